@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations per thread by replacing the global operator new, so a scope of code can be checked
+// for allocating, e.g. the draw loop, which must not allocate per frame. The array forms of new forward to it by
+// default; the sized and array forms of delete are replaced as well, since compilers call the sized one directly.
+// Include it from Main.cpp only: a program may replace them once.
+inline std::size_t& threadAllocations()
+{
+	static thread_local std::size_t allocations = 0;
+	return allocations;
+}
+
+void* operator new(std::size_t size)
+{
+	threadAllocations()++;
+	void* memory = std::malloc(size > 0 ? size : 1);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+	operator delete(memory);
+}
+
+// allocations made by the current thread while the scope is alive
+class AllocationScope
+{
+public:
+	AllocationScope() : start(threadAllocations()) {}
+
+	std::size_t Allocations() const { return threadAllocations() - start; }
+
+private:
+	std::size_t start;
+};
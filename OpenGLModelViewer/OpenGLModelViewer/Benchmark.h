@@ -0,0 +1,229 @@
+#pragma once
+
+#include <opengl/Model.h>
+#include <opengl/ThreadPool.h>
+#include <opengl/Timing.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Command line benchmarks for the loading pipeline. They run before the viewer window is created
+// and print their results to the console, e.g.
+//   OpenGLModelViewer.exe --bench-convert ./resources/multi_mesh.obj
+//   OpenGLModelViewer.exe --bench-obj ./resources/c3po.obj ./resources/source_models/hat.obj
+//   OpenGLModelViewer.exe --bench-profiles ./resources/c3po.obj
+//   OpenGLModelViewer.exe --bench-textures ./resources/textures/C3PO_Diffuse.jpg
+class Benchmark
+{
+public:
+	// runs the benchmark selected on the command line; returns false if none was requested
+	static bool Run(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			string option = argv[i];
+			string path = (i + 1 < argc) ? argv[i + 1] : "";
+			if (option == "--bench-convert")
+			{
+				MeshConversion(path.empty() ? "./resources/multi_mesh.obj" : path);
+				return true;
+			}
+			if (option == "--bench-profiles")
+			{
+				ImportProfiles(path.empty() ? "./resources/c3po.obj" : path);
+				return true;
+			}
+			if (option == "--bench-textures")
+			{
+				vector<string> paths(argv + i + 1, argv + argc);
+				if (paths.empty())
+				{
+					paths.push_back("./resources/textures/C3PO_Diffuse.jpg");
+					paths.push_back("./resources/textures/C3PO_Normal.jpg");
+					paths.push_back("./resources/textures/C3PO_Roughness.jpg");
+					paths.push_back("./resources/textures/C3PO_Specular.jpg");
+				}
+				for (unsigned int p = 0; p < paths.size(); p++)
+					TextureCompression(paths[p], paths[p].find("Normal") != string::npos ? NORMAL_TEXTURE : COLOR_TEXTURE);
+				return true;
+			}
+			if (option == "--bench-obj")
+			{
+				vector<string> paths(argv + i + 1, argv + argc);
+				if (paths.empty())
+				{
+					paths.push_back("./resources/c3po.obj");
+					paths.push_back("./resources/source_models/hat.obj");
+				}
+				for (unsigned int p = 0; p < paths.size(); p++)
+					ObjImport(paths[p]);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// times Model::ConvertScene on an already imported scene with 1, 2, 4, ... threads
+	static void MeshConversion(const string& path, int repetitions = 20)
+	{
+		Assimp::Importer importer;
+		const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+		{
+			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			return;
+		}
+
+		size_t vertexCount = 0;
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+			vertexCount += scene->mMeshes[i]->mNumVertices;
+		cout << "Mesh conversion: " << path << " (" << scene->mNumMeshes << " meshes, " << vertexCount << " vertices)" << endl;
+		cout << "threads\tbest ms\tspeedup" << endl;
+
+		unsigned int maxThreads = ThreadPool::Shared().Size() + 1;
+		double serialMilliseconds = 0.0;
+		for (unsigned int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+		{
+			double best = 1e30;
+			for (int r = 0; r < repetitions; r++)
+			{
+				vector<MeshData> meshes;
+				chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+				Model::ConvertScene(scene, meshes, nullptr, threads);
+				best = std::min(best, ElapsedMilliseconds(start));
+			}
+			if (threads == 1)
+				serialMilliseconds = best;
+			cout << threads << "\t" << best << "\t" << serialMilliseconds / best << "x" << endl;
+			if (threads == maxThreads)
+				break;
+		}
+	}
+
+	// compares the native ObjLoader against ASSIMP (import + conversion) on the same file, without the mesh cache
+	static void ObjImport(const string& path, int repetitions = 10)
+	{
+		cout << "OBJ import: " << path << endl;
+		cout << "loader\tbest ms\tmeshes\tvertices\tindices" << endl;
+
+		double assimpBest = 1e30;
+		vector<MeshData> meshes;
+		for (int r = 0; r < repetitions; r++)
+		{
+			chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			Assimp::Importer importer;
+			const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+			if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+			{
+				cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+				return;
+			}
+			Model::ConvertScene(scene, meshes);
+			assimpBest = std::min(assimpBest, ElapsedMilliseconds(start));
+		}
+		printResult("assimp", assimpBest, meshes);
+
+		double nativeBest = 1e30;
+		for (int r = 0; r < repetitions; r++)
+		{
+			chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			if (!ObjLoader::Load(path, meshes))
+			{
+				cout << "native\tunsupported, the viewer falls back to ASSIMP for this file" << endl;
+				return;
+			}
+			nativeBest = std::min(nativeBest, ElapsedMilliseconds(start));
+		}
+		printResult("native", nativeBest, meshes);
+		cout << "speedup\t" << assimpBest / nativeBest << "x" << endl;
+	}
+
+	// imports the file through ASSIMP with every import profile and prints the time of each step
+	static void ImportProfiles(const string& path)
+	{
+		ImportSettings settings;
+		settings.useMeshCache = false;
+		settings.useObjLoader = false;
+		for (unsigned int p = 0; p < IMPORT_PROFILE_COUNT; p++)
+		{
+			settings.profile = p;
+			ModelData data;
+			chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			if (!Model::Import(path, data, nullptr, settings))
+				return;
+			double total = ElapsedMilliseconds(start);
+			cout << "Import profile \"" << IMPORT_PROFILES[p].name << "\": " << total << " ms" << endl;
+			printResult("result", total, data.meshes);
+		}
+	}
+
+	// compares decoding the source image against loading its BCn bake, and the GPU memory of both
+	static void TextureCompression(const string& path, Texture_Usage usage, int repetitions = 5)
+	{
+		int width = 0, height = 0, nrComponents = 0;
+		double decodeBest = 1e30;
+		unsigned char* pixels = nullptr;
+		for (int r = 0; r < repetitions; r++)
+		{
+			stbi_image_free(pixels);
+			chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			pixels = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
+			decodeBest = std::min(decodeBest, ElapsedMilliseconds(start));
+		}
+		if (!pixels)
+		{
+			cout << "Texture failed to load at: " << path << endl;
+			return;
+		}
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		std::shared_ptr<BakedTexture> chain = TextureBaker::BuildMipChain(pixels, width, height, nrComponents, usage);
+		double mipMilliseconds = ElapsedMilliseconds(start);
+		stbi_image_free(pixels);
+		start = chrono::high_resolution_clock::now();
+		std::shared_ptr<BakedTexture> baked = TextureBaker::Compress(*chain, usage);
+		double bakeMilliseconds = ElapsedMilliseconds(start);
+
+		uint64_t sourceHash = 0;
+		MeshCache::HashSource(path, sourceHash);
+		string bakePath = TextureBaker::PathFor(sourceHash, usage);
+		TextureBaker::Write(bakePath, sourceHash, *baked);
+		double loadBest = 1e30;
+		for (int r = 0; r < repetitions; r++)
+		{
+			start = chrono::high_resolution_clock::now();
+			std::shared_ptr<BakedTexture> loaded = TextureBaker::Load(bakePath, sourceHash);
+			loadBest = std::min(loadBest, ElapsedMilliseconds(start));
+			if (!loaded)
+			{
+				cout << "ERROR::TEXTURE_BAKER:: could not read back " << bakePath << endl;
+				return;
+			}
+		}
+
+		double uncompressedMB = chain->data.size() / (1024.0 * 1024.0);
+		double compressedMB = baked->data.size() / (1024.0 * 1024.0);
+		cout << "Texture: " << path << " (" << width << "x" << height << ", " << nrComponents << " channels -> " << TextureBaker::FormatName(baked->format)
+			<< ", " << baked->levels.size() << " levels)" << endl;
+		cout << "  decode " << decodeBest << " ms, mip chain " << mipMilliseconds << " ms, bake " << bakeMilliseconds << " ms (" << ThreadPool::Shared().Size() + 1 << " threads), load bake " << loadBest << " ms" << endl;
+		cout << "  GPU memory " << uncompressedMB << " MB uncompressed, " << compressedMB << " MB compressed (" << uncompressedMB / compressedMB << "x smaller)" << endl;
+	}
+
+private:
+	static void printResult(const char* loader, double milliseconds, const vector<MeshData>& meshes)
+	{
+		size_t vertexCount = 0, indexCount = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			vertexCount += meshes[i].vertices.size();
+			indexCount += meshes[i].indices.size();
+		}
+		cout << loader << "\t" << milliseconds << "\t" << meshes.size() << "\t" << vertexCount << "\t" << indexCount << endl;
+	}
+};
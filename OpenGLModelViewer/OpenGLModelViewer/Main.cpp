@@ -30,8 +30,20 @@
 #include <opengl/Shader.h>
 #include <opengl/Camera.h>
 #include <opengl/Model.h>
+#include <opengl/AsyncModelLoader.h>
+#include <opengl/BatchRenderer.h>
+#include <opengl/RenderQueue.h>
+#include <opengl/FrustumCuller.h>
+#include <opengl/OcclusionCuller.h>
+#include <opengl/LodSelector.h>
+#include <opengl/MeshletCuller.h>
+#include <opengl/ModelPicker.h>
+#include <opengl/UniformBuffer.h>
+#include <opengl/GLState.h>
 #include <opengl/FileSystem.h>
 #include <ModelLoader.h>
+#include <Benchmark.h>
+#include <AllocationCounter.h>
 
 static void glfw_error_callback(int error, const char* description)
 {
@@ -44,6 +56,7 @@ void mousedown_callback(GLFWwindow* window, int button, int action, int mods);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
 void loadNewModel();
+void pickModel(float x, float y);
 
 // settings
 const unsigned int SCR_WIDTH = 1240;
@@ -68,6 +81,27 @@ int mouseButton = GLFW_MOUSE_BUTTON_LEFT;
 // camera
 Camera camera(glm::vec3(0.0f, -0.4f, 3.0f));
 Model previewModel;
+AsyncModelLoader modelLoader;
+ImportSettings importSettings;
+BatchRenderer batchRenderer;
+bool batchDraws = true;
+RenderQueue renderQueue;
+bool sortDraws = true; // unbatched draws go through the render queue instead of the mesh order
+FrustumCuller frustumCuller;
+bool cullMeshes = true;
+OcclusionCuller occlusionCuller;
+bool occlusionCulling = false; // only pays off when large meshes hide many others
+bool showOcclusionBuffer = false;
+unsigned int occlusionTexture = 0; // the occlusion buffer for the debug view
+std::vector<unsigned char> occlusionImage;
+LodSelector lodSelector;
+MeshletCuller meshletCuller;
+bool meshletCulling = false; // draws the meshes' surviving meshlets instead of batching them
+ModelPicker modelPicker;
+// where the viewport image is on screen and the transforms of the last frame, for picking
+ImVec2 viewportImageMin, viewportClipMin, viewportClipMax;
+glm::mat4 viewportProjection, viewportView, viewportModel;
+std::size_t drawAllocations = 0; // heap allocations of the last frame's model draw
 
 // timing
 float deltaTime = 0.0f;
@@ -76,7 +110,7 @@ float lastFrame = 0.0f;
 // lighting
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
 	// Setup window
 	glfwSetErrorCallback(glfw_error_callback);
@@ -101,6 +135,25 @@ int main(int, char**)
 	// Load debug window
 	ModelLoader::InitDebugConsole();
 
+	// import profile: --profile full|fast
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) != "--profile")
+			continue;
+		int profile = FindImportProfile(argv[i + 1]);
+		if (profile >= 0)
+			importSettings.profile = (unsigned int)profile;
+		else
+			std::cout << "ERROR::COMMAND_LINE:: unknown import profile " << argv[i + 1] << std::endl;
+	}
+
+	// command line benchmarks run headless and exit
+	if (Benchmark::Run(argc, argv))
+	{
+		glfwTerminate();
+		return 0;
+	}
+
 	// Create window with graphics context
 	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LiveCam FIlter Viewer", NULL, NULL);
 	if (window == NULL)
@@ -136,18 +189,28 @@ int main(int, char**)
 		return 1;
 	}
 
-	// configure global opengl state
+	// configure global opengl state; the renderer changes it through GLState, which skips redundant calls
 	// -----------------------------
-	glEnable(GL_DEPTH_TEST);
+	GLState& glState = GLState::Current();
+	glState.Enable(GL_DEPTH_TEST);
 
 	// build and compile shaders
 	// -------------------------
 	Shader modelShader("shaders/material.vert", "shaders/material.frag");
 	Shader lampShader("shaders/lamp.vert", "shaders/lamp.frag");
+	modelShader.BindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+	modelShader.BindUniformBlock("Light", LIGHT_BLOCK_BINDING);
+	modelShader.BindUniformBlock("Material", MATERIAL_BLOCK_BINDING);
+	modelShader.BindUniformBlock("Draw", DRAW_BLOCK_BINDING);
+	lampShader.BindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+	UniformBuffer<CameraBlock> cameraBuffer(CAMERA_BLOCK_BINDING);
+	UniformBuffer<LightBlock> lightBuffer(LIGHT_BLOCK_BINDING);
+	UniformBuffer<MaterialBlock> materialBuffer(MATERIAL_BLOCK_BINDING);
+	UniformBuffer<DrawBlock> drawBuffer(DRAW_BLOCK_BINDING);
 
 	// load models
 	// -----------
-	previewModel.Load(modelPath);
+	modelLoader.Start(modelPath, importSettings);
 
 	// Setup Dear ImGui context
 	IMGUI_CHECKVERSION();
@@ -166,11 +229,11 @@ int main(int, char**)
 	// -------------------------
 	unsigned int framebuffer;
 	glGenFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glState.BindFramebuffer(framebuffer);
 	// create a color attachment texture
 	unsigned int textureColorbuffer;
 	glGenTextures(1, &textureColorbuffer);
-	glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
+	glState.BindTexture(textureColorbuffer);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, OUTPUT_WIDTH, OUTPUT_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -181,9 +244,9 @@ int main(int, char**)
 	// second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
 	unsigned int lightVAO;
 	glGenVertexArrays(1, &lightVAO);
-	glBindVertexArray(lightVAO);
+	glState.BindVertexArray(lightVAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, framebuffer);
+	glState.BindBuffer(GL_ARRAY_BUFFER, framebuffer);
 	// note that we update the lamp's position attribute's stride to reflect the updated buffer data
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -199,6 +262,7 @@ int main(int, char**)
 	// Main loop
 	while (!glfwWindowShouldClose(window))
 	{
+		glState.BeginFrame();
 		processInput(window);
 
 		glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
@@ -210,6 +274,11 @@ int main(int, char**)
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
+		// pick up meshes finished by the background loader
+		modelLoader.Update(previewModel);
+		previewModel.UpdateTextures();
+		modelLoading = modelLoader.IsLoading();
+
 		// Start the Dear ImGui frame
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
@@ -233,10 +302,10 @@ int main(int, char**)
 
 			// render
 			// ------
-			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-			glEnable(GL_DEPTH_TEST);
-			glDisable(GL_BLEND);
-			glDisable(GL_CULL_FACE);
+			glState.BindFramebuffer(framebuffer);
+			glState.Enable(GL_DEPTH_TEST);
+			glState.Disable(GL_BLEND);
+			glState.Disable(GL_CULL_FACE);
 
 			// make sure we clear the framebuffer's content
 			glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
@@ -250,26 +319,31 @@ int main(int, char**)
 			float specVal = (blinn) ? 0.8f : 0.1f;
 			float shininess = (blinn) ? 32.0f : 5.0f;
 
-			// set light uniforms
-			modelShader.setInt("blinn", blinn);
-			modelShader.setVec3("light.position", lightPos);
-			modelShader.setVec3("viewPos", camera.Position);
-
+			// the uniform blocks only upload what changed since the last frame
 			// light properties
-			modelShader.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-			modelShader.setVec3("light.diffuse", 0.8f, 0.8f, 0.8f);
-			modelShader.setVec3("light.specular", specVal, specVal, specVal);
+			LightBlock lightData = {};
+			lightData.position = glm::vec4(lightPos, 1.0f);
+			lightData.ambient = glm::vec4(0.2f, 0.2f, 0.2f, 0.0f);
+			lightData.diffuse = glm::vec4(0.8f, 0.8f, 0.8f, 0.0f);
+			lightData.specular = glm::vec3(specVal, specVal, specVal);
+			lightData.blinn = blinn;
+			lightBuffer.Update(lightData);
 
 			// material properties
-			modelShader.setVec3("material.ambient", 0.4f, 0.4f, 0.4f);
-			modelShader.setVec3("material.specular", 0.6f, 0.6f, 0.6f); // specular lighting doesn't have full effect on this object's material
-			modelShader.setFloat("material.shininess", shininess);
+			MaterialBlock materialData = {};
+			materialData.ambient = glm::vec4(0.4f, 0.4f, 0.4f, 0.0f);
+			materialData.specular = glm::vec3(0.6f, 0.6f, 0.6f); // specular lighting doesn't have full effect on this object's material
+			materialData.shininess = shininess;
+			materialBuffer.Update(materialData);
 
 			// view/projection transformations
 			glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)OUTPUT_WIDTH / (float)OUTPUT_HEIGHT, 0.1f, 100.0f);
 			glm::mat4 view = camera.GetViewMatrix();
-			modelShader.setMat4("projection", projection);
-			modelShader.setMat4("view", view);
+			CameraBlock cameraData = {};
+			cameraData.projection = projection;
+			cameraData.view = view;
+			cameraData.viewPos = glm::vec4(camera.Position, 1.0f);
+			cameraBuffer.Update(cameraData);
 
 			// render the loaded model
 			glm::mat4 model = glm::mat4(1.0f);
@@ -278,12 +352,46 @@ int main(int, char**)
 			model = glm::rotate(model, camera.SliderRotation.x, glm::vec3(0.1f, 0.0f, 0.0f));
 			model = glm::rotate(model, camera.SliderRotation.y, glm::vec3(0.0f, 0.1f, 0.0f));
 			model = glm::rotate(model, camera.SliderRotation.z, glm::vec3(0.0f, 0.0f, 0.1f));
-			modelShader.setMat4("model", model);
-
-			// draw the meshes
-			previewModel.Draw(modelShader);
+			DrawBlock drawData = {};
+			drawData.model = model;
+			drawData.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+			drawBuffer.Update(drawData);
+
+			viewportProjection = projection;
+			viewportView = view;
+			viewportModel = model;
+
+			// draw the meshes inside the view frustum that the occluders leave visible
+			AllocationScope drawScope;
+			const unsigned char* visible = nullptr;
+			if (cullMeshes && !previewModel.meshes.empty())
+				visible = &frustumCuller.Cull(previewModel, model, projection * view)[0];
+			if (occlusionCulling && !previewModel.meshes.empty())
+				visible = &occlusionCuller.Cull(previewModel, model, projection * view, visible)[0];
+			lodSelector.Select(previewModel, model, view, projection, (float)OUTPUT_HEIGHT, visible);
+			if (meshletCulling)
+			{
+				meshletCuller.Cull(previewModel, model, view, projection, visible);
+				// cone culling drops the meshlets that face away, so the back faces of the rest must go as well
+				if (meshletCuller.ConeCulling)
+					glState.Enable(GL_CULL_FACE);
+				meshletCuller.Draw(previewModel, modelShader);
+				glState.Disable(GL_CULL_FACE);
+			}
+			else if (batchDraws)
+				batchRenderer.Draw(previewModel, modelShader, visible);
+			else if (sortDraws)
+			{
+				renderQueue.Clear();
+				renderQueue.Submit(previewModel, modelShader, view * model, visible);
+				renderQueue.Sort();
+				renderQueue.Draw(previewModel, modelShader);
+			}
+			else
+				previewModel.Draw(modelShader, visible);
+			drawAllocations = drawScope.Allocations();
 
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glState.BindFramebuffer(0);
 			/*glDisable(GL_DEPTH_TEST);
 
 			glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -291,19 +399,20 @@ int main(int, char**)
 
 			// also draw the lamp object
 			lampShader.use();
-			lampShader.setMat4("projection", projection);
-			lampShader.setMat4("view", view);
 			model = glm::mat4(1.0f);
 			model = glm::translate(model, lightPos);
 			model = glm::scale(model, glm::vec3(0.2f)); // a smaller cube
 			lampShader.setMat4("model", model);
 
-			glBindVertexArray(lightVAO);
+			glState.BindVertexArray(lightVAO);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
 
 			glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
 			ImVec2 pos = ImGui::GetCursorScreenPos();
+			viewportImageMin = pos;
+			viewportClipMin = ImGui::GetWindowPos();
+			viewportClipMax = ImVec2(viewportClipMin.x + ImGui::GetWindowSize().x, viewportClipMin.y + ImGui::GetWindowSize().y);
 
 			ImGui::GetWindowDrawList()->AddImage(
 				(void*)textureColorbuffer, ImVec2(ImGui::GetCursorScreenPos()),
@@ -327,6 +436,278 @@ int main(int, char**)
 
 			ImGui::SameLine();
 			ImGui::Text(modelPath.c_str());
+			if (modelLoading)
+			{
+				ImGui::ProgressBar(modelLoader.Progress(), ImVec2(-80.0f, 0.0f), modelLoader.Stage());
+				ImGui::SameLine();
+				if (ImGui::Button("Cancel"))
+					modelLoader.Cancel();
+				if (modelLoader.FirstPixelMilliseconds() > 0.0)
+					ImGui::Text("First pixel: %.1f ms", modelLoader.FirstPixelMilliseconds());
+			}
+			else
+			{
+				// until the model was at full detail; a progressive load showed a preview after the first pixel time
+				ImGui::Text("Load time: %.1f ms, first pixel %.1f ms (mesh cache %s)", previewModel.loadMilliseconds, previewModel.firstPixelMilliseconds, previewModel.loadedFromCache ? "hit" : "miss");
+				ImGui::Text("Geometry: %.1f MB GPU, %.1f MB CPU", previewModel.GeometryBytes() / (1024.0 * 1024.0), previewModel.ResidentGeometryBytes() / (1024.0 * 1024.0));
+				if (previewModel.importSettings.vertexFormat == PACKED_VERTEX)
+					ImGui::Text("Packed vertices save %.1f MB of %.1f MB", (previewModel.FullGeometryBytes() - previewModel.GeometryBytes()) / (1024.0 * 1024.0), previewModel.FullGeometryBytes() / (1024.0 * 1024.0));
+			}
+
+			if (ImGui::CollapsingHeader("Import"))
+			{
+				int profile = (int)importSettings.profile;
+				if (ImGui::Combo("Profile", &profile, [](void*, int i, const char** name) { *name = IMPORT_PROFILES[i].name; return true; }, nullptr, IMPORT_PROFILE_COUNT))
+					importSettings.profile = (unsigned int)profile;
+				ImGui::Checkbox("Mesh cache", &importSettings.useMeshCache);
+				ImGui::SameLine();
+				ImGui::Checkbox("Native OBJ loader", &importSettings.useObjLoader);
+				ImGui::Checkbox("Progressive loading", &modelLoader.Progressive);
+				bool keepGeometry = importSettings.residency == KEEP_GEOMETRY;
+				if (ImGui::Checkbox("Keep CPU geometry", &keepGeometry))
+					importSettings.residency = keepGeometry ? KEEP_GEOMETRY : RELEASE_GEOMETRY;
+				ImGui::Checkbox("Optimize meshes", &importSettings.optimizeMeshes);
+				ImGui::Checkbox("Generate LODs", &importSettings.generateLods);
+				if (importSettings.generateLods)
+				{
+					int lodLevels = (int)importSettings.lodLevels;
+					if (ImGui::SliderInt("Levels", &lodLevels, 2, MAX_LOD_LEVELS))
+						importSettings.lodLevels = (unsigned int)lodLevels;
+					ImGui::Checkbox("Attribute aware", &importSettings.simplify.attributeAware);
+					ImGui::SameLine();
+					ImGui::Checkbox("Preserve borders", &importSettings.simplify.preserveBorders);
+				}
+				ImGui::Checkbox("Build meshlets", &importSettings.buildMeshlets);
+				bool packedVertices = importSettings.vertexFormat == PACKED_VERTEX;
+				if (ImGui::Checkbox("Packed vertices", &packedVertices))
+					importSettings.vertexFormat = packedVertices ? PACKED_VERTEX : FULL_VERTEX;
+				if (ImGui::Button("Reload"))
+					modelLoader.Start(modelPath, importSettings);
+				for (unsigned int i = 0; i < previewModel.importTimings.size(); i++)
+					ImGui::Text("%-26s %8.2f ms", previewModel.importTimings[i].step.c_str(), previewModel.importTimings[i].milliseconds);
+			}
+
+			if (ImGui::CollapsingHeader("Rendering"))
+			{
+				ImGui::Checkbox("Batch draws", &batchDraws);
+				ImGui::Checkbox("Frustum culling", &cullMeshes);
+				if (cullMeshes)
+				{
+					CullStats cullStats = frustumCuller.Stats();
+					ImGui::Text("Meshes drawn: %u, culled: %u (%.3f ms)", cullStats.tested - cullStats.culled, cullStats.culled, cullStats.milliseconds);
+					ImGui::Text("  rejected by sphere %u, box %u, oriented box %u", cullStats.culledBySphere, cullStats.culledByBox, cullStats.culledByOrientedBox);
+					float boxVolume = 0.0f, orientedVolume = 0.0f;
+					for (unsigned int i = 0; i < previewModel.meshes.size(); i++)
+					{
+						const MeshBounds& bounds = previewModel.meshes[i].bounds;
+						glm::vec3 size = bounds.maximum - bounds.minimum;
+						boxVolume += size.x * size.y * size.z;
+						orientedVolume += bounds.orientedBox.Volume();
+					}
+					if (boxVolume > 0.0f)
+						ImGui::Text("  oriented boxes: %.0f%% of the box volume", 100.0f * orientedVolume / boxVolume);
+				}
+				ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+				if (occlusionCulling)
+				{
+					OcclusionStats occlusionStats = occlusionCuller.Stats();
+					ImGui::Text("Meshes occluded: %u of %u (test %.3f ms)", occlusionStats.occluded, occlusionStats.tested, occlusionStats.testMilliseconds);
+					ImGui::Text("  %u occluders, %u of %u triangles rasterized (%.3f ms)", occlusionStats.occluders, occlusionStats.rasterizedTriangles,
+						occlusionStats.occluderTriangles, occlusionStats.rasterMilliseconds);
+					ImGui::Checkbox("Show occlusion buffer", &showOcclusionBuffer);
+					if (showOcclusionBuffer)
+					{
+						if (occlusionTexture == 0)
+						{
+							glGenTextures(1, &occlusionTexture);
+							glState.BindTexture(occlusionTexture);
+							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+						}
+						occlusionCuller.Buffer().DebugImage(occlusionImage);
+						glState.BindTexture(occlusionTexture);
+						glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, OcclusionBuffer::WIDTH, OcclusionBuffer::HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, &occlusionImage[0]);
+						float width = ImGui::GetContentRegionAvail().x;
+						ImGui::Image((void*)(intptr_t)occlusionTexture, ImVec2(width, width * OcclusionBuffer::HEIGHT / OcclusionBuffer::WIDTH));
+					}
+				}
+				if (BatchRenderer::MultiDrawIndirectSupported())
+					ImGui::Checkbox("Multi-draw indirect", &batchRenderer.UseMultiDrawIndirect);
+				else
+					ImGui::Text("Multi-draw indirect: not supported, using base-vertex draws");
+				BatchStats stats = batchRenderer.Stats();
+				if (meshletCulling)
+					ImGui::Text("Draw calls: %u, culled per meshlet (see Meshlets)", meshletCuller.Stats().drawCalls);
+				else if (batchDraws)
+					ImGui::Text("Draw calls: %u (%u unbatched), %u batches in %u buffers", stats.drawCalls, (unsigned int)previewModel.meshes.size(), stats.batches, stats.buffers);
+				else
+				{
+					unsigned int culled = (cullMeshes ? frustumCuller.Stats().culled : 0) + (occlusionCulling ? occlusionCuller.Stats().occluded : 0);
+					ImGui::Text("Draw calls: %u", (unsigned int)previewModel.meshes.size() - culled);
+					ImGui::Checkbox("Sort draws", &sortDraws);
+					if (sortDraws)
+					{
+						RenderQueueStats queueStats = renderQueue.Stats();
+						ImGui::Text("Render queue: %u commands, %u material and %u VAO changes", queueStats.commands, queueStats.materialChanges, queueStats.vertexArrayChanges);
+						ImGui::Text("  keys %.3f ms, sort %.3f ms, submit %.3f ms", queueStats.buildMilliseconds, queueStats.sortMilliseconds, queueStats.submitMilliseconds);
+					}
+				}
+				// zero once bindings and batches are built; a rebuild after a load or texture swap allocates for one frame
+				ImGui::Text("Draw loop allocations: %u", (unsigned int)drawAllocations);
+				ImGui::Text("Uniform block uploads (skipped): camera %u (%u), light %u (%u)", cameraBuffer.uploads, cameraBuffer.skipped, lightBuffer.uploads, lightBuffer.skipped);
+				ImGui::Text("  material %u (%u), draw %u (%u)", materialBuffer.uploads, materialBuffer.skipped, drawBuffer.uploads, drawBuffer.skipped);
+				// calls of the previous frame that went through GLState
+				GLStateStats glStats = glState.LastFrame();
+				ImGui::Text("GL state calls: %u issued, %u elided", glStats.Issued(), glStats.Elided());
+				ImGui::Text("  binds %u (%u), enables %u (%u), uniforms %u (%u)", glStats.issued[STATE_BIND], glStats.elided[STATE_BIND],
+					glStats.issued[STATE_ENABLE], glStats.elided[STATE_ENABLE], glStats.issued[STATE_UNIFORM], glStats.elided[STATE_UNIFORM]);
+			}
+
+			if (ImGui::CollapsingHeader("Picking"))
+			{
+				size_t bvhBytes = 0, bvhNodes = 0;
+				for (unsigned int i = 0; i < previewModel.meshes.size(); i++)
+				{
+					bvhBytes += previewModel.meshes[i].bvh.MemoryBytes();
+					bvhNodes += previewModel.meshes[i].bvh.NodeCount();
+				}
+				ImGui::Text("Triangle BVHs: %u nodes, %.2f MB (build time under Import timings)", (unsigned int)bvhNodes, bvhBytes / (1024.0f * 1024.0f));
+				ImGui::Text("Mesh BVH build: %.3f ms", modelPicker.BuildMilliseconds());
+				PickResult pick = modelPicker.LastPick();
+				if (pick.hit)
+				{
+					ImGui::Text("Hit mesh %u, triangle %u", pick.mesh, pick.triangle);
+					ImGui::Text("  at (%.3f, %.3f, %.3f)", pick.point.x, pick.point.y, pick.point.z);
+				}
+				else
+					ImGui::Text("Left click the model to pick a triangle");
+				ImGui::Text("Query: %.4f ms", pick.milliseconds);
+			}
+
+			if (ImGui::CollapsingHeader("Mesh optimizer"))
+			{
+				const std::vector<MeshOptimizationStats>& optimization = previewModel.optimizationStats;
+				if (optimization.empty())
+					ImGui::TextWrapped("No statistics: the meshes weren't optimized. Turn on Optimize meshes and reload to measure them.");
+				else
+				{
+					// cache metrics are per triangle / vertex, overdraw per covered pixel
+					ImGui::Columns(5, "optimizer");
+					ImGui::Text("Mesh"); ImGui::NextColumn();
+					ImGui::Text("ACMR"); ImGui::NextColumn();
+					ImGui::Text("ATVR"); ImGui::NextColumn();
+					ImGui::Text("Overdraw"); ImGui::NextColumn();
+					ImGui::Text("Time"); ImGui::NextColumn();
+					ImGui::Separator();
+					for (unsigned int i = 0; i < optimization.size(); i++)
+					{
+						const MeshOptimizationStats& mesh = optimization[i];
+						ImGui::Text("%u (%u tris)", i, mesh.triangles); ImGui::NextColumn();
+						ImGui::Text("%.3f > %.3f", mesh.before.acmr, mesh.after.acmr); ImGui::NextColumn();
+						ImGui::Text("%.3f > %.3f", mesh.before.atvr, mesh.after.atvr); ImGui::NextColumn();
+						ImGui::Text("%.3f > %.3f", mesh.overdrawBefore, mesh.overdrawAfter); ImGui::NextColumn();
+						ImGui::Text("%.2f ms", mesh.milliseconds); ImGui::NextColumn();
+					}
+					ImGui::Columns(1);
+				}
+			}
+
+			if (ImGui::CollapsingHeader("Level of detail"))
+			{
+				// triangles and the largest error of every level, over all meshes
+				size_t levelTriangles[MAX_LOD_LEVELS] = {};
+				float levelErrors[MAX_LOD_LEVELS] = {};
+				unsigned int levels = 1;
+				for (unsigned int i = 0; i < previewModel.meshes.size(); i++)
+				{
+					const std::vector<MeshLod>& lods = previewModel.meshes[i].lods;
+					levels = std::max(levels, (unsigned int)lods.size());
+					for (unsigned int l = 0; l < MAX_LOD_LEVELS; l++)
+					{
+						// meshes with fewer levels draw their coarsest one in its place
+						const MeshLod& lod = lods[std::min<size_t>(l, lods.size() - 1)];
+						levelTriangles[l] += lod.indexCount / 3;
+						levelErrors[l] = std::max(levelErrors[l], lod.error);
+					}
+				}
+				LodStats lodStats = lodSelector.Stats();
+				ImGui::Columns(4, "lods");
+				ImGui::Text("Level"); ImGui::NextColumn();
+				ImGui::Text("Triangles"); ImGui::NextColumn();
+				ImGui::Text("Error"); ImGui::NextColumn();
+				ImGui::Text("Meshes drawn"); ImGui::NextColumn();
+				ImGui::Separator();
+				for (unsigned int l = 0; l < levels; l++)
+				{
+					ImGui::Text("%u", l); ImGui::NextColumn();
+					ImGui::Text("%u", (unsigned int)levelTriangles[l]); ImGui::NextColumn();
+					ImGui::Text("%.5f", levelErrors[l]); ImGui::NextColumn();
+					ImGui::Text("%u", lodStats.meshesAtLevel[l]); ImGui::NextColumn();
+				}
+				ImGui::Columns(1);
+				ImGui::SliderInt("Forced level", &lodSelector.ForcedLevel, -1, (int)levels - 1, lodSelector.ForcedLevel < 0 ? "auto" : "%d");
+				ImGui::SliderFloat("Max error (px)", &lodSelector.MaxScreenError, 0.1f, 16.0f, "%.1f", 2.0f);
+				ImGui::Text("Drawing %u of %u triangles (%.0f%%)", (unsigned int)lodStats.triangles, (unsigned int)lodStats.fullTriangles, lodStats.fullTriangles > 0 ? 100.0 * lodStats.triangles / lodStats.fullTriangles : 0.0);
+				ImGui::Text("Selection: %.4f ms", lodStats.milliseconds);
+			}
+
+			if (ImGui::CollapsingHeader("Meshlets"))
+			{
+				unsigned int meshlets = 0, meshletVertices = 0;
+				for (unsigned int i = 0; i < previewModel.meshes.size(); i++)
+				{
+					meshlets += (unsigned int)previewModel.meshes[i].meshlets.size();
+					for (unsigned int j = 0; j < previewModel.meshes[i].meshlets.size(); j++)
+						meshletVertices += previewModel.meshes[i].meshlets[j].vertexCount;
+				}
+				if (meshlets == 0)
+					ImGui::TextWrapped("The model has no meshlets. Check \"Build meshlets\" under Import and reload.");
+				else
+					ImGui::Text("%u meshlets, %.1f vertices each", meshlets, (float)meshletVertices / meshlets);
+				ImGui::Checkbox("Meshlet culling", &meshletCulling);
+				if (meshletCulling)
+				{
+					ImGui::Checkbox("Frustum", &meshletCuller.FrustumCulling);
+					ImGui::SameLine();
+					ImGui::Checkbox("Backface cones", &meshletCuller.ConeCulling);
+					MeshletStats meshletStats = meshletCuller.Stats();
+					ImGui::Text("Culled %u of %u: frustum %u, cone %u (%.3f ms)", meshletStats.culledByFrustum + meshletStats.culledByCone, meshletStats.meshlets,
+						meshletStats.culledByFrustum, meshletStats.culledByCone, meshletStats.milliseconds);
+					ImGui::Text("Drawing %u of %u triangles in %u ranges", (unsigned int)meshletStats.triangles, (unsigned int)meshletStats.fullTriangles, meshletStats.ranges);
+				}
+			}
+
+			if (ImGui::CollapsingHeader("Textures"))
+			{
+				TextureCache& textureCache = TextureCache::Shared();
+				TextureCacheStats stats = textureCache.Stats();
+				ImGui::Text("GPU: %u textures (%u in use), %.1f MB", stats.gpuTextures, stats.referencedTextures, stats.gpuBytes / (1024.0 * 1024.0));
+				ImGui::Text("CPU: %u images, %.1f MB, %u decoding", stats.cpuImages, stats.cpuBytes / (1024.0 * 1024.0), stats.decoding);
+				ImGui::Text("Hits: %u  Misses: %u  Evictions: %u GPU, %u CPU", stats.hits, stats.misses, stats.gpuEvictions, stats.cpuEvictions);
+				ImGui::Text("Files: %u, %u with unique contents", stats.files, stats.uniqueFiles);
+				ImGui::Text("Mip chains: %u in %.0f ms, baked: %u in %.0f ms", stats.mipChains, stats.mipMilliseconds, stats.baked, stats.bakeMilliseconds);
+				ImGui::Text("Capped by max dimension: %u", stats.cappedTextures);
+				const char* dimensions[] = { "No limit", "4096", "2048", "1024", "512", "256" };
+				const int dimensionValues[] = { 0, 4096, 2048, 1024, 512, 256 };
+				int dimension = 0;
+				while (dimension < 5 && dimensionValues[dimension] != textureCache.MaxTextureDimension)
+					dimension++;
+				if (ImGui::Combo("Max dimension", &dimension, dimensions, 6))
+					textureCache.MaxTextureDimension = dimensionValues[dimension];
+				bool compress = textureCache.CompressTextures;
+				if (ImGui::Checkbox("Compress textures (BCn)", &compress))
+					textureCache.CompressTextures = compress;
+				int gpuBudget = (int)(textureCache.GpuBudgetBytes >> 20);
+				int cpuBudget = (int)(textureCache.CpuBudgetBytes >> 20);
+				bool budgetChanged = ImGui::SliderInt("GPU budget (MB)", &gpuBudget, 16, 4096);
+				budgetChanged |= ImGui::SliderInt("CPU budget (MB)", &cpuBudget, 0, 4096);
+				if (budgetChanged)
+				{
+					textureCache.GpuBudgetBytes = (size_t)gpuBudget << 20;
+					textureCache.CpuBudgetBytes = (size_t)cpuBudget << 20;
+					textureCache.Trim();
+				}
+			}
 
 			ImGui::Text("PITCH: %f", camera.Pitch);
 			ImGui::Text("YAW: %f", camera.Yaw);
@@ -394,6 +775,17 @@ int main(int, char**)
 	}
 
 	// Cleanup
+	// release the models' textures while the GL context is still alive
+	modelLoader.Shutdown();
+	previewModel = Model();
+	batchRenderer.Clear();
+	cameraBuffer.Clear();
+	lightBuffer.Clear();
+	materialBuffer.Clear();
+	drawBuffer.Clear();
+	TextureCache::Shared().Clear();
+	glState.DeleteTexture(occlusionTexture);
+
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
@@ -408,9 +800,13 @@ int main(int, char**)
 // ---------------------------------------------------------------------------------------------------------
 void loadNewModel()
 {
+	std::string path = ModelLoader::openfilename();
+	if (path.empty())
+		return;
 	camera.Reset();
-	modelPath = ModelLoader::openfilename();
-	previewModel.Load(modelPath);
+	modelPath = path;
+	// the current model keeps rendering until the new one has been uploaded
+	modelLoader.Start(modelPath, importSettings);
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -469,6 +865,27 @@ void mousedown_callback(GLFWwindow* window, int button, int action, int mods)
 	{
 		isDragging = (action == GLFW_PRESS);
 	}
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+	{
+		double xpos, ypos;
+		glfwGetCursorPos(window, &xpos, &ypos);
+		if (xpos >= viewportClipMin.x && xpos < viewportClipMax.x && ypos >= viewportClipMin.y && ypos < viewportClipMax.y)
+			pickModel((float)xpos, (float)ypos);
+	}
+}
+
+// casts a ray from a point of the viewport image into the scene as the last frame rendered it
+void pickModel(float x, float y)
+{
+	// the scene is rendered with a SCR_WIDTH x SCR_HEIGHT viewport into the OUTPUT_WIDTH x OUTPUT_HEIGHT texture,
+	// and the image shows the texture 1:1 horizontally and flipped over SCR_HEIGHT pixels vertically
+	float texelX = x - viewportImageMin.x;
+	float texelY = (1.0f - (y - viewportImageMin.y) / SCR_HEIGHT) * OUTPUT_HEIGHT;
+	glm::vec2 ndc(texelX / SCR_WIDTH * 2.0f - 1.0f, texelY / SCR_HEIGHT * 2.0f - 1.0f);
+	Ray ray = ModelPicker::ViewportRay(ndc, viewportProjection, viewportView);
+	PickResult pick = modelPicker.Pick(previewModel, viewportModel, ray);
+	if (pick.hit)
+		std::cout << "PICK::HIT mesh " << pick.mesh << " triangle " << pick.triangle << " at (" << pick.point.x << ", " << pick.point.y << ", " << pick.point.z << ") in " << pick.milliseconds << " ms" << std::endl;
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
@@ -0,0 +1,338 @@
+#ifndef ASYNC_MODEL_LOADER_H
+#define ASYNC_MODEL_LOADER_H
+
+#include <opengl/model.h>
+#include <opengl/Timing.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// State shared between the worker thread of one load and the render thread
+struct ModelLoadJob
+{
+	std::string path;
+	std::string directory; // the one Model::Import will report
+	ImportSettings settings;
+	LoadProgress progress;
+	std::chrono::high_resolution_clock::time_point started;
+
+	// imported meshes waiting for their GL upload; guarded by queueMutex
+	std::mutex queueMutex;
+	std::deque<MeshData> queue;
+	unsigned int meshCount = 0;
+	bool fromCache = false;
+	std::vector<ImportTiming> timings;
+	std::vector<MeshOptimizationStats> optimization;
+	// the latest preview from Model::Import that hasn't been shown yet; guarded by queueMutex
+	std::vector<MeshData> preview;
+	bool previewReady = false;
+	Preview_Stage previewStage = BOX_PREVIEW;
+
+	std::atomic<bool> imported{ false }; // every mesh has been queued (or the import failed)
+	std::atomic<bool> failed{ false };
+	std::atomic<bool> finished{ false }; // the worker thread has returned and can be joined
+};
+
+// Imports models on a background thread and uploads the results on the GL thread a few meshes per frame.
+// Without Progressive the target model keeps rendering until the new one is complete. With it, the previews
+// Model::Import hands out replace the target as soon as they arrive, and the full meshes then take the place of
+// their stand-ins one by one, so the camera can move around the model while it refines. The model the target
+// showed before is kept until the new one is complete and comes back if the load is cancelled or fails.
+// Starting another load cancels the one in flight.
+class AsyncModelLoader
+{
+public:
+	// time the GL thread may spend uploading meshes per Update call
+	double UploadBudgetMilliseconds = 4.0;
+	// show the import's previews first and refine them in place
+	bool Progressive = true;
+
+	AsyncModelLoader() {}
+	// the GL context may already be gone here, so the pending buffers are left to it; call Shutdown first
+	~AsyncModelLoader()
+	{
+		if (job)
+		{
+			job->progress.cancelled = true;
+			retire();
+		}
+		joinRetired();
+	}
+
+	AsyncModelLoader(const AsyncModelLoader&) = delete;
+	AsyncModelLoader& operator=(const AsyncModelLoader&) = delete;
+
+	// begins loading 'path' in the background, cancelling any load still in flight
+	void Start(const std::string& path, const ImportSettings& settings = ImportSettings())
+	{
+		Cancel();
+
+		job = std::make_shared<ModelLoadJob>();
+		job->path = path;
+		job->settings = settings;
+		job->started = std::chrono::high_resolution_clock::now();
+		job->directory = path.substr(0, path.find_last_of("/\\"));
+		uploaded = 0;
+		firstPixelMilliseconds = 0.0;
+		pending = Model();
+		pending.importSettings = settings;
+		pending.directory = job->directory;
+
+		std::shared_ptr<ModelLoadJob> workerJob = job;
+		bool progressive = Progressive;
+		worker = std::thread([workerJob, progressive]() { run(workerJob, progressive); });
+	}
+
+	// abandons the current load; the worker stops at its next cancellation point and is joined later
+	void Cancel()
+	{
+		if (!job)
+			return;
+		job->progress.cancelled = true;
+		retire();
+		dropPending();
+		endPreview(true);
+	}
+
+	// cancels the current load and blocks until every worker, retired ones included, has returned and the
+	// texture decodes they started have finished. Call on the GL thread before the context is destroyed.
+	void Shutdown()
+	{
+		Cancel();
+		joinRetired();
+		TextureCache::Shared().WaitForDecodes();
+	}
+
+	// call once per frame on the GL thread, always with the same target. Shows a new preview, uploads queued
+	// meshes within the time budget and swaps the finished model into 'target'. Returns true on the frame the
+	// new model (or its preview) becomes visible.
+	bool Update(Model& target)
+	{
+		reapRetired();
+		if (!job)
+			return false;
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		bool shown = showPreview(target);
+		for (;;)
+		{
+			MeshData mesh;
+			{
+				std::lock_guard<std::mutex> lock(job->queueMutex);
+				if (job->queue.empty())
+					break;
+				mesh = std::move(job->queue.front());
+				job->queue.pop_front();
+			}
+			// once a preview is showing, each full mesh replaces its stand-in in the target
+			if (refining && uploaded < refining->meshes.size())
+				refining->ReplaceMesh(uploaded, std::move(mesh));
+			else
+				pending.AddMesh(std::move(mesh));
+			uploaded++;
+			if (ElapsedMilliseconds(start) >= UploadBudgetMilliseconds)
+				break;
+		}
+
+		if (!job->imported)
+			return shown;
+		if (job->failed)
+		{
+			std::cout << "ERROR::MODEL_LOADER:: failed to load " << job->path << std::endl;
+			retire();
+			dropPending();
+			endPreview(true);
+			return false;
+		}
+		{
+			std::lock_guard<std::mutex> lock(job->queueMutex);
+			if (!job->queue.empty())
+				return shown;
+		}
+
+		Model& loaded = refining ? *refining : pending;
+		loaded.loadedFromCache = job->fromCache;
+		loaded.importTimings = job->timings;
+		loaded.optimizationStats = job->optimization;
+		loaded.loadMilliseconds = ElapsedMilliseconds(job->started);
+		loaded.firstPixelMilliseconds = refining ? firstPixelMilliseconds : loaded.loadMilliseconds;
+		std::cout << "MODEL::LOADED " << job->path << " (" << loaded.meshes.size() << " meshes) in " << loaded.loadMilliseconds << " ms, first pixel after " << loaded.firstPixelMilliseconds << " ms" << std::endl;
+		bool swapped = !refining;
+		// the model swapped out is released along with the empty pending one, or with 'previous' after a preview
+		if (swapped)
+			std::swap(target, pending);
+		endPreview(false);
+		retire();
+		dropPending();
+		return swapped;
+	}
+
+	bool IsLoading() const { return (bool)job; }
+
+	// overall progress in [0, 1]: import and decode on the worker, then the GL uploads
+	float Progress() const
+	{
+		if (!job)
+			return 1.0f;
+		if (!job->imported)
+			return job->progress.fraction * 0.8f;
+		return 0.8f + 0.2f * (job->meshCount > 0 ? (float)uploaded / (float)job->meshCount : 1.0f);
+	}
+
+	// short description of the current stage for the UI
+	const char* Stage() const
+	{
+		if (!job)
+			return "Idle";
+		if (refining)
+			return job->imported ? "Refining" : (previewStage == BOX_PREVIEW ? "Showing bounds" : "Showing coarse LOD");
+		return job->imported ? "Uploading meshes" : "Importing";
+	}
+
+	// how long the current load took to show its first preview; 0 until it has
+	double FirstPixelMilliseconds() const { return firstPixelMilliseconds; }
+
+private:
+	struct RetiredWorker
+	{
+		std::thread thread;
+		std::shared_ptr<ModelLoadJob> job;
+	};
+
+	std::shared_ptr<ModelLoadJob> job;
+	std::thread worker;
+	std::vector<RetiredWorker> retired;
+	Model pending;
+	unsigned int uploaded = 0;
+	Model* refining = nullptr; // the target while it shows this load's preview; full meshes go straight into it
+	Model previous;            // what that target showed before the preview
+	Preview_Stage previewStage = BOX_PREVIEW;
+	double firstPixelMilliseconds = 0.0;
+
+	static void run(std::shared_ptr<ModelLoadJob> job, bool progressive)
+	{
+		PreviewCallback preview;
+		if (progressive)
+		{
+			preview = [job](std::vector<MeshData>&& meshes, Preview_Stage stage)
+			{
+				std::lock_guard<std::mutex> lock(job->queueMutex);
+				job->preview = std::move(meshes);
+				job->previewStage = stage;
+				job->previewReady = true;
+			};
+		}
+		ModelData data;
+		bool ok = Model::Import(job->path, data, &job->progress, job->settings, preview);
+		{
+			std::lock_guard<std::mutex> lock(job->queueMutex);
+			job->fromCache = data.fromCache;
+			job->timings = data.timings;
+			job->optimization = data.optimization;
+			if (ok)
+			{
+				job->meshCount = (unsigned int)data.meshes.size();
+				for (unsigned int i = 0; i < data.meshes.size(); i++)
+					job->queue.push_back(std::move(data.meshes[i]));
+			}
+		}
+		job->failed = !ok;
+		job->imported = true;
+		job->finished = true;
+	}
+
+	// releases the pending model's GL buffers on the GL thread and starts a new one
+	void dropPending()
+	{
+		pending.DeleteBuffers();
+		pending = Model();
+	}
+
+	// swaps a preview that arrived since the last frame into the target. The first one moves the target's model
+	// into 'previous'; later ones release the preview they replace. Previews that come in after the full meshes
+	// are queued are dropped: by then the meshes are about to replace them anyway.
+	bool showPreview(Model& target)
+	{
+		std::vector<MeshData> meshes;
+		Preview_Stage stage;
+		{
+			std::lock_guard<std::mutex> lock(job->queueMutex);
+			if (!job->previewReady)
+				return false;
+			job->previewReady = false;
+			if (job->imported || !job->queue.empty() || uploaded > 0)
+				return false;
+			meshes.swap(job->preview);
+			stage = job->previewStage;
+		}
+
+		Model preview;
+		preview.importSettings = job->settings;
+		preview.directory = job->directory;
+		preview.meshes.reserve(meshes.size());
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			preview.AddMesh(std::move(meshes[i]));
+		if (!refining)
+			firstPixelMilliseconds = ElapsedMilliseconds(job->started);
+		preview.firstPixelMilliseconds = firstPixelMilliseconds;
+		std::swap(target, preview);
+		if (refining)
+			preview.DeleteBuffers();
+		else
+			std::swap(previous, preview);
+		refining = &target;
+		previewStage = stage;
+		return true;
+	}
+
+	// ends a progressive load's preview: puts the model it replaced back into the target when the load was
+	// cancelled or failed, and releases whichever of the two is no longer shown
+	void endPreview(bool restore)
+	{
+		if (!refining)
+			return;
+		if (restore)
+			std::swap(*refining, previous);
+		previous.DeleteBuffers();
+		previous = Model();
+		refining = nullptr;
+	}
+
+	// hands the current worker over to the retired list so it can be joined once it has returned
+	void retire()
+	{
+		RetiredWorker retiredWorker;
+		retiredWorker.thread = std::move(worker);
+		retiredWorker.job = job;
+		retired.push_back(std::move(retiredWorker));
+		job.reset();
+	}
+
+	void joinRetired()
+	{
+		for (unsigned int i = 0; i < retired.size(); i++)
+			retired[i].thread.join();
+		retired.clear();
+	}
+
+	void reapRetired()
+	{
+		for (unsigned int i = 0; i < retired.size();)
+		{
+			if (retired[i].job->finished)
+			{
+				retired[i].thread.join();
+				retired.erase(retired.begin() + i);
+			}
+			else
+				i++;
+		}
+	}
+};
+#endif
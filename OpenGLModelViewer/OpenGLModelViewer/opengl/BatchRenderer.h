@@ -0,0 +1,333 @@
+#ifndef BATCH_RENDERER_H
+#define BATCH_RENDERER_H
+
+#include <opengl/model.h>
+
+#include <algorithm>
+#include <vector>
+
+// one draw as glMultiDrawElementsIndirect reads it from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
+
+// per-draw vertex attributes 5 and 6 of material.vert, fetched through the draw's base instance
+struct DrawData
+{
+	glm::vec3 positionOffset;
+	glm::vec3 positionScale;
+};
+
+// counters of the most recent Draw call
+struct BatchStats
+{
+	unsigned int meshes = 0;
+	unsigned int buffers = 0;
+	unsigned int batches = 0;
+	unsigned int drawCalls = 0;
+	bool multiDrawIndirect = false;
+};
+
+// Draws a model with as few calls as possible. Meshes with the same vertex layout and index type are copied
+// into shared buffers, and meshes that also share their textures form a batch that is submitted with a single
+// glMultiDrawElementsIndirect, or with one glDrawElementsBaseVertex per mesh where GL 4.3 isn't available.
+// Everything is rebuilt from the model's GPU buffers when its revisions change, so CPU geometry isn't needed.
+// Every level of detail is copied along, so switching a mesh's level only rewrites its command.
+class BatchRenderer
+{
+public:
+	// use glMultiDrawElementsIndirect when the context supports it
+	bool UseMultiDrawIndirect = true;
+
+	BatchRenderer() {}
+	~BatchRenderer() { Clear(); }
+
+	BatchRenderer(const BatchRenderer&) = delete;
+	BatchRenderer& operator=(const BatchRenderer&) = delete;
+
+	// multi-draw indirect needs GL 4.3, or the extension plus base instances for the per-draw attributes
+	static bool MultiDrawIndirectSupported()
+	{
+		return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+	}
+
+	// call with the shader in use. Meshes whose 'visible' flag is 0 are skipped (see FrustumCuller).
+	void Draw(const Model& model, const Shader& shader, const unsigned char* visible = nullptr)
+	{
+		if (model.geometryRevision != geometryRevision)
+			build(model);
+		if (model.materialRevision != materialRevision)
+			buildBatches(model);
+
+		bool indirect = UseMultiDrawIndirect && MultiDrawIndirectSupported();
+		stats.drawCalls = 0;
+		stats.multiDrawIndirect = indirect;
+		GLState& state = GLState::Current();
+		updateCommands(model, visible, indirect);
+		for (unsigned int b = 0; b < batches.size(); b++)
+		{
+			Batch& batch = batches[b];
+			const GeometryBuffer& buffer = buffers[batch.buffer];
+			if (!anyVisible(batch, visible))
+				continue;
+			if (batch.binding.program != shader.ID)
+				batch.binding.Compile(batch.textures, buffer.format, shader);
+			batch.binding.Bind();
+			state.BindVertexArray(buffer.VAO);
+			if (indirect)
+			{
+				state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer.indirectBuffer);
+				glMultiDrawElementsIndirect(GL_TRIANGLES, buffer.indexType, (void *)(batch.firstCommand * sizeof(DrawElementsIndirectCommand)), batch.commandCount, 0);
+				stats.drawCalls++;
+				continue;
+			}
+
+			// without base instances the per-draw attributes are pointed at the draw's entry instead
+			state.BindBuffer(GL_ARRAY_BUFFER, buffer.drawBuffer);
+			size_t indexSize = buffer.indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+			for (unsigned int c = batch.firstCommand; c < batch.firstCommand + batch.commandCount; c++)
+			{
+				const DrawElementsIndirectCommand& command = buffer.commands[c];
+				if (visible != nullptr && !visible[buffer.meshes[command.baseInstance]])
+					continue;
+				size_t drawOffset = command.baseInstance * sizeof(DrawData);
+				glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void *)(drawOffset + offsetof(DrawData, positionOffset)));
+				glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void *)(drawOffset + offsetof(DrawData, positionScale)));
+				glDrawElementsBaseVertex(GL_TRIANGLES, command.count, buffer.indexType, (void *)(command.firstIndex * indexSize), command.baseVertex);
+				stats.drawCalls++;
+			}
+			// back to the base pointers the instanced path adds baseInstance to
+			glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void *)offsetof(DrawData, positionOffset));
+			glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void *)offsetof(DrawData, positionScale));
+		}
+	}
+
+	// deletes the merged buffers; call while the GL context is current
+	void Clear()
+	{
+		for (unsigned int i = 0; i < buffers.size(); i++)
+		{
+			GeometryBuffer& buffer = buffers[i];
+			GLState& state = GLState::Current();
+			state.DeleteVertexArray(buffer.VAO);
+			state.DeleteBuffer(buffer.VBO);
+			state.DeleteBuffer(buffer.EBO);
+			state.DeleteBuffer(buffer.drawBuffer);
+			state.DeleteBuffer(buffer.indirectBuffer);
+		}
+		buffers.clear();
+		batches.clear();
+		geometryRevision = materialRevision = 0;
+		stats = BatchStats();
+	}
+
+	BatchStats Stats() const { return stats; }
+
+private:
+	// meshes of one vertex layout and index type, merged into one set of buffers
+	struct GeometryBuffer
+	{
+		Vertex_Format format;
+		GLenum indexType;
+		unsigned int VAO;
+		unsigned int VBO;
+		unsigned int EBO;
+		unsigned int drawBuffer;     // DrawData per mesh
+		unsigned int indirectBuffer; // 'commands', grouped by batch
+		std::vector<unsigned int> meshes; // model mesh index of every draw slot
+		std::vector<unsigned int> firstIndices; // where each slot's indices start in EBO
+		std::vector<DrawElementsIndirectCommand> commands;
+		bool stale; // indirectBuffer is behind 'commands'
+	};
+
+	// meshes of one buffer that bind the same textures
+	struct Batch
+	{
+		unsigned int buffer;
+		std::vector<Texture> textures;
+		unsigned int firstCommand;
+		unsigned int commandCount;
+		MaterialBinding binding;
+	};
+
+	std::vector<GeometryBuffer> buffers;
+	std::vector<Batch> batches;
+	unsigned int geometryRevision = 0;
+	unsigned int materialRevision = 0;
+	BatchStats stats;
+
+	// copies every mesh's GPU buffers into the merged buffer of its layout
+	void build(const Model& model)
+	{
+		Clear();
+		for (unsigned int m = 0; m < model.meshes.size(); m++)
+		{
+			const Mesh& mesh = model.meshes[m];
+			if (mesh.indexCount == 0)
+				continue;
+			unsigned int b = 0;
+			while (b < buffers.size() && (buffers[b].format != mesh.format || buffers[b].indexType != mesh.indexType))
+				b++;
+			if (b == buffers.size())
+			{
+				GeometryBuffer buffer = {};
+				buffer.format = mesh.format;
+				buffer.indexType = mesh.indexType;
+				buffers.push_back(buffer);
+			}
+			buffers[b].meshes.push_back(m);
+		}
+
+		for (unsigned int b = 0; b < buffers.size(); b++)
+		{
+			GeometryBuffer& buffer = buffers[b];
+			size_t vertexBytes = 0, indexBytes = 0;
+			for (unsigned int i = 0; i < buffer.meshes.size(); i++)
+			{
+				const Mesh& mesh = model.meshes[buffer.meshes[i]];
+				vertexBytes += mesh.vertexCount * mesh.VertexStride();
+				indexBytes += mesh.bufferIndexCount * mesh.IndexSize();
+			}
+
+			glGenVertexArrays(1, &buffer.VAO);
+			glGenBuffers(1, &buffer.VBO);
+			glGenBuffers(1, &buffer.EBO);
+			glGenBuffers(1, &buffer.drawBuffer);
+			glGenBuffers(1, &buffer.indirectBuffer);
+			GLState& state = GLState::Current();
+			state.BindVertexArray(buffer.VAO);
+			state.BindBuffer(GL_ARRAY_BUFFER, buffer.VBO);
+			glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_STATIC_DRAW);
+			state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.EBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, nullptr, GL_STATIC_DRAW);
+
+			// indices keep their per-mesh values; the base vertex of each draw offsets them
+			std::vector<DrawData> drawData(buffer.meshes.size());
+			buffer.commands.resize(buffer.meshes.size());
+			buffer.firstIndices.resize(buffer.meshes.size());
+			size_t vertexOffset = 0, indexOffset = 0;
+			for (unsigned int i = 0; i < buffer.meshes.size(); i++)
+			{
+				const Mesh& mesh = model.meshes[buffer.meshes[i]];
+				size_t meshVertexBytes = mesh.vertexCount * mesh.VertexStride();
+				size_t meshIndexBytes = mesh.bufferIndexCount * mesh.IndexSize();
+				state.BindBuffer(GL_COPY_READ_BUFFER, mesh.VertexBuffer());
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, vertexOffset, meshVertexBytes);
+				state.BindBuffer(GL_COPY_READ_BUFFER, mesh.IndexBuffer());
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, 0, indexOffset, meshIndexBytes);
+
+				buffer.firstIndices[i] = (unsigned int)(indexOffset / mesh.IndexSize());
+				DrawElementsIndirectCommand command = { mesh.indexCount, 1, buffer.firstIndices[i], (int)(vertexOffset / mesh.VertexStride()), i };
+				buffer.commands[i] = command;
+				drawData[i].positionOffset = mesh.positionOffset;
+				drawData[i].positionScale = mesh.positionScale;
+				vertexOffset += meshVertexBytes;
+				indexOffset += meshIndexBytes;
+			}
+			state.BindBuffer(GL_COPY_READ_BUFFER, 0);
+			Mesh::SetupAttributes(buffer.format);
+
+			state.BindBuffer(GL_ARRAY_BUFFER, buffer.drawBuffer);
+			glBufferData(GL_ARRAY_BUFFER, drawData.size() * sizeof(DrawData), &drawData[0], GL_STATIC_DRAW);
+			glEnableVertexAttribArray(5);
+			glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void *)offsetof(DrawData, positionOffset));
+			glVertexAttribDivisor(5, 1);
+			glEnableVertexAttribArray(6);
+			glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void *)offsetof(DrawData, positionScale));
+			glVertexAttribDivisor(6, 1);
+			state.BindVertexArray(0);
+		}
+
+		geometryRevision = model.geometryRevision;
+		materialRevision = 0;
+		stats.meshes = (unsigned int)model.meshes.size();
+		stats.buffers = (unsigned int)buffers.size();
+	}
+
+	bool anyVisible(const Batch& batch, const unsigned char* visible) const
+	{
+		if (visible == nullptr)
+			return true;
+		const GeometryBuffer& buffer = buffers[batch.buffer];
+		for (unsigned int c = batch.firstCommand; c < batch.firstCommand + batch.commandCount; c++)
+		{
+			if (visible[buffer.meshes[buffer.commands[c].baseInstance]])
+				return true;
+		}
+		return false;
+	}
+
+	// points every command at its mesh's current level of detail. Culled draws stay in the indirect buffer with an
+	// instance count of 0; the buffer is only rewritten when a command changes.
+	void updateCommands(const Model& model, const unsigned char* visible, bool indirect)
+	{
+		for (unsigned int b = 0; b < buffers.size(); b++)
+		{
+			GeometryBuffer& buffer = buffers[b];
+			for (unsigned int c = 0; c < buffer.commands.size(); c++)
+			{
+				DrawElementsIndirectCommand& command = buffer.commands[c];
+				unsigned int m = buffer.meshes[command.baseInstance];
+				const Mesh& mesh = model.meshes[m];
+				const MeshLod& level = mesh.lods[std::min<size_t>(mesh.lod, mesh.lods.size() - 1)];
+				unsigned int instanceCount = (visible == nullptr || visible[m]) ? 1 : 0;
+				unsigned int firstIndex = buffer.firstIndices[command.baseInstance] + level.firstIndex;
+				buffer.stale |= command.instanceCount != instanceCount || command.count != level.indexCount || command.firstIndex != firstIndex;
+				command.instanceCount = instanceCount;
+				command.count = level.indexCount;
+				command.firstIndex = firstIndex;
+			}
+			if (!buffer.stale || !indirect)
+				continue;
+			buffer.stale = false;
+			GLState::Current().BindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer.indirectBuffer);
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, buffer.commands.size() * sizeof(DrawElementsIndirectCommand), &buffer.commands[0]);
+		}
+	}
+
+	// groups the draws of every buffer by their textures and uploads the commands in batch order
+	void buildBatches(const Model& model)
+	{
+		batches.clear();
+		for (unsigned int b = 0; b < buffers.size(); b++)
+		{
+			GeometryBuffer& buffer = buffers[b];
+			std::vector<DrawElementsIndirectCommand> ordered;
+			ordered.reserve(buffer.commands.size());
+			std::vector<bool> placed(buffer.commands.size(), false);
+			for (unsigned int i = 0; i < buffer.commands.size(); i++)
+			{
+				if (placed[i])
+					continue;
+				const std::vector<Texture>& textures = model.meshes[buffer.meshes[buffer.commands[i].baseInstance]].textures;
+				Batch batch;
+				batch.buffer = b;
+				batch.textures = textures;
+				batch.firstCommand = (unsigned int)ordered.size();
+				batch.commandCount = 0;
+				for (unsigned int j = i; j < buffer.commands.size(); j++)
+				{
+					if (placed[j] || !SameTextures(textures, model.meshes[buffer.meshes[buffer.commands[j].baseInstance]].textures))
+						continue;
+					placed[j] = true;
+					ordered.push_back(buffer.commands[j]);
+					batch.commandCount++;
+				}
+				batches.push_back(batch);
+			}
+			buffer.commands.swap(ordered);
+			GLState::Current().BindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer.indirectBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, buffer.commands.size() * sizeof(DrawElementsIndirectCommand), &buffer.commands[0], GL_STATIC_DRAW);
+			buffer.stale = false;
+		}
+		GLState::Current().BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		materialRevision = model.materialRevision;
+		stats.batches = (unsigned int)batches.size();
+	}
+};
+#endif
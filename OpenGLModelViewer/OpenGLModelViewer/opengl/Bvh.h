@@ -0,0 +1,331 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+struct Ray
+{
+	glm::vec3 origin;
+	glm::vec3 direction; // needn't be normalized; hit distances are in multiples of it
+};
+
+// the closest hit found so far; 'distance' doubles as the far end of the ray while searching
+struct RayHit
+{
+	float distance = FLT_MAX;
+	unsigned int mesh = 0;
+	unsigned int triangle = 0;
+	float u = 0.0f, v = 0.0f; // barycentrics of the second and third corner
+
+	bool Hit() const { return distance < FLT_MAX; }
+};
+
+// 32 bytes; an inner node has count 0 and its children at 'first' and 'first + 1'
+struct BvhNode
+{
+	glm::vec3 minimum;
+	unsigned int first;
+	glm::vec3 maximum;
+	unsigned int count;
+};
+
+// Bounding volume hierarchy over primitives given by their boxes, built top down with a binned surface area
+// heuristic: the primitives' centroids are binned along the widest axis and the split between bins with the
+// lowest expected cost is taken, or none if a leaf is cheaper. Used for the triangles of a mesh and for the
+// meshes of a model.
+class Bvh
+{
+public:
+	static const unsigned int BINS = 16;
+	static const unsigned int MAX_LEAF_SIZE = 8;
+	static const unsigned int MAX_DEPTH = 64;
+
+	std::vector<BvhNode> nodes;
+	std::vector<unsigned int> primitives; // primitive index of every leaf slot
+
+	void Build(const std::vector<glm::vec3>& minima, const std::vector<glm::vec3>& maxima)
+	{
+		size_t count = minima.size();
+		nodes.clear();
+		primitives.resize(count);
+		centroids.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			primitives[i] = (unsigned int)i;
+			centroids[i] = (minima[i] + maxima[i]) * 0.5f;
+		}
+		if (count == 0)
+			return;
+		nodes.reserve(2 * count);
+		nodes.push_back(BvhNode());
+		subdivide(0, 0, (unsigned int)count, 0, minima, maxima);
+		std::vector<glm::vec3>().swap(centroids);
+	}
+
+	bool Empty() const { return nodes.empty(); }
+	size_t MemoryBytes() const { return nodes.capacity() * sizeof(BvhNode) + primitives.capacity() * sizeof(unsigned int); }
+
+	// calls visit(first, count, hit) for every leaf the ray enters before hit.distance, nearest child first.
+	// 'visit' narrows hit.distance when it finds something closer, which prunes the rest of the search.
+	template <typename Visit>
+	void Traverse(const Ray& ray, RayHit& hit, Visit visit) const
+	{
+		if (nodes.empty())
+			return;
+		glm::vec3 inverse = 1.0f / ray.direction;
+		unsigned int stack[MAX_DEPTH];
+		unsigned int size = 0;
+		if (slab(nodes[0], ray.origin, inverse, hit.distance) == FLT_MAX)
+			return;
+		stack[size++] = 0;
+		while (size > 0)
+		{
+			const BvhNode& node = nodes[stack[--size]];
+			if (node.count > 0)
+			{
+				visit(node.first, node.count, hit);
+				continue;
+			}
+			float nearT = slab(nodes[node.first], ray.origin, inverse, hit.distance);
+			float farT = slab(nodes[node.first + 1], ray.origin, inverse, hit.distance);
+			unsigned int nearChild = node.first, farChild = node.first + 1;
+			if (farT < nearT)
+			{
+				std::swap(nearT, farT);
+				std::swap(nearChild, farChild);
+			}
+			// push the far child first so the near one is searched first
+			if (farT != FLT_MAX)
+				stack[size++] = farChild;
+			if (nearT != FLT_MAX)
+				stack[size++] = nearChild;
+		}
+	}
+
+private:
+	std::vector<glm::vec3> centroids; // only during Build
+
+	struct Bin
+	{
+		glm::vec3 minimum;
+		glm::vec3 maximum;
+		unsigned int count;
+	};
+
+	// distance at which the ray enters the node, or FLT_MAX if it misses it within 'limit'
+	static float slab(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverse, float limit)
+	{
+		glm::vec3 t0 = (node.minimum - origin) * inverse;
+		glm::vec3 t1 = (node.maximum - origin) * inverse;
+		glm::vec3 nearT = glm::min(t0, t1), farT = glm::max(t0, t1);
+		float enter = std::max(std::max(nearT.x, nearT.y), std::max(nearT.z, 0.0f));
+		float exit = std::min(std::min(farT.x, farT.y), std::min(farT.z, limit));
+		return enter <= exit ? enter : FLT_MAX;
+	}
+
+	static float area(const glm::vec3& minimum, const glm::vec3& maximum)
+	{
+		glm::vec3 size = glm::max(maximum - minimum, glm::vec3(0.0f));
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	void subdivide(unsigned int nodeIndex, unsigned int first, unsigned int count, unsigned int depth, const std::vector<glm::vec3>& minima, const std::vector<glm::vec3>& maxima)
+	{
+		glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX), centroidMinimum(FLT_MAX), centroidMaximum(-FLT_MAX);
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			unsigned int p = primitives[i];
+			minimum = glm::min(minimum, minima[p]);
+			maximum = glm::max(maximum, maxima[p]);
+			centroidMinimum = glm::min(centroidMinimum, centroids[p]);
+			centroidMaximum = glm::max(centroidMaximum, centroids[p]);
+		}
+		nodes[nodeIndex].minimum = minimum;
+		nodes[nodeIndex].maximum = maximum;
+		nodes[nodeIndex].first = first;
+		nodes[nodeIndex].count = count;
+		// the traversal stack holds at most one entry per level
+		if (count <= 2 || depth + 2 >= MAX_DEPTH)
+			return;
+
+		glm::vec3 extent = centroidMaximum - centroidMinimum;
+		unsigned int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		unsigned int middle = first;
+		if (extent[axis] > 0.0f)
+		{
+			Bin bins[BINS];
+			for (unsigned int b = 0; b < BINS; b++)
+			{
+				bins[b].minimum = glm::vec3(FLT_MAX);
+				bins[b].maximum = glm::vec3(-FLT_MAX);
+				bins[b].count = 0;
+			}
+			float scale = BINS / extent[axis];
+			for (unsigned int i = first; i < first + count; i++)
+			{
+				unsigned int p = primitives[i];
+				Bin& bin = bins[binOf(centroids[p][axis], centroidMinimum[axis], scale)];
+				bin.minimum = glm::min(bin.minimum, minima[p]);
+				bin.maximum = glm::max(bin.maximum, maxima[p]);
+				bin.count++;
+			}
+
+			// cost of splitting after bin b: the children's primitive counts weighted by their surface areas
+			float leftCost[BINS - 1];
+			glm::vec3 leftMinimum(FLT_MAX), leftMaximum(-FLT_MAX);
+			unsigned int leftCount = 0;
+			for (unsigned int b = 0; b < BINS - 1; b++)
+			{
+				leftMinimum = glm::min(leftMinimum, bins[b].minimum);
+				leftMaximum = glm::max(leftMaximum, bins[b].maximum);
+				leftCount += bins[b].count;
+				leftCost[b] = leftCount * area(leftMinimum, leftMaximum);
+			}
+			float bestCost = FLT_MAX;
+			unsigned int bestSplit = 0;
+			glm::vec3 rightMinimum(FLT_MAX), rightMaximum(-FLT_MAX);
+			unsigned int rightCount = 0;
+			for (unsigned int b = BINS - 1; b > 0; b--)
+			{
+				rightMinimum = glm::min(rightMinimum, bins[b].minimum);
+				rightMaximum = glm::max(rightMaximum, bins[b].maximum);
+				rightCount += bins[b].count;
+				float cost = leftCost[b - 1] + rightCount * area(rightMinimum, rightMaximum);
+				if (rightCount > 0 && rightCount < count && cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = b - 1;
+				}
+			}
+
+			// a traversal step costs about as much as one primitive test
+			float parentArea = area(minimum, maximum);
+			float splitCost = 1.0f + (parentArea > 0.0f ? bestCost / parentArea : 0.0f);
+			if (splitCost >= (float)count && count <= MAX_LEAF_SIZE)
+				return;
+
+			float centroidMinimumAxis = centroidMinimum[axis];
+			middle = (unsigned int)(std::partition(primitives.begin() + first, primitives.begin() + first + count, [&](unsigned int p)
+			{
+				return binOf(centroids[p][axis], centroidMinimumAxis, scale) <= bestSplit;
+			}) - primitives.begin());
+		}
+		if (middle == first || middle == first + count)
+		{
+			// every centroid in one bin: split by count instead
+			if (count <= MAX_LEAF_SIZE)
+				return;
+			middle = first + count / 2;
+			std::nth_element(primitives.begin() + first, primitives.begin() + middle, primitives.begin() + first + count, [&](unsigned int a, unsigned int b)
+			{
+				return centroids[a][axis] < centroids[b][axis];
+			});
+		}
+
+		unsigned int left = (unsigned int)nodes.size();
+		nodes.push_back(BvhNode());
+		nodes.push_back(BvhNode());
+		nodes[nodeIndex].first = left;
+		nodes[nodeIndex].count = 0;
+		subdivide(left, first, middle - first, depth + 1, minima, maxima);
+		subdivide(left + 1, middle, first + count - middle, depth + 1, minima, maxima);
+	}
+
+	static unsigned int binOf(float centroid, float minimum, float scale)
+	{
+		int bin = (int)((centroid - minimum) * scale);
+		return (unsigned int)std::min(std::max(bin, 0), (int)BINS - 1);
+	}
+};
+
+// BVH over the triangles of one mesh. Keeps its own copy of the corners in leaf order, so it works after the
+// mesh has released its CPU geometry and a leaf's triangles are contiguous in memory.
+class TriangleBvh
+{
+public:
+	// 'positions' are 'stride' bytes apart, e.g. the Position member of a vertex array
+	void Build(const glm::vec3* positions, size_t stride, const std::vector<unsigned int>& indices)
+	{
+		const char* base = reinterpret_cast<const char*>(positions);
+		size_t triangleCount = indices.size() / 3;
+		std::vector<glm::vec3> minima(triangleCount), maxima(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const glm::vec3& a = point(base, stride, indices[t * 3]);
+			const glm::vec3& b = point(base, stride, indices[t * 3 + 1]);
+			const glm::vec3& c = point(base, stride, indices[t * 3 + 2]);
+			minima[t] = glm::min(a, glm::min(b, c));
+			maxima[t] = glm::max(a, glm::max(b, c));
+		}
+		bvh.Build(minima, maxima);
+		corners.resize(triangleCount * 3);
+		for (size_t i = 0; i < triangleCount; i++)
+		{
+			unsigned int t = bvh.primitives[i];
+			for (unsigned int k = 0; k < 3; k++)
+				corners[i * 3 + k] = point(base, stride, indices[t * 3 + k]);
+		}
+	}
+
+	bool Empty() const { return bvh.Empty(); }
+	size_t NodeCount() const { return bvh.nodes.size(); }
+	size_t MemoryBytes() const { return bvh.MemoryBytes() + corners.capacity() * sizeof(glm::vec3); }
+	// the mesh's triangles as three corners each, in leaf order
+	const std::vector<glm::vec3>& Corners() const { return corners; }
+
+	// narrows 'hit' to the closest triangle in front of the ray, if closer than hit.distance; both sides count
+	bool Intersect(const Ray& ray, RayHit& hit) const
+	{
+		float before = hit.distance;
+		bvh.Traverse(ray, hit, [this, &ray](unsigned int first, unsigned int count, RayHit& closest)
+		{
+			for (unsigned int i = first; i < first + count; i++)
+				intersectTriangle(ray, i, closest);
+		});
+		return hit.distance < before;
+	}
+
+private:
+	Bvh bvh;
+	std::vector<glm::vec3> corners;
+
+	static const glm::vec3& point(const char* base, size_t stride, size_t i)
+	{
+		return *reinterpret_cast<const glm::vec3*>(base + i * stride);
+	}
+
+	// Moller-Trumbore
+	void intersectTriangle(const Ray& ray, unsigned int slot, RayHit& hit) const
+	{
+		const glm::vec3& a = corners[slot * 3];
+		glm::vec3 edge1 = corners[slot * 3 + 1] - a;
+		glm::vec3 edge2 = corners[slot * 3 + 2] - a;
+		glm::vec3 p = glm::cross(ray.direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (std::fabs(determinant) < 1e-12f)
+			return;
+		float inverse = 1.0f / determinant;
+		glm::vec3 s = ray.origin - a;
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return;
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = glm::dot(ray.direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return;
+		float t = glm::dot(edge2, q) * inverse;
+		if (t <= 0.0f || t >= hit.distance)
+			return;
+		hit.distance = t;
+		hit.triangle = bvh.primitives[slot];
+		hit.u = u;
+		hit.v = v;
+	}
+};
+#endif
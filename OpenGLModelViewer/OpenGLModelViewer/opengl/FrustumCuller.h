@@ -0,0 +1,248 @@
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+
+#include <opengl/model.h>
+#include <opengl/Simd.h>
+#include <opengl/Timing.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+// the six planes of a view frustum, pointing inwards: a point p is inside a plane if dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	// extracts the planes of a projection * view matrix (Gribb and Hartmann), in the space the matrix maps from
+	static Frustum FromMatrix(const glm::mat4& matrix)
+	{
+		glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+		glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+		glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+		glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+		Frustum frustum;
+		frustum.planes[0] = row3 + row0; // left
+		frustum.planes[1] = row3 - row0; // right
+		frustum.planes[2] = row3 + row1; // bottom
+		frustum.planes[3] = row3 - row1; // top
+		frustum.planes[4] = row3 + row2; // near
+		frustum.planes[5] = row3 - row2; // far
+		for (unsigned int i = 0; i < 6; i++)
+			frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+		return frustum;
+	}
+};
+
+// counters of the most recent Cull call. A mesh is culled if any of its volumes is outside the frustum; the
+// per-volume counts show what each test would reject on its own.
+struct CullStats
+{
+	unsigned int tested = 0;
+	unsigned int culled = 0;
+	unsigned int culledBySphere = 0;
+	unsigned int culledByBox = 0;
+	unsigned int culledByOrientedBox = 0;
+	double milliseconds = 0.0;
+};
+
+// Tests the bounding volumes of a model's meshes against the view frustum. The world-space bounds are kept as
+// structure of arrays, padded to a multiple of four, so one SSE iteration tests four meshes against a plane:
+// a mesh is culled if its sphere, its box or its oriented box lies entirely outside any plane. The arrays keep
+// their capacity, so culling a model allocates nothing after the first frame.
+class FrustumCuller
+{
+public:
+	// one visibility flag per mesh of the model, placed in the world by modelMatrix
+	const std::vector<unsigned char>& Cull(const Model& model, const glm::mat4& modelMatrix, const glm::mat4& viewProjection)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		transformBounds(model, modelMatrix);
+		Frustum frustum = Frustum::FromMatrix(viewProjection);
+		unsigned int count = (unsigned int)model.meshes.size();
+		visible.resize(count);
+		rejected.resize(count);
+#ifdef SIMD_SSE
+		testSse(frustum, count);
+#else
+		testScalar(frustum, count);
+#endif
+		stats.tested = count;
+		stats.culled = stats.culledBySphere = stats.culledByBox = stats.culledByOrientedBox = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			stats.culled += !visible[i];
+			stats.culledBySphere += (rejected[i] & SPHERE_REJECTED) != 0;
+			stats.culledByBox += (rejected[i] & BOX_REJECTED) != 0;
+			stats.culledByOrientedBox += (rejected[i] & ORIENTED_BOX_REJECTED) != 0;
+		}
+		stats.milliseconds = ElapsedMilliseconds(start);
+		return visible;
+	}
+
+	const std::vector<unsigned char>& Visibility() const { return visible; }
+	CullStats Stats() const { return stats; }
+
+private:
+	// bits of 'rejected'
+	static const unsigned char SPHERE_REJECTED = 1;
+	static const unsigned char BOX_REJECTED = 2;
+	static const unsigned char ORIENTED_BOX_REJECTED = 4;
+	static const unsigned int ARRAYS = 19;
+
+	// world-space sphere centers and radii, and box centers and half extents; the box center is the sphere's
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> extentX, extentY, extentZ;
+	// oriented box centers and axes scaled by the half extents, which keeps them exact under any model matrix
+	std::vector<float> orientedX, orientedY, orientedZ;
+	std::vector<float> axis0X, axis0Y, axis0Z, axis1X, axis1Y, axis1Z, axis2X, axis2Y, axis2Z;
+	std::vector<unsigned char> visible;
+	std::vector<unsigned char> rejected;
+	CullStats stats;
+
+	void transformBounds(const Model& model, const glm::mat4& modelMatrix)
+	{
+		size_t count = model.meshes.size();
+		size_t padded = (count + 3) & ~(size_t)3;
+		std::vector<float>* arrays[ARRAYS] = { &centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ,
+			&orientedX, &orientedY, &orientedZ, &axis0X, &axis0Y, &axis0Z, &axis1X, &axis1Y, &axis1Z, &axis2X, &axis2Y, &axis2Z };
+		for (unsigned int a = 0; a < ARRAYS; a++)
+			arrays[a]->resize(padded, 0.0f);
+
+		// a sphere grows with the largest axis scale, a box with the absolute values of the rotation
+		glm::mat3 linear(modelMatrix);
+		glm::mat3 absolute(glm::abs(linear[0]), glm::abs(linear[1]), glm::abs(linear[2]));
+		float scale = std::max(glm::length(linear[0]), std::max(glm::length(linear[1]), glm::length(linear[2])));
+		for (size_t i = 0; i < count; i++)
+		{
+			const MeshBounds& bounds = model.meshes[i].bounds;
+			glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(bounds.center, 1.0f));
+			glm::vec3 extent = absolute * ((bounds.maximum - bounds.minimum) * 0.5f);
+			centerX[i] = center.x;
+			centerY[i] = center.y;
+			centerZ[i] = center.z;
+			radius[i] = bounds.radius * scale;
+			extentX[i] = extent.x;
+			extentY[i] = extent.y;
+			extentZ[i] = extent.z;
+
+			const OrientedBox& box = bounds.orientedBox;
+			glm::vec3 orientedCenter = glm::vec3(modelMatrix * glm::vec4(box.center, 1.0f));
+			glm::vec3 axis0 = linear * (box.axes[0] * box.halfExtents.x);
+			glm::vec3 axis1 = linear * (box.axes[1] * box.halfExtents.y);
+			glm::vec3 axis2 = linear * (box.axes[2] * box.halfExtents.z);
+			orientedX[i] = orientedCenter.x;
+			orientedY[i] = orientedCenter.y;
+			orientedZ[i] = orientedCenter.z;
+			axis0X[i] = axis0.x;
+			axis0Y[i] = axis0.y;
+			axis0Z[i] = axis0.z;
+			axis1X[i] = axis1.x;
+			axis1Y[i] = axis1.y;
+			axis1Z[i] = axis1.z;
+			axis2X[i] = axis2.x;
+			axis2Y[i] = axis2.y;
+			axis2Z[i] = axis2.z;
+		}
+	}
+
+	// reference version, used on targets without SSE
+	void testScalar(const Frustum& frustum, unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			unsigned char outside = 0;
+			for (unsigned int p = 0; p < 6; p++)
+			{
+				glm::vec3 normal(frustum.planes[p]);
+				float w = frustum.planes[p].w;
+				float distance = glm::dot(normal, glm::vec3(centerX[i], centerY[i], centerZ[i])) + w;
+				float boxRadius = glm::dot(glm::abs(normal), glm::vec3(extentX[i], extentY[i], extentZ[i]));
+				float orientedDistance = glm::dot(normal, glm::vec3(orientedX[i], orientedY[i], orientedZ[i])) + w;
+				float orientedRadius = std::fabs(glm::dot(normal, glm::vec3(axis0X[i], axis0Y[i], axis0Z[i])))
+					+ std::fabs(glm::dot(normal, glm::vec3(axis1X[i], axis1Y[i], axis1Z[i])))
+					+ std::fabs(glm::dot(normal, glm::vec3(axis2X[i], axis2Y[i], axis2Z[i])));
+				if (distance + radius[i] < 0.0f)
+					outside |= SPHERE_REJECTED;
+				if (distance + boxRadius < 0.0f)
+					outside |= BOX_REJECTED;
+				if (orientedDistance + orientedRadius < 0.0f)
+					outside |= ORIENTED_BOX_REJECTED;
+			}
+			rejected[i] = outside;
+			visible[i] = outside == 0;
+		}
+	}
+
+#ifdef SIMD_SSE
+	static __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+	}
+
+	static __m128 absolute(__m128 v)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+	}
+
+	void testSse(const Frustum& frustum, unsigned int count)
+	{
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+		for (unsigned int p = 0; p < 6; p++)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			planeX[p] = _mm_set1_ps(plane.x);
+			planeY[p] = _mm_set1_ps(plane.y);
+			planeZ[p] = _mm_set1_ps(plane.z);
+			planeW[p] = _mm_set1_ps(plane.w);
+			absX[p] = _mm_set1_ps(std::fabs(plane.x));
+			absY[p] = _mm_set1_ps(std::fabs(plane.y));
+			absZ[p] = _mm_set1_ps(std::fabs(plane.z));
+		}
+		const __m128 zero = _mm_setzero_ps();
+		for (unsigned int i = 0; i < count; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&centerX[i]), y = _mm_loadu_ps(&centerY[i]), z = _mm_loadu_ps(&centerZ[i]);
+			__m128 r = _mm_loadu_ps(&radius[i]);
+			__m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+			__m128 ox = _mm_loadu_ps(&orientedX[i]), oy = _mm_loadu_ps(&orientedY[i]), oz = _mm_loadu_ps(&orientedZ[i]);
+			__m128 a0x = _mm_loadu_ps(&axis0X[i]), a0y = _mm_loadu_ps(&axis0Y[i]), a0z = _mm_loadu_ps(&axis0Z[i]);
+			__m128 a1x = _mm_loadu_ps(&axis1X[i]), a1y = _mm_loadu_ps(&axis1Y[i]), a1z = _mm_loadu_ps(&axis1Z[i]);
+			__m128 a2x = _mm_loadu_ps(&axis2X[i]), a2y = _mm_loadu_ps(&axis2Y[i]), a2z = _mm_loadu_ps(&axis2Z[i]);
+			__m128 sphereOutside = zero, boxOutside = zero, orientedOutside = zero;
+			for (unsigned int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(dot(planeX[p], planeY[p], planeZ[p], x, y, z), planeW[p]);
+				__m128 boxRadius = dot(absX[p], absY[p], absZ[p], ex, ey, ez);
+				__m128 orientedDistance = _mm_add_ps(dot(planeX[p], planeY[p], planeZ[p], ox, oy, oz), planeW[p]);
+				__m128 orientedRadius = _mm_add_ps(_mm_add_ps(
+					absolute(dot(planeX[p], planeY[p], planeZ[p], a0x, a0y, a0z)),
+					absolute(dot(planeX[p], planeY[p], planeZ[p], a1x, a1y, a1z))),
+					absolute(dot(planeX[p], planeY[p], planeZ[p], a2x, a2y, a2z)));
+				sphereOutside = _mm_or_ps(sphereOutside, _mm_cmplt_ps(_mm_add_ps(distance, r), zero));
+				boxOutside = _mm_or_ps(boxOutside, _mm_cmplt_ps(_mm_add_ps(distance, boxRadius), zero));
+				orientedOutside = _mm_or_ps(orientedOutside, _mm_cmplt_ps(_mm_add_ps(orientedDistance, orientedRadius), zero));
+			}
+			int sphereMask = _mm_movemask_ps(sphereOutside);
+			int boxMask = _mm_movemask_ps(boxOutside);
+			int orientedMask = _mm_movemask_ps(orientedOutside);
+			for (unsigned int k = 0; k < 4 && i + k < count; k++)
+			{
+				unsigned char outside = 0;
+				if ((sphereMask >> k) & 1)
+					outside |= SPHERE_REJECTED;
+				if ((boxMask >> k) & 1)
+					outside |= BOX_REJECTED;
+				if ((orientedMask >> k) & 1)
+					outside |= ORIENTED_BOX_REJECTED;
+				rejected[i + k] = outside;
+				visible[i + k] = outside == 0;
+			}
+		}
+	}
+#endif
+};
+#endif
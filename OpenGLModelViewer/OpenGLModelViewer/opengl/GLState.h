@@ -0,0 +1,335 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+// texture units tracked by GLState; MaterialBinding uses at most MAX_MATERIAL_TEXTURES of them
+const unsigned int GL_STATE_TEXTURE_UNITS = 16;
+
+enum GL_State_Call
+{
+	STATE_BIND,     // programs, VAOs, buffers, textures, framebuffers
+	STATE_ENABLE,   // glEnable / glDisable and the active texture unit
+	STATE_UNIFORM,  // uniform values
+	STATE_CALL_TYPES
+};
+
+// issued and elided calls per GL_State_Call
+struct GLStateStats
+{
+	unsigned int issued[STATE_CALL_TYPES];
+	unsigned int elided[STATE_CALL_TYPES];
+
+	unsigned int Issued() const { return issued[STATE_BIND] + issued[STATE_ENABLE] + issued[STATE_UNIFORM]; }
+	unsigned int Elided() const { return elided[STATE_BIND] + elided[STATE_ENABLE] + elided[STATE_UNIFORM]; }
+};
+
+// Shadows the GL state the renderer changes and skips calls that would set what is already current. Every
+// bind, enable and tracked uniform of the renderer goes through here, including the deletes, which unbind.
+// Code that changes state behind its back (ImGui restores what it touches) must call Invalidate.
+// GL thread only.
+class GLState
+{
+public:
+	// the state of the one GL context
+	static GLState& Current()
+	{
+		static GLState state;
+		return state;
+	}
+
+	GLState() { Invalidate(); }
+
+	GLState(const GLState&) = delete;
+	GLState& operator=(const GLState&) = delete;
+
+	// forgets everything, so the next call of each kind is issued
+	void Invalidate()
+	{
+		program = unknown;
+		vertexArray = unknown;
+		framebuffer = unknown;
+		activeUnit = unknown;
+		for (unsigned int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+			textures[i] = unknown;
+		for (unsigned int i = 0; i < BUFFER_TARGETS; i++)
+			buffers[i] = unknown;
+		for (unsigned int i = 0; i < CAPABILITIES; i++)
+			capabilities[i] = -1;
+		uniforms.clear();
+		floats.clear();
+	}
+
+	// starts the counters of a new frame; LastFrame returns those of the frame before
+	void BeginFrame()
+	{
+		lastFrame = frame;
+		std::memset(&frame, 0, sizeof(frame));
+	}
+
+	GLStateStats LastFrame() const { return lastFrame; }
+
+	void Enable(GLenum capability) { setCapability(capability, true); }
+	void Disable(GLenum capability) { setCapability(capability, false); }
+
+	void UseProgram(unsigned int id)
+	{
+		if (elide(program == id, STATE_BIND))
+			return;
+		program = id;
+		glUseProgram(id);
+	}
+
+	void BindVertexArray(unsigned int id)
+	{
+		if (elide(vertexArray == id, STATE_BIND))
+			return;
+		vertexArray = id;
+		glBindVertexArray(id);
+	}
+
+	void BindFramebuffer(unsigned int id)
+	{
+		if (elide(framebuffer == id, STATE_BIND))
+			return;
+		framebuffer = id;
+		glBindFramebuffer(GL_FRAMEBUFFER, id);
+	}
+
+	// GL_ELEMENT_ARRAY_BUFFER belongs to the bound VAO and is always issued
+	void BindBuffer(GLenum target, unsigned int id)
+	{
+		int slot = bufferSlot(target);
+		if (slot < 0)
+		{
+			frame.issued[STATE_BIND]++;
+			glBindBuffer(target, id);
+			return;
+		}
+		if (elide(buffers[slot] == id, STATE_BIND))
+			return;
+		buffers[slot] = id;
+		glBindBuffer(target, id);
+	}
+
+	// also binds the buffer to the generic target, as glBindBufferBase does
+	void BindBufferBase(GLenum target, unsigned int index, unsigned int id)
+	{
+		frame.issued[STATE_BIND]++;
+		glBindBufferBase(target, index, id);
+		int slot = bufferSlot(target);
+		if (slot >= 0)
+			buffers[slot] = id;
+	}
+
+	void ActiveTexture(unsigned int unit)
+	{
+		if (elide(activeUnit == unit, STATE_ENABLE))
+			return;
+		activeUnit = unit;
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	// binds a 2D texture to a unit, switching the active unit only if the binding changes
+	void BindTexture(unsigned int unit, unsigned int id)
+	{
+		if (unit < GL_STATE_TEXTURE_UNITS && elide(textures[unit] == id, STATE_BIND))
+			return;
+		ActiveTexture(unit);
+		if (unit < GL_STATE_TEXTURE_UNITS)
+			textures[unit] = id;
+		else
+			frame.issued[STATE_BIND]++;
+		glBindTexture(GL_TEXTURE_2D, id);
+	}
+
+	// binds a 2D texture to whatever unit is active, e.g. to upload it
+	void BindTexture(unsigned int id)
+	{
+		if (activeUnit == unknown)
+			ActiveTexture(0);
+		BindTexture(activeUnit, id);
+	}
+
+	// uniforms of the current program
+	void Uniform1i(int location, int value)
+	{
+		if (location < 0)
+			return;
+		std::unordered_map<uint64_t, int>::iterator found = uniforms.find(uniformKey(location));
+		if (elide(found != uniforms.end() && found->second == value, STATE_UNIFORM))
+			return;
+		uniforms[uniformKey(location)] = value;
+		glUniform1i(location, value);
+	}
+
+	void Uniform1f(int location, float value)
+	{
+		if (floatsChanged(location, &value, 1))
+			glUniform1f(location, value);
+	}
+
+	void Uniform2f(int location, const glm::vec2& value)
+	{
+		if (floatsChanged(location, &value[0], 2))
+			glUniform2fv(location, 1, &value[0]);
+	}
+
+	void Uniform3f(int location, const glm::vec3& value)
+	{
+		if (floatsChanged(location, &value[0], 3))
+			glUniform3fv(location, 1, &value[0]);
+	}
+
+	void Uniform4f(int location, const glm::vec4& value)
+	{
+		if (floatsChanged(location, &value[0], 4))
+			glUniform4fv(location, 1, &value[0]);
+	}
+
+	void UniformMatrix2(int location, const glm::mat2& value)
+	{
+		if (floatsChanged(location, &value[0][0], 4))
+			glUniformMatrix2fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+
+	void UniformMatrix3(int location, const glm::mat3& value)
+	{
+		if (floatsChanged(location, &value[0][0], 9))
+			glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+
+	void UniformMatrix4(int location, const glm::mat4& value)
+	{
+		if (floatsChanged(location, &value[0][0], 16))
+			glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+
+	// deleting an object unbinds it, and GL may hand its name out again
+	void DeleteTexture(unsigned int id)
+	{
+		if (id == 0)
+			return;
+		for (unsigned int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+		{
+			if (textures[i] == id)
+				textures[i] = 0;
+		}
+		glDeleteTextures(1, &id);
+	}
+
+	void DeleteVertexArray(unsigned int id)
+	{
+		if (id == 0)
+			return;
+		if (vertexArray == id)
+			vertexArray = 0;
+		glDeleteVertexArrays(1, &id);
+	}
+
+	void DeleteBuffer(unsigned int id)
+	{
+		if (id == 0)
+			return;
+		for (unsigned int i = 0; i < BUFFER_TARGETS; i++)
+		{
+			if (buffers[i] == id)
+				buffers[i] = 0;
+		}
+		glDeleteBuffers(1, &id);
+	}
+
+private:
+	static const unsigned int unknown = ~0u;
+	static const unsigned int BUFFER_TARGETS = 5;
+	static const unsigned int CAPABILITIES = 4;
+
+	unsigned int program;
+	unsigned int vertexArray;
+	unsigned int framebuffer;
+	unsigned int activeUnit;
+	unsigned int textures[GL_STATE_TEXTURE_UNITS];
+	unsigned int buffers[BUFFER_TARGETS];
+	int capabilities[CAPABILITIES]; // -1 unknown, 0 disabled, 1 enabled
+	// last value per program and location; float uniforms up to a mat4 share one map, a location
+	// always has the same type
+	std::unordered_map<uint64_t, int> uniforms;
+	std::unordered_map<uint64_t, glm::mat4> floats;
+
+	GLStateStats frame = {};
+	GLStateStats lastFrame = {};
+
+	bool elide(bool current, GL_State_Call call)
+	{
+		if (current)
+			frame.elided[call]++;
+		else
+			frame.issued[call]++;
+		return current;
+	}
+
+	// compares 'count' floats with the last ones set at the location of the current program, and stores them
+	// if they differ. False for locations that aren't active.
+	bool floatsChanged(int location, const float* values, unsigned int count)
+	{
+		if (location < 0)
+			return false;
+		glm::mat4 value(0.0f);
+		std::memcpy(&value[0][0], values, count * sizeof(float));
+		std::unordered_map<uint64_t, glm::mat4>::iterator found = floats.find(uniformKey(location));
+		if (elide(found != floats.end() && found->second == value, STATE_UNIFORM))
+			return false;
+		floats[uniformKey(location)] = value;
+		return true;
+	}
+
+	void setCapability(GLenum capability, bool enabled)
+	{
+		int slot = capabilitySlot(capability);
+		if (slot >= 0 && elide(capabilities[slot] == (enabled ? 1 : 0), STATE_ENABLE))
+			return;
+		if (slot >= 0)
+			capabilities[slot] = enabled ? 1 : 0;
+		else
+			frame.issued[STATE_ENABLE]++;
+		if (enabled)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+
+	uint64_t uniformKey(int location) const
+	{
+		return ((uint64_t)program << 32) | (uint32_t)location;
+	}
+
+	static int bufferSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return 0;
+		case GL_UNIFORM_BUFFER: return 1;
+		case GL_DRAW_INDIRECT_BUFFER: return 2;
+		case GL_COPY_READ_BUFFER: return 3;
+		case GL_COPY_WRITE_BUFFER: return 4;
+		default: return -1;
+		}
+	}
+
+	static int capabilitySlot(GLenum capability)
+	{
+		switch (capability)
+		{
+		case GL_DEPTH_TEST: return 0;
+		case GL_BLEND: return 1;
+		case GL_CULL_FACE: return 2;
+		case GL_SCISSOR_TEST: return 3;
+		default: return -1;
+		}
+	}
+};
+#endif
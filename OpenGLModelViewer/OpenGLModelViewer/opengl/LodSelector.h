@@ -0,0 +1,79 @@
+#ifndef LOD_SELECTOR_H
+#define LOD_SELECTOR_H
+
+#include <opengl/model.h>
+#include <opengl/MeshSimplifier.h>
+#include <opengl/Timing.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// counters of the most recent Select call, over the meshes that are drawn
+struct LodStats
+{
+	unsigned int meshesAtLevel[MAX_LOD_LEVELS] = {};
+	size_t triangles = 0;     // drawn at the selected levels
+	size_t fullTriangles = 0; // what the full meshes would have drawn
+	double milliseconds = 0.0;
+};
+
+// Picks the level of detail of every mesh of a model from its screen-space error: a level's error, which
+// MeshSimplifier measures in model units, is projected at the distance of the nearest point of the mesh's
+// bounding sphere, and the coarsest level that stays below MaxScreenError pixels is drawn.
+class LodSelector
+{
+public:
+	// -1 selects by screen-space error, otherwise every mesh draws this level (or its coarsest, if it has fewer)
+	int ForcedLevel = -1;
+	// in pixels
+	float MaxScreenError = 1.0f;
+
+	// sets Mesh::lod of every mesh; 'visible' only limits which meshes are counted in the stats
+	LodStats Select(Model& model, const glm::mat4& modelMatrix, const glm::mat4& view, const glm::mat4& projection, float viewportHeight, const unsigned char* visible = nullptr)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		glm::mat4 modelView = view * modelMatrix;
+		float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+		// pixels per world unit at distance 1; an orthographic projection doesn't divide by the distance
+		float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+		bool perspective = projection[2][3] != 0.0f;
+
+		stats = LodStats();
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
+		{
+			Mesh& mesh = model.meshes[i];
+			unsigned int coarsest = (unsigned int)mesh.lods.size() - 1;
+			if (ForcedLevel >= 0)
+				mesh.lod = std::min((unsigned int)ForcedLevel, coarsest);
+			else
+			{
+				float pixels = pixelsPerUnit * scale;
+				if (perspective)
+				{
+					float depth = -(modelView * glm::vec4(mesh.bounds.center, 1.0f)).z - mesh.bounds.radius * scale;
+					pixels /= std::max(depth, 1e-4f);
+				}
+				mesh.lod = 0;
+				while (mesh.lod < coarsest && mesh.lods[mesh.lod + 1].error * pixels <= MaxScreenError)
+					mesh.lod++;
+			}
+
+			if (visible != nullptr && !visible[i])
+				continue;
+			stats.meshesAtLevel[std::min(mesh.lod, MAX_LOD_LEVELS - 1)]++;
+			stats.triangles += mesh.lods[mesh.lod].indexCount / 3;
+			stats.fullTriangles += mesh.indexCount / 3;
+		}
+		stats.milliseconds = ElapsedMilliseconds(start);
+		return stats;
+	}
+
+	LodStats Stats() const { return stats; }
+
+private:
+	LodStats stats;
+};
+#endif
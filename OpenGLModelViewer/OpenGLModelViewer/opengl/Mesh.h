@@ -3,13 +3,21 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <opengl/shader.h>
+#include <opengl/GLState.h>
+#include <opengl/OrientedBox.h>
+#include <opengl/Bvh.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <utility>
 #include <vector>
 using namespace std;
 
@@ -27,6 +35,17 @@ struct Vertex
     glm::vec3 Bitangent;
 };
 
+// Vertex squeezed into 20 bytes for the GPU. Positions are 16-bit fractions of the mesh's bounding box,
+// normal and tangent are octahedral encoded, texture coordinates are half floats and the bitangent is
+// rebuilt in material.vert from cross(normal, tangent) and the sign kept in Position[3].
+struct PackedVertex
+{
+    unsigned short Position[4];
+    short Normal[2];
+    short Tangent[2];
+    unsigned short TexCoords[2];
+};
+
 struct Texture
 {
     unsigned int id;
@@ -34,88 +53,302 @@ struct Texture
     string path;
 };
 
-class Mesh
+// model-space bounding boxes and sphere of a mesh's vertices, for culling and depth sorting
+struct MeshBounds
+{
+    glm::vec3 minimum = glm::vec3(0.0f);
+    glm::vec3 maximum = glm::vec3(0.0f);
+    // the sphere shares the box's center; its radius reaches the farthest vertex, which is at most half the diagonal
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+    OrientedBox orientedBox;
+
+    static MeshBounds FromVertices(const vector<Vertex>& vertices)
+    {
+        MeshBounds bounds;
+        if (vertices.empty())
+            return bounds;
+        bounds.minimum = bounds.maximum = vertices[0].Position;
+        for (size_t i = 1; i < vertices.size(); i++)
+        {
+            bounds.minimum = glm::min(bounds.minimum, vertices[i].Position);
+            bounds.maximum = glm::max(bounds.maximum, vertices[i].Position);
+        }
+        bounds.center = (bounds.minimum + bounds.maximum) * 0.5f;
+        float radiusSquared = 0.0f;
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            glm::vec3 offset = vertices[i].Position - bounds.center;
+            radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+        }
+        bounds.radius = std::sqrt(radiusSquared);
+        bounds.orientedBox = OrientedBox::FromPoints(&vertices[0].Position, vertices.size(), sizeof(Vertex));
+        return bounds;
+    }
+};
+
+// one level of detail: a range of the mesh's index buffer, and how far, in model units, its surface may be from
+// the full mesh's. Every level indexes the same vertices.
+struct MeshLod
+{
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    float error;
+};
+
+// a small cluster of the full mesh's triangles, stored as one range of its indices (see MeshletBuilder), with a
+// bounding sphere and a cone around the normals of its triangles. An eye for which
+// dot(normalize(coneApex - eye), coneAxis) >= coneCutoff sees all of them from behind; a cutoff of 1 or more
+// means the normals are too spread out for the test.
+struct Meshlet
+{
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneApex;
+    float coneCutoff;
+    glm::vec3 coneAxis;
+    unsigned int vertexCount;
+};
+
+// CPU-side result of importing a mesh, before any GL object exists. Texture ids stay 0 until the GL thread loads them.
+struct MeshData
 {
-public:
-    /*  Mesh Data  */
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
-    unsigned int VAO;
+    // the coarser levels' indices, stored after 'indices' in the index buffer; 'lods' lists every level, the full
+    // mesh first, or is empty when no levels were built (see MeshSimplifier)
+    vector<unsigned int> lodIndices;
+    vector<MeshLod> lods;
+    vector<Meshlet> meshlets; // empty unless they were built
+    MeshBounds bounds;
+    TriangleBvh bvh;
+};
 
-    /*  Functions  */
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
-    {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+// layout of the vertex and index buffers on the GPU
+enum Vertex_Format
+{
+    FULL_VERTEX,    // Vertex as is and 32-bit indices
+    PACKED_VERTEX   // PackedVertex, plus 16-bit indices for meshes with fewer than 65536 vertices
+};
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+// most textures one material binds; they go to units 0 .. MAX_MATERIAL_TEXTURES - 1
+const unsigned int MAX_MATERIAL_TEXTURES = 8;
+
+// whether two meshes bind the same material, i.e. the same textures in the same slots
+inline bool SameTextures(const vector<Texture>& a, const vector<Texture>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (unsigned int i = 0; i < a.size(); i++)
+    {
+        if (a[i].id != b[i].id || a[i].type != b[i].type)
+            return false;
     }
+    return true;
+}
 
-    // render the mesh
-    void Draw(Shader shader)
+// Everything a draw needs to bind its material, resolved once per shader program: sampler locations, texture
+// units (the index) and GL texture ids. Binding it does no string work, uniform lookups or allocations.
+struct MaterialBinding
+{
+    unsigned int program = 0; // program the locations belong to; 0 = not compiled yet
+    unsigned int textureCount = 0;
+    int samplerLocations[MAX_MATERIAL_TEXTURES];
+    unsigned int textureIds[MAX_MATERIAL_TEXTURES];
+    int packedLocation = -1;
+    int packedVertices = 0;
+
+    // finds the samplers of the textures (texture_diffuseN, texture_specularN, ...) and packedVertices in the
+    // shader's uniform table
+    void Compile(const vector<Texture>& textures, Vertex_Format format, const Shader& shader)
     {
-        // bind appropriate textures
+        if (textures.size() > MAX_MATERIAL_TEXTURES)
+            cout << "ERROR::MATERIAL:: only the first " << MAX_MATERIAL_TEXTURES << " of " << textures.size() << " textures are bound" << endl;
+        textureCount = (unsigned int)std::min<size_t>(textures.size(), MAX_MATERIAL_TEXTURES);
+
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr = 1;
         unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
+        for (unsigned int i = 0; i < textureCount; i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
+            const string& name = textures[i].type;
+            unsigned int number = 0;
             if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
+                number = diffuseNr++;
             else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
+                number = specularNr++;
             else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
+                number = normalNr++;
             else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
+                number = heightNr++;
+
+            char sampler[64];
+            if (number > 0)
+                snprintf(sampler, sizeof(sampler), "%s%u", name.c_str(), number);
+            else
+                snprintf(sampler, sizeof(sampler), "%s", name.c_str());
+            samplerLocations[i] = shader.UniformLocation(sampler);
+            textureIds[i] = textures[i].id;
+        }
+        packedLocation = shader.UniformLocation("packedVertices");
+        packedVertices = format == PACKED_VERTEX;
+        program = shader.ID;
+    }
+
+    void Bind() const
+    {
+        GLState& state = GLState::Current();
+        for (unsigned int i = 0; i < textureCount; i++)
+        {
+            state.Uniform1i(samplerLocations[i], i);
+            state.BindTexture(i, textureIds[i]);
+        }
+        // how material.vert decodes the vertices
+        state.Uniform1i(packedLocation, packedVertices);
+    }
+};
+
+// what happens to the CPU copy of a mesh's geometry once it has been uploaded
+enum Geometry_Residency
+{
+    RELEASE_GEOMETRY,   // free it right after the upload; the GPU buffers are the only copy
+    KEEP_GEOMETRY       // keep it for CPU-side consumers such as picking or export
+};
+
+class Mesh
+{
+public:
+    /*  Mesh Data  */
+    // empty after the upload unless the mesh was created with KEEP_GEOMETRY
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<Texture> textures;
+    unsigned int VAO;
+    unsigned int vertexCount;
+    unsigned int indexCount;       // of the full mesh
+    unsigned int bufferIndexCount; // of every level together
+    Vertex_Format format;
+    GLenum indexType;
+    // PackedVertex positions are dequantized as positionOffset + Position * positionScale
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    // computed on import (see Model::Import); the vertices may be gone by the time the mesh is drawn
+    MeshBounds bounds;
+    TriangleBvh bvh;
+    // the levels of detail, the full mesh first, and the one Draw uses (set by LodSelector)
+    vector<MeshLod> lods;
+    unsigned int lod = 0;
+    // clusters of the full mesh for MeshletCuller, if they were built on import
+    vector<Meshlet> meshlets;
 
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+    /*  Functions  */
+    // constructor. The buffers are moved in, so pass them with std::move to avoid copying the geometry.
+    // lodIndices and lods are the coarser levels of detail as MeshData holds them; they only live on the GPU.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, Geometry_Residency residency = KEEP_GEOMETRY, Vertex_Format format = FULL_VERTEX,
+        const vector<unsigned int>& lodIndices = vector<unsigned int>(), vector<MeshLod> lods = vector<MeshLod>())
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), format(format), lods(std::move(lods))
+    {
+        vertexCount = (unsigned int)this->vertices.size();
+        indexCount = (unsigned int)this->indices.size();
+        bufferIndexCount = indexCount + (unsigned int)lodIndices.size();
+        indexType = GL_UNSIGNED_INT;
+        positionOffset = glm::vec3(0.0f);
+        positionScale = glm::vec3(1.0f);
+        if (this->lods.empty())
+        {
+            MeshLod full = { 0, indexCount, 0.0f };
+            this->lods.push_back(full);
         }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        // now that we have all the required data, set the vertex buffers and its attribute pointers.
+        setupMesh(lodIndices);
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        if (residency == RELEASE_GEOMETRY)
+            ReleaseGeometry();
     }
 
-private:
-    /*  Render data  */
-    unsigned int VBO, EBO;
+    // deletes the GL objects, e.g. when a loaded model or a refined mesh replaces this one; it can't be drawn afterwards
+    void DeleteBuffers()
+    {
+        GLState::Current().DeleteVertexArray(VAO);
+        GLState::Current().DeleteBuffer(VBO);
+        GLState::Current().DeleteBuffer(EBO);
+        VAO = VBO = EBO = 0;
+        vertexCount = indexCount = 0;
+        gpuBytes = 0;
+    }
 
-    /*  Functions    */
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // frees the CPU copy of the vertices and indices; the mesh keeps drawing from its GPU buffers
+    void ReleaseGeometry()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+    }
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+    bool HasGeometry() const { return !vertices.empty(); }
+
+    // size of the GPU buffers, and what they would take in the full format
+    size_t GeometryBytes() const { return gpuBytes; }
+    size_t FullGeometryBytes() const { return vertexCount * sizeof(Vertex) + bufferIndexCount * sizeof(unsigned int); }
+    size_t ResidentGeometryBytes() const { return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int); }
+
+    // the GPU buffers, for renderers that merge meshes (see BatchRenderer)
+    unsigned int VertexBuffer() const { return VBO; }
+    unsigned int IndexBuffer() const { return EBO; }
+    size_t VertexStride() const { return VertexStride(format); }
+    size_t IndexSize() const { return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int); }
+
+    static size_t VertexStride(Vertex_Format format) { return format == PACKED_VERTEX ? sizeof(PackedVertex) : sizeof(Vertex); }
+
+    // replaces one texture, e.g. a placeholder once the real image is uploaded
+    void SetTexture(unsigned int index, const Texture& texture)
+    {
+        textures[index] = texture;
+        binding.program = 0;
+    }
+
+    // render the mesh. The material binding is compiled on the first draw with a shader and reused after that.
+    void Draw(const Shader& shader)
+    {
+        bind(shader);
+        // draw the selected level; the VAO and textures stay bound so the next draw can skip rebinding them
+        const MeshLod& level = lods[lod];
+        glDrawElements(GL_TRIANGLES, level.indexCount, indexType, (void *)(level.firstIndex * IndexSize()));
+    }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+    // draws ranges of the index buffer with one glMultiDrawElements, e.g. the meshlets that survived culling
+    // (see MeshletCuller). The offsets are in bytes.
+    void DrawRanges(const Shader& shader, const GLsizei* counts, const void* const* offsets, GLsizei rangeCount)
+    {
+        if (rangeCount == 0)
+            return;
+        bind(shader);
+        glMultiDrawElements(GL_TRIANGLES, counts, indexType, offsets, rangeCount);
+    }
+
+    // sets the attribute pointers of a vertex layout on the bound VAO and GL_ARRAY_BUFFER
+    static void SetupAttributes(Vertex_Format format)
+    {
+        if (format == PACKED_VERTEX)
+        {
+            // positions in [0, 1] with the bitangent sign in w; octahedral normal and tangent as raw shorts, scaled
+            // in the shader so the result doesn't depend on the GL version's snorm conversion rule
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, Position));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, Normal));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, TexCoords));
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 2, GL_SHORT, GL_FALSE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, Tangent));
+            glDisableVertexAttribArray(4);
+            return;
+        }
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -133,8 +366,138 @@ private:
         // vertex bitangent
         glEnableVertexAttribArray(4);
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, Bitangent));
+    }
+
+private:
+    /*  Render data  */
+    unsigned int VBO, EBO;
+    size_t gpuBytes;
+    MaterialBinding binding;
+
+    /*  Functions    */
+    // binds the material and the VAO. The dequantization of packed positions comes in through the per-draw
+    // attributes 5 and 6, which hold these constant values while their arrays are disabled.
+    void bind(const Shader& shader)
+    {
+        if (binding.program != shader.ID)
+            binding.Compile(textures, format, shader);
+        binding.Bind();
+        glVertexAttrib3fv(5, &positionOffset[0]);
+        glVertexAttrib3fv(6, &positionScale[0]);
+        GLState::Current().BindVertexArray(VAO);
+    }
+
+    // initializes all the buffer objects/arrays
+    void setupMesh(const vector<unsigned int>& lodIndices)
+    {
+        // create buffers/arrays
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
 
-        glBindVertexArray(0);
+        GLState::Current().BindVertexArray(VAO);
+        if (format == PACKED_VERTEX)
+        {
+            setupPackedMesh(lodIndices);
+            GLState::Current().BindVertexArray(0);
+            return;
+        }
+        // load data into vertex buffers
+        GLState::Current().BindBuffer(GL_ARRAY_BUFFER, VBO);
+        // A great thing about structs is that their memory layout is sequential for all its items.
+        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+        // again translates to 3/2 floats which translates to a byte array.
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+
+        GLState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        uploadIndices(lodIndices);
+
+        SetupAttributes(FULL_VERTEX);
+
+        gpuBytes = FullGeometryBytes();
+        GLState::Current().BindVertexArray(0);
+    }
+
+    // the full mesh's indices followed by the coarser levels', as 32-bit indices into the bound GL_ELEMENT_ARRAY_BUFFER
+    void uploadIndices(const vector<unsigned int>& lodIndices)
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, bufferIndexCount * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+        if (!indices.empty())
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(unsigned int), &indices[0]);
+        if (!lodIndices.empty())
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), lodIndices.size() * sizeof(unsigned int), &lodIndices[0]);
+    }
+
+    // uploads the PackedVertex layout into the bound VAO
+    void setupPackedMesh(const vector<unsigned int>& lodIndices)
+    {
+        glm::vec3 minimum(0.0f), maximum(0.0f);
+        if (!vertices.empty())
+            minimum = maximum = vertices[0].Position;
+        for (size_t i = 1; i < vertices.size(); i++)
+        {
+            minimum = glm::min(minimum, vertices[i].Position);
+            maximum = glm::max(maximum, vertices[i].Position);
+        }
+        positionOffset = minimum;
+        positionScale = maximum - minimum;
+
+        vector<PackedVertex> packed(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+            packVertex(vertices[i], packed[i]);
+
+        GLState::Current().BindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), packed.empty() ? nullptr : &packed[0], GL_STATIC_DRAW);
+        gpuBytes = packed.size() * sizeof(PackedVertex);
+
+        GLState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        if (vertices.size() < 65536)
+        {
+            vector<unsigned short> shortIndices(indices.begin(), indices.end());
+            shortIndices.insert(shortIndices.end(), lodIndices.begin(), lodIndices.end());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.empty() ? nullptr : &shortIndices[0], GL_STATIC_DRAW);
+            indexType = GL_UNSIGNED_SHORT;
+            gpuBytes += shortIndices.size() * sizeof(unsigned short);
+        }
+        else
+        {
+            uploadIndices(lodIndices);
+            gpuBytes += bufferIndexCount * sizeof(unsigned int);
+        }
+
+        SetupAttributes(PACKED_VERTEX);
+    }
+
+    void packVertex(const Vertex& vertex, PackedVertex& packed) const
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            float t = positionScale[c] > 0.0f ? (vertex.Position[c] - positionOffset[c]) / positionScale[c] : 0.0f;
+            packed.Position[c] = (unsigned short)std::floor(glm::clamp(t, 0.0f, 1.0f) * 65535.0f + 0.5f);
+        }
+        float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent);
+        packed.Position[3] = handedness < 0.0f ? 0 : 65535;
+        packOctahedral(vertex.Normal, packed.Normal);
+        packOctahedral(vertex.Tangent, packed.Tangent);
+        packed.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+        packed.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+    }
+
+    // maps the unit sphere onto an octahedron unfolded into [-1, 1]^2
+    static void packOctahedral(glm::vec3 direction, short encoded[2])
+    {
+        float length = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+        if (length == 0.0f)
+            direction = glm::vec3(0.0f, 0.0f, 1.0f), length = 1.0f;
+        direction /= length;
+        glm::vec2 folded(direction.x, direction.y);
+        if (direction.z < 0.0f)
+        {
+            folded.x = (1.0f - std::abs(direction.y)) * (direction.x >= 0.0f ? 1.0f : -1.0f);
+            folded.y = (1.0f - std::abs(direction.x)) * (direction.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        encoded[0] = (short)std::floor(glm::clamp(folded.x, -1.0f, 1.0f) * 32767.0f + 0.5f);
+        encoded[1] = (short)std::floor(glm::clamp(folded.y, -1.0f, 1.0f) * 32767.0f + 0.5f);
     }
 };
 #endif
\ No newline at end of file
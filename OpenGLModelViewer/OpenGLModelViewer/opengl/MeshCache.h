@@ -0,0 +1,462 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <opengl/mesh.h>
+#include <opengl/MeshOptimizer.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Directory the binary mesh caches are written to (relative to the working directory, like the shaders)
+const char* const MESH_CACHE_DIRECTORY = "./cache";
+// Bump whenever the cache layout or the Vertex struct changes so stale files are rebuilt
+const uint32_t MESH_CACHE_VERSION = 4;
+
+// Read-only memory mapping of a whole file. The mapping is released when the object goes out of scope.
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path)
+	{
+		Close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			Close();
+			return false;
+		}
+		data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = (size_t)fileSize.QuadPart;
+#else
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+		void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		data = (view == MAP_FAILED) ? nullptr : (const unsigned char*)view;
+		size = (size_t)st.st_size;
+#endif
+		if (data == nullptr)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != nullptr)
+			munmap((void*)data, size);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
+
+// 64-bit FNV-1a over a byte range; cheap enough to run over a whole source model on every load
+inline uint64_t HashBytes(const unsigned char* bytes, size_t length, uint64_t seed = 14695981039346656037ULL)
+{
+	uint64_t hash = seed;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*  On-disk layout (every section starts 16-byte aligned so it can be used in place from the mapping):
+    MeshCacheHeader | MeshCacheEntry[meshCount] | MeshCacheTextureRef[textureCount] | MeshOptimizationStats[optimizationCount] |
+    MeshCacheLod[lodCount] | Meshlet[meshletCount] | Vertex[vertexCount] | unsigned int[indexCount] | char strings[]
+    Each mesh's coarser levels of detail follow its full index list, so a mesh's indices are indices ++ lodIndices.  */
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t importFlags;
+	uint32_t vertexStride;
+	uint32_t meshCount;
+	uint32_t textureCount;
+	uint32_t optimizationCount; // meshCount when the meshes went through MeshOptimizer, 0 otherwise
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	uint32_t padding;
+	uint64_t vertexCount;
+	uint64_t indexCount;
+	uint64_t entryOffset;
+	uint64_t textureOffset;
+	uint64_t optimizationOffset;
+	uint64_t lodOffset;
+	uint64_t meshletOffset;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t stringOffset;
+	uint64_t fileSize;
+};
+
+struct MeshCacheEntry
+{
+	uint64_t firstVertex;
+	uint64_t firstIndex;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	uint32_t lodIndexCount; // the indices of the coarser levels, after the indexCount of the full mesh
+	uint32_t firstLod;
+	uint32_t lodCount;      // 0 when no levels were built
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;  // 0 when no meshlets were built
+	uint32_t reserved;
+};
+
+// one level of detail of a mesh; the same as MeshLod
+struct MeshCacheLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+	uint32_t reserved;
+};
+
+struct MeshCacheTextureRef
+{
+	uint32_t typeOffset;
+	uint32_t typeLength;
+	uint32_t pathOffset;
+	uint32_t pathLength;
+};
+
+// A validated, mapped cache file. Pointers returned from here stay valid while the MeshCacheView is alive.
+class MeshCacheView
+{
+public:
+	bool Open(const std::string& path, uint64_t sourceHash, uint32_t importFlags)
+	{
+		if (!file.Open(path) || file.Size() < sizeof(MeshCacheHeader))
+			return false;
+
+		header = (const MeshCacheHeader*)file.Data();
+		if (std::memcmp(header->magic, "OMVC", 4) != 0 ||
+			header->version != MESH_CACHE_VERSION ||
+			header->sourceHash != sourceHash ||
+			header->importFlags != importFlags ||
+			header->vertexStride != sizeof(Vertex) ||
+			header->fileSize != file.Size() ||
+			!fits(header->entryOffset, header->meshCount, sizeof(MeshCacheEntry)) ||
+			!fits(header->textureOffset, header->textureCount, sizeof(MeshCacheTextureRef)) ||
+			(header->optimizationCount != 0 && header->optimizationCount != header->meshCount) ||
+			!fits(header->optimizationOffset, header->optimizationCount, sizeof(MeshOptimizationStats)) ||
+			!fits(header->lodOffset, header->lodCount, sizeof(MeshCacheLod)) ||
+			!fits(header->meshletOffset, header->meshletCount, sizeof(Meshlet)) ||
+			!fits(header->vertexOffset, header->vertexCount, sizeof(Vertex)) ||
+			!fits(header->indexOffset, header->indexCount, sizeof(unsigned int)) ||
+			!fits(header->stringOffset, 0, 1) ||
+			!entriesValid())
+		{
+			file.Close();
+			header = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int MeshCount() const { return header->meshCount; }
+	const MeshCacheEntry& Entry(unsigned int i) const { return ((const MeshCacheEntry*)(file.Data() + header->entryOffset))[i]; }
+	const Vertex* Vertices(const MeshCacheEntry& entry) const { return (const Vertex*)(file.Data() + header->vertexOffset) + entry.firstVertex; }
+	const unsigned int* Indices(const MeshCacheEntry& entry) const { return (const unsigned int*)(file.Data() + header->indexOffset) + entry.firstIndex; }
+	const MeshCacheTextureRef& TextureRef(unsigned int i) const { return ((const MeshCacheTextureRef*)(file.Data() + header->textureOffset))[i]; }
+	// the optimizer statistics of every mesh, or nullptr if the meshes weren't optimized
+	const MeshOptimizationStats* Optimization() const { return header->optimizationCount != 0 ? (const MeshOptimizationStats*)(file.Data() + header->optimizationOffset) : nullptr; }
+	const MeshCacheLod& Lod(unsigned int i) const { return ((const MeshCacheLod*)(file.Data() + header->lodOffset))[i]; }
+	const Meshlet* Meshlets(const MeshCacheEntry& entry) const { return (const Meshlet*)(file.Data() + header->meshletOffset) + entry.firstMeshlet; }
+	std::string String(uint32_t offset, uint32_t length) const
+	{
+		const char* strings = (const char*)file.Data() + header->stringOffset;
+		if (header->stringOffset + offset + length > file.Size())
+			return std::string();
+		return std::string(strings + offset, length);
+	}
+
+private:
+	MappedFile file;
+	const MeshCacheHeader* header = nullptr;
+
+	// whether 'count' elements of 'size' bytes at 'offset' lie inside the file, without overflowing
+	bool fits(uint64_t offset, uint64_t count, uint64_t size) const
+	{
+		return offset <= file.Size() && count <= (file.Size() - offset) / size;
+	}
+
+	// every range an entry or texture ref points at lies inside the counts of the header, so a corrupt file is
+	// rejected here instead of being read out of bounds later
+	bool entriesValid() const
+	{
+		uint64_t stringBytes = file.Size() - header->stringOffset;
+		for (unsigned int i = 0; i < header->meshCount; i++)
+		{
+			const MeshCacheEntry& entry = Entry(i);
+			uint64_t bufferIndexCount = (uint64_t)entry.indexCount + entry.lodIndexCount;
+			if (entry.firstVertex > header->vertexCount || entry.vertexCount > header->vertexCount - entry.firstVertex ||
+				entry.firstIndex > header->indexCount || bufferIndexCount > header->indexCount - entry.firstIndex ||
+				entry.firstTexture > header->textureCount || entry.textureCount > header->textureCount - entry.firstTexture ||
+				entry.firstLod > header->lodCount || entry.lodCount > header->lodCount - entry.firstLod ||
+				entry.firstMeshlet > header->meshletCount || entry.meshletCount > header->meshletCount - entry.firstMeshlet)
+				return false;
+			for (unsigned int j = 0; j < entry.lodCount; j++)
+			{
+				const MeshCacheLod& lod = Lod(entry.firstLod + j);
+				if ((uint64_t)lod.firstIndex + lod.indexCount > bufferIndexCount)
+					return false;
+			}
+			// meshlets split the full index list
+			const Meshlet* meshlets = Meshlets(entry);
+			for (unsigned int j = 0; j < entry.meshletCount; j++)
+			{
+				if ((uint64_t)meshlets[j].firstIndex + meshlets[j].indexCount > entry.indexCount)
+					return false;
+			}
+		}
+		for (unsigned int i = 0; i < header->textureCount; i++)
+		{
+			const MeshCacheTextureRef& ref = TextureRef(i);
+			if ((uint64_t)ref.typeOffset + ref.typeLength > stringBytes || (uint64_t)ref.pathOffset + ref.pathLength > stringBytes)
+				return false;
+		}
+		return true;
+	}
+};
+
+class MeshCache
+{
+public:
+	// hashes the source model's bytes; returns false if the file can't be read
+	static bool HashSource(const std::string& sourcePath, uint64_t& hash)
+	{
+		MappedFile source;
+		if (!source.Open(sourcePath))
+			return false;
+		hash = HashBytes(source.Data(), source.Size());
+		return true;
+	}
+
+	static void MakeDirectory(const char* path)
+	{
+#ifdef _WIN32
+		_mkdir(path);
+#else
+		mkdir(path, 0755);
+#endif
+	}
+
+	// cache file name for a given source hash and Assimp post-process flag set
+	static std::string PathFor(uint64_t sourceHash, uint32_t importFlags)
+	{
+		uint64_t key = HashBytes((const unsigned char*)&importFlags, sizeof(importFlags), sourceHash);
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.meshcache", (unsigned long long)key);
+		return std::string(MESH_CACHE_DIRECTORY) + "/" + name;
+	}
+
+	// serializes the final meshes and, when MeshOptimizer ran, its statistics (one per mesh, or empty); written to a
+	// temporary file first so a crash never leaves a half-written cache behind
+	static bool Write(const std::string& cachePath, uint64_t sourceHash, uint32_t importFlags, const std::vector<MeshData>& meshes, const std::vector<MeshOptimizationStats>& optimization)
+	{
+		MakeDirectory(MESH_CACHE_DIRECTORY);
+
+		std::vector<MeshCacheEntry> entries;
+		std::vector<MeshCacheTextureRef> textureRefs;
+		std::vector<MeshCacheLod> lods;
+		uint64_t meshletCount = 0;
+		std::string strings;
+		uint64_t vertexCount = 0;
+		uint64_t indexCount = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const MeshData& mesh = meshes[i];
+			MeshCacheEntry entry;
+			entry.firstVertex = vertexCount;
+			entry.firstIndex = indexCount;
+			entry.vertexCount = (uint32_t)mesh.vertices.size();
+			entry.indexCount = (uint32_t)mesh.indices.size();
+			entry.firstTexture = (uint32_t)textureRefs.size();
+			entry.textureCount = (uint32_t)mesh.textures.size();
+			entry.lodIndexCount = (uint32_t)mesh.lodIndices.size();
+			entry.firstLod = (uint32_t)lods.size();
+			entry.lodCount = (uint32_t)mesh.lods.size();
+			entry.firstMeshlet = (uint32_t)meshletCount;
+			entry.meshletCount = (uint32_t)mesh.meshlets.size();
+			entry.reserved = 0;
+			meshletCount += mesh.meshlets.size();
+			for (unsigned int j = 0; j < mesh.lods.size(); j++)
+			{
+				MeshCacheLod lod = { mesh.lods[j].firstIndex, mesh.lods[j].indexCount, mesh.lods[j].error, 0 };
+				lods.push_back(lod);
+			}
+			for (unsigned int j = 0; j < mesh.textures.size(); j++)
+			{
+				MeshCacheTextureRef ref;
+				ref.typeOffset = (uint32_t)strings.size();
+				ref.typeLength = (uint32_t)mesh.textures[j].type.size();
+				strings += mesh.textures[j].type;
+				ref.pathOffset = (uint32_t)strings.size();
+				ref.pathLength = (uint32_t)mesh.textures[j].path.size();
+				strings += mesh.textures[j].path;
+				textureRefs.push_back(ref);
+			}
+			vertexCount += mesh.vertices.size();
+			indexCount += mesh.indices.size() + mesh.lodIndices.size();
+			entries.push_back(entry);
+		}
+
+		MeshCacheHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, "OMVC", 4);
+		header.version = MESH_CACHE_VERSION;
+		header.sourceHash = sourceHash;
+		header.importFlags = importFlags;
+		header.vertexStride = sizeof(Vertex);
+		header.meshCount = (uint32_t)entries.size();
+		header.textureCount = (uint32_t)textureRefs.size();
+		header.optimizationCount = optimization.size() == meshes.size() ? (uint32_t)optimization.size() : 0;
+		header.lodCount = (uint32_t)lods.size();
+		header.meshletCount = (uint32_t)meshletCount;
+		header.vertexCount = vertexCount;
+		header.indexCount = indexCount;
+		header.entryOffset = align(sizeof(MeshCacheHeader));
+		header.textureOffset = align(header.entryOffset + entries.size() * sizeof(MeshCacheEntry));
+		header.optimizationOffset = align(header.textureOffset + textureRefs.size() * sizeof(MeshCacheTextureRef));
+		header.lodOffset = align(header.optimizationOffset + header.optimizationCount * sizeof(MeshOptimizationStats));
+		header.meshletOffset = align(header.lodOffset + lods.size() * sizeof(MeshCacheLod));
+		header.vertexOffset = align(header.meshletOffset + meshletCount * sizeof(Meshlet));
+		header.indexOffset = align(header.vertexOffset + vertexCount * sizeof(Vertex));
+		header.stringOffset = align(header.indexOffset + indexCount * sizeof(unsigned int));
+		header.fileSize = header.stringOffset + strings.size();
+
+		std::string tempPath = cachePath + ".tmp";
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		uint64_t written = 0;
+		writeAt(out, written, 0, &header, sizeof(header));
+		writeAt(out, written, header.entryOffset, entries.data(), entries.size() * sizeof(MeshCacheEntry));
+		writeAt(out, written, header.textureOffset, textureRefs.data(), textureRefs.size() * sizeof(MeshCacheTextureRef));
+		writeAt(out, written, header.optimizationOffset, optimization.data(), header.optimizationCount * sizeof(MeshOptimizationStats));
+		writeAt(out, written, header.lodOffset, lods.data(), lods.size() * sizeof(MeshCacheLod));
+		writeAt(out, written, header.meshletOffset, nullptr, 0);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			writeAt(out, written, written, meshes[i].meshlets.data(), meshes[i].meshlets.size() * sizeof(Meshlet));
+		writeAt(out, written, header.vertexOffset, nullptr, 0);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			writeAt(out, written, written, meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+		writeAt(out, written, header.indexOffset, nullptr, 0);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			writeAt(out, written, written, meshes[i].indices.data(), meshes[i].indices.size() * sizeof(unsigned int));
+			writeAt(out, written, written, meshes[i].lodIndices.data(), meshes[i].lodIndices.size() * sizeof(unsigned int));
+		}
+		writeAt(out, written, header.stringOffset, strings.data(), strings.size());
+		out.close();
+		if (!out)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+
+		std::remove(cachePath.c_str());
+		return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+	}
+
+private:
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 15) & ~(uint64_t)15;
+	}
+
+	// pads the stream up to 'offset' and then appends 'length' bytes
+	static void writeAt(std::ofstream& out, uint64_t& written, uint64_t offset, const void* bytes, size_t length)
+	{
+		static const char zeros[16] = { 0 };
+		while (written < offset)
+		{
+			size_t pad = (size_t)std::min<uint64_t>(offset - written, sizeof(zeros));
+			out.write(zeros, pad);
+			written += pad;
+		}
+		if (length > 0)
+		{
+			out.write((const char*)bytes, length);
+			written += length;
+		}
+	}
+};
+#endif
@@ -0,0 +1,433 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <opengl/mesh.h>
+#include <opengl/ThreadPool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// size of the FIFO post-transform cache the orderings are tuned for and measured against
+const unsigned int VERTEX_CACHE_SIZE = 16;
+// how much worse than the cache-optimal order a cluster may get so it can be drawn in a better place for overdraw
+const float OVERDRAW_THRESHOLD = 1.05f;
+// resolution of the six views rasterized to estimate overdraw
+const int OVERDRAW_RESOLUTION = 256;
+
+struct VertexCacheStats
+{
+	float acmr; // average cache miss ratio: transformed vertices per triangle, 0.5 is the ideal for large grids
+	float atvr; // average transform to vertex ratio: transformed vertices per unique vertex, 1.0 is the ideal
+};
+
+// before/after measurements of one optimized mesh
+struct MeshOptimizationStats
+{
+	unsigned int vertices = 0;
+	unsigned int triangles = 0;
+	VertexCacheStats before = { 0.0f, 0.0f };
+	VertexCacheStats after = { 0.0f, 0.0f };
+	float overdrawBefore = 0.0f; // shaded fragments per covered pixel
+	float overdrawAfter = 0.0f;
+	double milliseconds = 0.0;   // time spent reordering, without the measurements
+};
+
+// Reorders a mesh for the GPU: triangles for post-transform vertex cache hits (Tipsify, Sander et al. 2007),
+// then clusters of those triangles so outward facing ones are drawn first and occlude the rest, and finally
+// the vertices in the order the indices first use them for fetch locality. Rendering is unchanged.
+class MeshOptimizer
+{
+public:
+	// optimizes every mesh, several meshes at once on the thread pool (maxThreads 0 = the whole pool)
+	static void OptimizeAll(std::vector<MeshData>& meshes, std::vector<MeshOptimizationStats>& stats, unsigned int maxThreads = 0)
+	{
+		stats.assign(meshes.size(), MeshOptimizationStats());
+		ThreadPool::Shared().ParallelFor(meshes.size(), [&meshes, &stats](size_t i)
+		{
+			stats[i] = Optimize(meshes[i]);
+		}, maxThreads);
+	}
+
+	static MeshOptimizationStats Optimize(MeshData& mesh)
+	{
+		MeshOptimizationStats stats;
+		stats.vertices = (unsigned int)mesh.vertices.size();
+		stats.triangles = (unsigned int)(mesh.indices.size() / 3);
+		if (mesh.indices.empty() || mesh.indices.size() % 3 != 0)
+			return stats;
+
+		stats.before = AnalyzeVertexCache(mesh.indices, stats.vertices);
+		stats.overdrawBefore = AnalyzeOverdraw(mesh.vertices, mesh.indices);
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::vector<unsigned int> clusters;
+		OptimizeVertexCache(mesh.indices, stats.vertices, clusters);
+		OptimizeOverdraw(mesh.vertices, mesh.indices, clusters, OVERDRAW_THRESHOLD);
+		OptimizeVertexFetch(mesh.vertices, mesh.indices);
+		stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		stats.vertices = (unsigned int)mesh.vertices.size();
+		stats.after = AnalyzeVertexCache(mesh.indices, stats.vertices);
+		stats.overdrawAfter = AnalyzeOverdraw(mesh.vertices, mesh.indices);
+		return stats;
+	}
+
+	// simulates a FIFO vertex cache over the index buffer
+	static VertexCacheStats AnalyzeVertexCache(const std::vector<unsigned int>& indices, unsigned int vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+	{
+		VertexCacheStats result = { 0.0f, 0.0f };
+		if (indices.empty())
+			return result;
+
+		// a vertex is cached while fewer than cacheSize misses happened since its own
+		std::vector<unsigned int> missedAt(vertexCount, 0);
+		std::vector<bool> used(vertexCount, false);
+		unsigned int misses = 0;
+		unsigned int unique = 0;
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int v = indices[i];
+			if (missedAt[v] == 0 || misses + 1 - missedAt[v] > cacheSize)
+				missedAt[v] = ++misses;
+			if (!used[v])
+			{
+				used[v] = true;
+				unique++;
+			}
+		}
+		result.acmr = (float)misses / (float)(indices.size() / 3);
+		result.atvr = (float)misses / (float)unique;
+		return result;
+	}
+
+	// rasterizes the mesh with depth testing and back-face culling from the six axis directions and returns
+	// the fragments that passed the depth test per covered pixel (1.0 = no overdraw)
+	static float AnalyzeOverdraw(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+	{
+		if (vertices.empty() || indices.empty())
+			return 0.0f;
+
+		glm::vec3 minimum = vertices[0].Position, maximum = vertices[0].Position;
+		for (size_t i = 1; i < vertices.size(); i++)
+		{
+			minimum = glm::min(minimum, vertices[i].Position);
+			maximum = glm::max(maximum, vertices[i].Position);
+		}
+		glm::vec3 extent = maximum - minimum;
+		float size = std::max(extent.x, std::max(extent.y, extent.z));
+		if (size <= 0.0f)
+			return 0.0f;
+		float scale = (OVERDRAW_RESOLUTION - 1) / size;
+
+		std::vector<float> depth(OVERDRAW_RESOLUTION * OVERDRAW_RESOLUTION);
+		size_t shaded = 0;
+		size_t covered = 0;
+		for (int view = 0; view < 6; view++)
+		{
+			int axis = view / 2;
+			float direction = view % 2 == 0 ? 1.0f : -1.0f;
+			int u = (axis + 1) % 3, v = (axis + 2) % 3;
+			std::fill(depth.begin(), depth.end(), 2.0f);
+
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				glm::vec3 p[3];
+				for (int k = 0; k < 3; k++)
+				{
+					glm::vec3 position = vertices[indices[i + k]].Position - minimum;
+					// screen x/y in pixels, depth in [0, 1] along the view direction
+					p[k] = glm::vec3(position[u] * scale, position[v] * scale, direction > 0.0f ? position[axis] / size : 1.0f - position[axis] / size);
+				}
+				// a triangle faces the camera when its normal points against the view direction
+				glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - vertices[indices[i]].Position, vertices[indices[i + 2]].Position - vertices[indices[i]].Position);
+				if (normal[axis] * direction >= 0.0f)
+					continue;
+				rasterize(p, depth, shaded, covered);
+			}
+		}
+		return covered > 0 ? (float)shaded / (float)covered : 0.0f;
+	}
+
+	// Tipsify: fans around a vertex while its triangles are likely still cached, and picks the next fanning
+	// vertex among the recently used ones. 'clusters' receives the first triangle of every run that started
+	// at a dead end; those are the boundaries OptimizeOverdraw may reorder at without hurting the cache.
+	static void OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount, std::vector<unsigned int>& clusters, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+	{
+		size_t triangleCount = indices.size() / 3;
+		clusters.clear();
+		if (triangleCount == 0)
+			return;
+
+		// triangles around each vertex
+		std::vector<unsigned int> liveTriangles(vertexCount, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			liveTriangles[indices[i]]++;
+		std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+		std::vector<unsigned int> adjacency(indices.size());
+		std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+		std::vector<unsigned int> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<unsigned int> deadEnd;
+		std::vector<unsigned int> candidates;
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		unsigned int time = cacheSize + 1;
+		unsigned int cursor = 0;
+
+		int fanning = nextLiveVertex(liveTriangles, cursor);
+		clusters.push_back(0);
+		while (fanning >= 0)
+		{
+			candidates.clear();
+			for (unsigned int a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++)
+			{
+				unsigned int triangle = adjacency[a];
+				if (emitted[triangle])
+					continue;
+				emitted[triangle] = true;
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int v = indices[triangle * 3 + k];
+					result.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+					if (time - cacheTime[v] > cacheSize)
+						cacheTime[v] = time++;
+				}
+			}
+
+			// prefer the candidate that is cached the longest and still has all its triangles ahead of it in the cache
+			int best = -1;
+			int bestPriority = -1;
+			for (size_t c = 0; c < candidates.size(); c++)
+			{
+				unsigned int v = candidates[c];
+				if (liveTriangles[v] == 0)
+					continue;
+				int priority = 0;
+				if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+					priority = (int)(time - cacheTime[v]);
+				if (priority > bestPriority)
+				{
+					best = (int)v;
+					bestPriority = priority;
+				}
+			}
+			if (best < 0)
+			{
+				// dead end: fall back to recently emitted vertices, then to the input order
+				while (!deadEnd.empty() && best < 0)
+				{
+					unsigned int v = deadEnd.back();
+					deadEnd.pop_back();
+					if (liveTriangles[v] > 0)
+						best = (int)v;
+				}
+				if (best < 0)
+					best = nextLiveVertex(liveTriangles, cursor);
+				if (best >= 0)
+					clusters.push_back((unsigned int)(result.size() / 3));
+			}
+			fanning = best;
+		}
+		indices.swap(result);
+	}
+
+	// splits the cache-ordered clusters further where that costs at most 'threshold' times their ACMR, then draws
+	// the clusters that face away from the mesh's centre first (Sander et al. 2007, as done by meshoptimizer)
+	static void OptimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, const std::vector<unsigned int>& clusters, float threshold = OVERDRAW_THRESHOLD)
+	{
+		unsigned int triangleCount = (unsigned int)(indices.size() / 3);
+		if (triangleCount == 0 || clusters.empty())
+			return;
+
+		std::vector<unsigned int> boundaries;
+		std::vector<unsigned int> cacheTime(vertices.size(), 0);
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			unsigned int begin = clusters[c];
+			unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+			splitCluster(indices, begin, end, threshold, cacheTime, boundaries);
+		}
+
+		// area weighted centroid and normal of every cluster
+		struct Cluster
+		{
+			unsigned int begin;
+			unsigned int end;
+			float sortKey;
+		};
+		std::vector<Cluster> sorted(boundaries.size());
+		std::vector<glm::vec3> centroids(boundaries.size());
+		std::vector<glm::vec3> normals(boundaries.size());
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < boundaries.size(); c++)
+		{
+			sorted[c].begin = boundaries[c];
+			sorted[c].end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+			glm::vec3 centroid(0.0f), normal(0.0f);
+			float area = 0.0f;
+			for (unsigned int t = sorted[c].begin; t < sorted[c].end; t++)
+			{
+				const glm::vec3& a = vertices[indices[t * 3]].Position;
+				const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+				glm::vec3 cross = glm::cross(b - a, d - a);
+				float triangleArea = glm::length(cross);
+				centroid += (a + b + d) * (triangleArea / 3.0f);
+				normal += cross;
+				area += triangleArea;
+			}
+			centroids[c] = area > 0.0f ? centroid / area : centroid;
+			float normalLength = glm::length(normal);
+			normals[c] = normalLength > 0.0f ? normal / normalLength : normal;
+			meshCentroid += centroid;
+			meshArea += area;
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+		for (size_t c = 0; c < sorted.size(); c++)
+			sorted[c].sortKey = glm::dot(centroids[c] - meshCentroid, normals[c]);
+
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		for (size_t c = 0; c < sorted.size(); c++)
+			result.insert(result.end(), indices.begin() + sorted[c].begin * 3, indices.begin() + sorted[c].end * 3);
+		indices.swap(result);
+	}
+
+	// renumbers the vertices in the order the index buffer first references them; unreferenced vertices are dropped
+	static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		const unsigned int unassigned = ~0u;
+		std::vector<unsigned int> remap(vertices.size(), unassigned);
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int& index = remap[indices[i]];
+			if (index == unassigned)
+			{
+				index = (unsigned int)result.size();
+				result.push_back(vertices[indices[i]]);
+			}
+			indices[i] = index;
+		}
+		vertices.swap(result);
+	}
+
+private:
+	static int nextLiveVertex(const std::vector<unsigned int>& liveTriangles, unsigned int& cursor)
+	{
+		while (cursor < liveTriangles.size())
+		{
+			if (liveTriangles[cursor] > 0)
+				return (int)cursor;
+			cursor++;
+		}
+		return -1;
+	}
+
+	// appends the start of every sub-cluster of [begin, end) to 'boundaries'. A sub-cluster ends as soon as its
+	// own ACMR, simulated from a cold cache, is within 'threshold' of the whole cluster's.
+	static void splitCluster(const std::vector<unsigned int>& indices, unsigned int begin, unsigned int end, float threshold,
+		std::vector<unsigned int>& cacheTime, std::vector<unsigned int>& boundaries)
+	{
+		float clusterAcmr = (float)simulateMisses(indices, begin, end, cacheTime) / (float)(end - begin);
+
+		unsigned int start = begin;
+		unsigned int time = 0;
+		unsigned int misses = 0;
+		resetCache(indices, begin, end, cacheTime);
+		boundaries.push_back(begin);
+		for (unsigned int t = begin; t < end; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[t * 3 + k];
+				if (cacheTime[v] == 0 || time + 1 - cacheTime[v] > VERTEX_CACHE_SIZE)
+				{
+					cacheTime[v] = ++time;
+					misses++;
+				}
+			}
+			unsigned int triangles = t + 1 - start;
+			if (t + 1 < end && triangles > 1 && (float)misses / (float)triangles <= clusterAcmr * threshold)
+			{
+				boundaries.push_back(t + 1);
+				start = t + 1;
+				time = 0;
+				misses = 0;
+				resetCache(indices, t + 1, end, cacheTime);
+			}
+		}
+	}
+
+	static unsigned int simulateMisses(const std::vector<unsigned int>& indices, unsigned int begin, unsigned int end, std::vector<unsigned int>& cacheTime)
+	{
+		resetCache(indices, begin, end, cacheTime);
+		unsigned int time = 0;
+		for (unsigned int i = begin * 3; i < end * 3; i++)
+		{
+			unsigned int v = indices[i];
+			if (cacheTime[v] == 0 || time + 1 - cacheTime[v] > VERTEX_CACHE_SIZE)
+				cacheTime[v] = ++time;
+		}
+		return time;
+	}
+
+	static void resetCache(const std::vector<unsigned int>& indices, unsigned int begin, unsigned int end, std::vector<unsigned int>& cacheTime)
+	{
+		for (unsigned int i = begin * 3; i < end * 3; i++)
+			cacheTime[indices[i]] = 0;
+	}
+
+	// scan converts one triangle at pixel centres with a less-than depth test
+	static void rasterize(const glm::vec3 p[3], std::vector<float>& depth, size_t& shaded, size_t& covered)
+	{
+		float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+		if (area == 0.0f)
+			return;
+		int minX = std::max(0, (int)std::floor(std::min(p[0].x, std::min(p[1].x, p[2].x))));
+		int maxX = std::min(OVERDRAW_RESOLUTION - 1, (int)std::ceil(std::max(p[0].x, std::max(p[1].x, p[2].x))));
+		int minY = std::max(0, (int)std::floor(std::min(p[0].y, std::min(p[1].y, p[2].y))));
+		int maxY = std::min(OVERDRAW_RESOLUTION - 1, (int)std::ceil(std::max(p[0].y, std::max(p[1].y, p[2].y))));
+		float inverseArea = 1.0f / area;
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			for (int x = minX; x <= maxX; x++)
+			{
+				float px = x + 0.5f, py = y + 0.5f;
+				// barycentric weights, positive inside for either winding
+				float w0 = ((p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x)) * inverseArea;
+				float w1 = ((p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x)) * inverseArea;
+				float w2 = 1.0f - w0 - w1;
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+				float z = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+				float& stored = depth[y * OVERDRAW_RESOLUTION + x];
+				if (z >= stored)
+					continue;
+				if (stored > 1.0f)
+					covered++;
+				stored = z;
+				shaded++;
+			}
+		}
+	}
+};
+#endif
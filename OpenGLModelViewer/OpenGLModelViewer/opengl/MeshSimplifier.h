@@ -0,0 +1,599 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <opengl/mesh.h>
+#include <opengl/MeshOptimizer.h>
+#include <opengl/ThreadPool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+// most levels of detail of a mesh, the full mesh included
+const unsigned int MAX_LOD_LEVELS = 5;
+// levels below this many triangles aren't built
+const unsigned int LOD_MIN_TRIANGLES = 64;
+// a level is only kept if it has at most this fraction of the previous level's triangles
+const float LOD_MIN_REDUCTION = 0.85f;
+// weights of the planes through open borders and attribute seams, relative to the faces' own planes
+const double BORDER_QUADRIC_WEIGHT = 10.0;
+const double SEAM_QUADRIC_WEIGHT = 1.0;
+
+// options of MeshSimplifier
+struct SimplifySettings
+{
+	// keep normal and texture seams in place and make collapses across changes in normals and texture coordinates
+	// more expensive; off, vertices are only told apart by their positions and seams simplify like the rest
+	bool attributeAware = true;
+	float attributeWeight = 1.0f;
+	// keep the vertices on open borders in place; otherwise they may only slide along the border
+	bool preserveBorders = true;
+};
+
+// the plane equations of a set of triangles, as one symmetric 4x4 matrix: Evaluate(p) is the weighted sum of
+// the squared distances from p to the planes (Garland and Heckbert 1997)
+struct Quadric
+{
+	double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+	double b0 = 0.0, b1 = 0.0, b2 = 0.0, c = 0.0;
+	double weight = 0.0;
+
+	// the plane dot(normal, p) + distance = 0, with a unit normal
+	static Quadric FromPlane(const glm::dvec3& normal, double distance, double weight)
+	{
+		Quadric q;
+		q.a00 = weight * normal.x * normal.x;
+		q.a01 = weight * normal.x * normal.y;
+		q.a02 = weight * normal.x * normal.z;
+		q.a11 = weight * normal.y * normal.y;
+		q.a12 = weight * normal.y * normal.z;
+		q.a22 = weight * normal.z * normal.z;
+		q.b0 = weight * normal.x * distance;
+		q.b1 = weight * normal.y * distance;
+		q.b2 = weight * normal.z * distance;
+		q.c = weight * distance * distance;
+		q.weight = weight;
+		return q;
+	}
+
+	void Add(const Quadric& q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c;
+		weight += q.weight;
+	}
+
+	double Evaluate(const glm::vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double error = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return std::max(error, 0.0);
+	}
+};
+
+// Quadric error edge-collapse simplification. Vertices are never moved or created: an edge collapses into one
+// of its ends, so every level keeps indexing the mesh's own vertex buffer and the levels only differ in their
+// index ranges. Vertices with the same position are welded for the topology; where their normals or texture
+// coordinates differ (a seam) the collapse moves both sides along the seam together. Collapses run in passes:
+// every pass ranks all candidate edges by error and takes the cheapest ones whose neighbourhoods don't overlap,
+// so the topology built at the start of the pass stays valid for every test in it.
+class MeshSimplifier
+{
+public:
+	MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const SimplifySettings& settings = SimplifySettings())
+		: vertices(vertices), settings(settings)
+	{
+		weld();
+		// triangles that are already degenerate in position would never survive a collapse
+		current.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			if (positionOf[indices[i]] != positionOf[indices[i + 1]] && positionOf[indices[i]] != positionOf[indices[i + 2]] && positionOf[indices[i + 1]] != positionOf[indices[i + 2]])
+				current.insert(current.end(), indices.begin() + i, indices.begin() + i + 3);
+		}
+		remap.resize(vertices.size());
+		std::iota(remap.begin(), remap.end(), 0u);
+		buildQuadrics();
+	}
+
+	// collapses edges until at most 'targetTriangles' are left or no collapse is possible. Returns the error of
+	// the result: roughly how far, in model units, its surface is from the original one.
+	float SimplifyTo(size_t targetTriangles)
+	{
+		while (TriangleCount() > targetTriangles)
+		{
+			analyze();
+			if (collapse(targetTriangles) == 0)
+				break;
+			rewrite();
+		}
+		return (float)std::sqrt(maximumError) * scale;
+	}
+
+	const std::vector<unsigned int>& Indices() const { return current; }
+	size_t TriangleCount() const { return current.size() / 3; }
+
+	// builds up to 'levels' levels of detail for a mesh, the full mesh included, halving the triangles from one
+	// level to the next. Stops early once the mesh won't simplify any further.
+	static void BuildLods(MeshData& mesh, unsigned int levels, const SimplifySettings& settings = SimplifySettings())
+	{
+		mesh.lodIndices.clear();
+		mesh.lods.clear();
+		MeshLod full = { 0, (unsigned int)mesh.indices.size(), 0.0f };
+		mesh.lods.push_back(full);
+		size_t fullTriangles = mesh.indices.size() / 3;
+		levels = std::min(levels, MAX_LOD_LEVELS);
+		if (levels < 2 || fullTriangles / 2 < LOD_MIN_TRIANGLES)
+			return;
+
+		MeshSimplifier simplifier(mesh.vertices, mesh.indices, settings);
+		size_t previous = fullTriangles;
+		std::vector<unsigned int> clusters;
+		for (unsigned int level = 1; level < levels; level++)
+		{
+			size_t target = fullTriangles >> level;
+			if (target < LOD_MIN_TRIANGLES)
+				break;
+			float error = simplifier.SimplifyTo(target);
+			if (simplifier.TriangleCount() > previous * LOD_MIN_REDUCTION)
+				break;
+			previous = simplifier.TriangleCount();
+
+			std::vector<unsigned int> indices = simplifier.Indices();
+			MeshOptimizer::OptimizeVertexCache(indices, (unsigned int)mesh.vertices.size(), clusters);
+			MeshLod lod = { (unsigned int)(mesh.indices.size() + mesh.lodIndices.size()), (unsigned int)indices.size(), error };
+			mesh.lodIndices.insert(mesh.lodIndices.end(), indices.begin(), indices.end());
+			mesh.lods.push_back(lod);
+		}
+	}
+
+	// one level of a mesh on its own: only the vertices the level uses, reindexed, and the mesh's textures
+	static MeshData ExtractLevel(const MeshData& mesh, unsigned int level)
+	{
+		MeshData result;
+		result.textures = mesh.textures;
+		const std::vector<unsigned int>* indices = &mesh.indices;
+		size_t first = 0, count = mesh.indices.size();
+		if (level > 0 && level < mesh.lods.size())
+		{
+			// the coarser levels' firstIndex counts the full mesh's indices too
+			indices = &mesh.lodIndices;
+			first = mesh.lods[level].firstIndex - mesh.indices.size();
+			count = mesh.lods[level].indexCount;
+		}
+		std::vector<unsigned int> remap(mesh.vertices.size(), ~0u);
+		result.indices.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			unsigned int source = (*indices)[first + i];
+			if (remap[source] == ~0u)
+			{
+				remap[source] = (unsigned int)result.vertices.size();
+				result.vertices.push_back(mesh.vertices[source]);
+			}
+			result.indices[i] = remap[source];
+		}
+		return result;
+	}
+
+	// builds the levels of every mesh, one mesh per task (maxThreads 0 = the whole pool)
+	static void BuildAllLods(std::vector<MeshData>& meshes, unsigned int levels, const SimplifySettings& settings = SimplifySettings(), unsigned int maxThreads = 0)
+	{
+		ThreadPool::Shared().ParallelFor(meshes.size(), [&meshes, levels, &settings](size_t i)
+		{
+			BuildLods(meshes[i], levels, settings);
+		}, maxThreads);
+	}
+
+private:
+	// how a welded position may move
+	enum Vertex_Kind
+	{
+		MANIFOLD_VERTEX, // inside the surface, one set of attributes: may collapse into any neighbour
+		BORDER_VERTEX,   // on an open border: only along it
+		SEAM_VERTEX,     // on an attribute seam: only along it, taking both sides with it
+		LOCKED_VERTEX    // corners of borders or seams, non-manifold spots: never moves
+	};
+
+	// bits of 'edgeFlags', per corner for the edge from it to the next corner of its triangle
+	static const unsigned char BORDER_EDGE = 1;
+	static const unsigned char SEAM_EDGE = 2;
+
+	// collapsing position 'source' into 'target'; the source's one or two vertices are replaced by the
+	// target's vertex on the same side of the seam
+	struct Collapse
+	{
+		unsigned int source, target;
+		unsigned int sourceVertex[2], targetVertex[2];
+		unsigned int sides;
+		float cost;  // what ranks the collapses: the error plus the attribute penalty
+		float error; // mean squared distance to the merged planes, in the normalized space
+	};
+
+	const std::vector<Vertex>& vertices;
+	SimplifySettings settings;
+	// positions are normalized into the unit sphere around the mesh, so errors don't depend on its size
+	glm::vec3 center;
+	float scale = 1.0f;
+	float textureScale = 1.0f;
+	std::vector<unsigned int> positionOf; // welded position of every vertex
+	std::vector<glm::vec3> points;        // normalized, per position
+	std::vector<Quadric> quadrics;        // per position
+	std::vector<unsigned int> current;    // the indices of the simplified mesh
+	std::vector<unsigned int> remap;      // vertex -> vertex it collapsed into during the current pass
+	double maximumError = 0.0;
+
+	// the topology of 'current', rebuilt by every pass: the corners at each position, and per corner whether
+	// the edge to the next corner is a border or seam and which corner starts its opposite edge
+	std::vector<unsigned int> cornerOffsets;
+	std::vector<unsigned int> corners;
+	std::vector<unsigned char> edgeFlags;
+	std::vector<unsigned int> opposite;
+	std::vector<unsigned char> kinds;
+	std::vector<Collapse> collapses;
+	std::vector<unsigned char> locked;
+	std::vector<unsigned int> sourceRing, targetRing;
+
+	static unsigned int next(unsigned int corner) { return corner % 3 == 2 ? corner - 2 : corner + 1; }
+	static unsigned int previous(unsigned int corner) { return corner % 3 == 0 ? corner + 2 : corner - 1; }
+
+	unsigned int positionAt(unsigned int corner) const { return positionOf[current[corner]]; }
+
+	// gives vertices with bitwise equal positions the same position id, and normalizes the positions
+	void weld()
+	{
+		size_t count = vertices.size();
+		positionOf.assign(count, 0);
+		points.clear();
+		if (count == 0)
+			return;
+		std::vector<unsigned int> order(count);
+		std::iota(order.begin(), order.end(), 0u);
+		std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b)
+		{
+			const glm::vec3& p = vertices[a].Position;
+			const glm::vec3& q = vertices[b].Position;
+			return p.x < q.x || (p.x == q.x && (p.y < q.y || (p.y == q.y && p.z < q.z)));
+		});
+
+		glm::vec3 minimum = vertices[0].Position, maximum = vertices[0].Position;
+		glm::vec2 textureMinimum = vertices[0].TexCoords, textureMaximum = vertices[0].TexCoords;
+		for (size_t i = 1; i < count; i++)
+		{
+			minimum = glm::min(minimum, vertices[i].Position);
+			maximum = glm::max(maximum, vertices[i].Position);
+			textureMinimum = glm::min(textureMinimum, vertices[i].TexCoords);
+			textureMaximum = glm::max(textureMaximum, vertices[i].TexCoords);
+		}
+		center = (minimum + maximum) * 0.5f;
+		scale = glm::length(maximum - minimum) * 0.5f;
+		if (!(scale > 0.0f))
+			scale = 1.0f;
+		glm::vec2 textureExtent = textureMaximum - textureMinimum;
+		textureScale = std::max(textureExtent.x, textureExtent.y);
+		if (!(textureScale > 0.0f))
+			textureScale = 1.0f;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			unsigned int v = order[i];
+			if (i == 0 || vertices[v].Position != vertices[order[i - 1]].Position)
+				points.push_back((vertices[v].Position - center) / scale);
+			positionOf[v] = (unsigned int)points.size() - 1;
+		}
+	}
+
+	// area weighted face planes per position, plus planes perpendicular to the faces along borders and seams
+	// that hold those lines in place
+	void buildQuadrics()
+	{
+		quadrics.assign(points.size(), Quadric());
+		for (unsigned int t = 0; t < current.size(); t += 3)
+		{
+			glm::dvec3 a(points[positionAt(t)]), b(points[positionAt(t + 1)]), c(points[positionAt(t + 2)]);
+			glm::dvec3 normal = glm::cross(b - a, c - a);
+			double length = glm::length(normal);
+			if (length <= 0.0)
+				continue;
+			normal /= length;
+			Quadric plane = Quadric::FromPlane(normal, -glm::dot(normal, a), length * 0.5);
+			for (unsigned int k = 0; k < 3; k++)
+				quadrics[positionAt(t + k)].Add(plane);
+		}
+
+		analyze();
+		for (unsigned int corner = 0; corner < current.size(); corner++)
+		{
+			unsigned char flags = edgeFlags[corner];
+			// a seam edge shows up from both of its triangles; add it once
+			if (flags == 0 || ((flags & SEAM_EDGE) && opposite[corner] < corner))
+				continue;
+			unsigned int t = corner - corner % 3;
+			glm::dvec3 a(points[positionAt(t)]), b(points[positionAt(t + 1)]), c(points[positionAt(t + 2)]);
+			glm::dvec3 faceNormal = glm::cross(b - a, c - a);
+			glm::dvec3 from(points[positionAt(corner)]), to(points[positionAt(next(corner))]);
+			glm::dvec3 edge = to - from;
+			glm::dvec3 normal = glm::cross(edge, faceNormal);
+			double length = glm::length(normal);
+			if (length <= 0.0)
+				continue;
+			normal /= length;
+			double weight = ((flags & BORDER_EDGE) ? BORDER_QUADRIC_WEIGHT : SEAM_QUADRIC_WEIGHT) * glm::dot(edge, edge);
+			Quadric plane = Quadric::FromPlane(normal, -glm::dot(normal, from), weight);
+			quadrics[positionAt(corner)].Add(plane);
+			quadrics[positionAt(next(corner))].Add(plane);
+		}
+	}
+
+	// rebuilds the corner lists, edge flags and vertex kinds of 'current'
+	void analyze()
+	{
+		unsigned int positionCount = (unsigned int)points.size();
+		unsigned int cornerCount = (unsigned int)current.size();
+		cornerOffsets.assign(positionCount + 1, 0);
+		for (unsigned int c = 0; c < cornerCount; c++)
+			cornerOffsets[positionAt(c) + 1]++;
+		for (unsigned int p = 0; p < positionCount; p++)
+			cornerOffsets[p + 1] += cornerOffsets[p];
+		corners.resize(cornerCount);
+		std::vector<unsigned int> fill(cornerOffsets.begin(), cornerOffsets.end() - 1);
+		for (unsigned int c = 0; c < cornerCount; c++)
+			corners[fill[positionAt(c)]++] = c;
+
+		// an edge without an opposite is a border; one whose opposite has other vertices at its ends is a seam
+		std::vector<unsigned char> nonManifold(positionCount, 0);
+		std::vector<unsigned char> borderEdges(positionCount, 0), seamEdges(positionCount, 0);
+		edgeFlags.assign(cornerCount, 0);
+		opposite.assign(cornerCount, ~0u);
+		for (unsigned int c = 0; c < cornerCount; c++)
+		{
+			unsigned int from = positionAt(c), to = positionAt(next(c));
+			unsigned int matches = 0, same = 0;
+			for (unsigned int i = cornerOffsets[to]; i < cornerOffsets[to + 1]; i++)
+			{
+				if (positionAt(next(corners[i])) == from)
+				{
+					opposite[c] = corners[i];
+					matches++;
+				}
+			}
+			for (unsigned int i = cornerOffsets[from]; i < cornerOffsets[from + 1]; i++)
+				same += positionAt(next(corners[i])) == to;
+			if (matches > 1 || same > 1)
+			{
+				nonManifold[from] = nonManifold[to] = 1;
+				opposite[c] = ~0u;
+				continue;
+			}
+			if (matches == 0)
+			{
+				edgeFlags[c] = BORDER_EDGE;
+				borderEdges[from] = (unsigned char)std::min(borderEdges[from] + 1, 255);
+				borderEdges[to] = (unsigned char)std::min(borderEdges[to] + 1, 255);
+			}
+			else if (settings.attributeAware && (current[c] != current[next(opposite[c])] || current[next(c)] != current[opposite[c]]))
+			{
+				edgeFlags[c] = SEAM_EDGE;
+				if (c < opposite[c])
+				{
+					seamEdges[from] = (unsigned char)std::min(seamEdges[from] + 1, 255);
+					seamEdges[to] = (unsigned char)std::min(seamEdges[to] + 1, 255);
+				}
+			}
+		}
+
+		kinds.assign(positionCount, LOCKED_VERTEX);
+		for (unsigned int p = 0; p < positionCount; p++)
+		{
+			if (cornerOffsets[p] == cornerOffsets[p + 1] || nonManifold[p])
+				continue;
+			// how many different vertices share the position
+			unsigned int first = current[corners[cornerOffsets[p]]], wedges = 1, second = first;
+			for (unsigned int i = cornerOffsets[p] + 1; i < cornerOffsets[p + 1] && settings.attributeAware; i++)
+			{
+				unsigned int v = current[corners[i]];
+				if (v == first || v == second)
+					continue;
+				if (second == first)
+					second = v;
+				wedges++;
+			}
+			if (borderEdges[p] > 0)
+				kinds[p] = (unsigned char)(!settings.preserveBorders && borderEdges[p] == 2 && seamEdges[p] == 0 && wedges == 1 ? BORDER_VERTEX : LOCKED_VERTEX);
+			else if (seamEdges[p] > 0)
+				kinds[p] = (unsigned char)(seamEdges[p] == 2 && wedges == 2 ? SEAM_VERTEX : LOCKED_VERTEX);
+			else
+				kinds[p] = (unsigned char)(wedges == 1 ? MANIFOLD_VERTEX : LOCKED_VERTEX);
+		}
+	}
+
+	// ranks the possible collapses of this pass and performs the cheapest ones whose neighbourhoods are disjoint.
+	// Returns how many it did.
+	unsigned int collapse(size_t targetTriangles)
+	{
+		collapses.clear();
+		for (unsigned int c = 0; c < current.size(); c++)
+		{
+			// the edge from corner c: its start may collapse into its end; a border edge has no opposite to
+			// offer the other direction, so it offers both
+			addCollapse(c, false);
+			if (edgeFlags[c] & BORDER_EDGE)
+				addCollapse(c, true);
+		}
+		if (collapses.empty())
+			return 0;
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// a collapse removes about two triangles; don't go far past the cost of the ones that are needed
+		size_t triangles = TriangleCount();
+		size_t needed = std::min(collapses.size(), (triangles - targetTriangles + 1) / 2);
+		float limit = collapses[std::max<size_t>(needed, 1) - 1].cost * 1.5f + 1e-12f;
+
+		locked.assign(points.size(), 0);
+		unsigned int done = 0;
+		for (size_t i = 0; i < collapses.size() && triangles > targetTriangles; i++)
+		{
+			const Collapse& collapse = collapses[i];
+			if (collapse.cost > limit)
+				break;
+			if (locked[collapse.source] || locked[collapse.target])
+				continue;
+			unsigned int removed = 0;
+			if (!keepsTopology(collapse.source, collapse.target, removed) || flips(collapse.source, collapse.target))
+				continue;
+
+			if (collapse.sides == 2)
+			{
+				for (unsigned int s = 0; s < 2; s++)
+					remap[collapse.sourceVertex[s]] = collapse.targetVertex[s];
+			}
+			else
+			{
+				// without seams every vertex at the source is replaced by the one at the target
+				for (unsigned int j = cornerOffsets[collapse.source]; j < cornerOffsets[collapse.source + 1]; j++)
+					remap[current[corners[j]]] = collapse.targetVertex[0];
+			}
+			quadrics[collapse.target].Add(quadrics[collapse.source]);
+			maximumError = std::max(maximumError, (double)collapse.error);
+			triangles -= std::min<size_t>(removed, triangles);
+			// the source's neighbourhood changes; nothing touching it may collapse again in this pass
+			for (unsigned int j = cornerOffsets[collapse.source]; j < cornerOffsets[collapse.source + 1]; j++)
+			{
+				unsigned int corner = corners[j];
+				locked[positionAt(next(corner))] = locked[positionAt(previous(corner))] = 1;
+			}
+			locked[collapse.source] = locked[collapse.target] = 1;
+			done++;
+		}
+		return done;
+	}
+
+	void addCollapse(unsigned int corner, bool reverse)
+	{
+		unsigned int sourceCorner = reverse ? next(corner) : corner;
+		unsigned int targetCorner = reverse ? corner : next(corner);
+		unsigned int source = positionAt(sourceCorner), target = positionAt(targetCorner);
+		unsigned char kind = kinds[source];
+		if (kind == LOCKED_VERTEX || (kind == BORDER_VERTEX && !(edgeFlags[corner] & BORDER_EDGE)) || (kind == SEAM_VERTEX && !(edgeFlags[corner] & SEAM_EDGE)))
+			return;
+
+		Collapse collapse;
+		collapse.source = source;
+		collapse.target = target;
+		collapse.sourceVertex[0] = current[sourceCorner];
+		collapse.targetVertex[0] = current[targetCorner];
+		collapse.sides = 1;
+		if (kind == SEAM_VERTEX)
+		{
+			// the opposite edge runs target -> source on the other side of the seam
+			unsigned int other = opposite[corner];
+			collapse.sourceVertex[1] = current[next(other)];
+			collapse.targetVertex[1] = current[other];
+			collapse.sides = 2;
+			if (collapse.sourceVertex[1] == collapse.sourceVertex[0] || collapse.targetVertex[1] == collapse.targetVertex[0])
+				return;
+		}
+
+		Quadric merged = quadrics[source];
+		merged.Add(quadrics[target]);
+		double error = merged.weight > 0.0 ? merged.Evaluate(points[target]) / merged.weight : 0.0;
+		double cost = error;
+		if (settings.attributeAware)
+		{
+			// the attribute change, scaled by the squared edge length so it is comparable to a squared distance
+			glm::vec3 edge = points[target] - points[source];
+			double change = 0.0;
+			for (unsigned int s = 0; s < collapse.sides; s++)
+			{
+				const Vertex& from = vertices[collapse.sourceVertex[s]];
+				const Vertex& to = vertices[collapse.targetVertex[s]];
+				glm::vec3 normal = from.Normal - to.Normal;
+				glm::vec2 texture = (from.TexCoords - to.TexCoords) / textureScale;
+				change += glm::dot(normal, normal) + glm::dot(texture, texture);
+			}
+			cost += settings.attributeWeight * glm::dot(edge, edge) * change / collapse.sides;
+		}
+		collapse.error = (float)error;
+		collapse.cost = (float)cost;
+		collapses.push_back(collapse);
+	}
+
+	// the link condition: the positions adjacent to both ends must be exactly the third corners of the triangles
+	// on the edge, or the collapse would fold the surface onto itself. 'removed' receives those triangles.
+	bool keepsTopology(unsigned int source, unsigned int target, unsigned int& removed)
+	{
+		removed = 0;
+		ring(source, sourceRing);
+		ring(target, targetRing);
+		for (unsigned int i = cornerOffsets[source]; i < cornerOffsets[source + 1]; i++)
+		{
+			unsigned int corner = corners[i];
+			removed += positionAt(next(corner)) == target || positionAt(previous(corner)) == target;
+		}
+		unsigned int shared = 0;
+		for (size_t i = 0, j = 0; i < sourceRing.size() && j < targetRing.size();)
+		{
+			if (sourceRing[i] < targetRing[j])
+				i++;
+			else if (targetRing[j] < sourceRing[i])
+				j++;
+			else
+			{
+				shared++;
+				i++;
+				j++;
+			}
+		}
+		return shared == removed;
+	}
+
+	void ring(unsigned int position, std::vector<unsigned int>& result) const
+	{
+		result.clear();
+		for (unsigned int i = cornerOffsets[position]; i < cornerOffsets[position + 1]; i++)
+		{
+			result.push_back(positionAt(next(corners[i])));
+			result.push_back(positionAt(previous(corners[i])));
+		}
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+	}
+
+	// whether moving the source onto the target turns any of its remaining triangles over
+	bool flips(unsigned int source, unsigned int target) const
+	{
+		for (unsigned int i = cornerOffsets[source]; i < cornerOffsets[source + 1]; i++)
+		{
+			unsigned int corner = corners[i];
+			unsigned int b = positionAt(next(corner)), c = positionAt(previous(corner));
+			if (b == target || c == target)
+				continue;
+			glm::vec3 before = glm::cross(points[b] - points[source], points[c] - points[source]);
+			glm::vec3 after = glm::cross(points[b] - points[target], points[c] - points[target]);
+			if (glm::dot(before, after) <= 0.0f)
+				return true;
+		}
+		return false;
+	}
+
+	// applies the pass's collapses to the indices and drops the triangles that became degenerate
+	void rewrite()
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < current.size(); i += 3)
+		{
+			unsigned int a = remap[current[i]], b = remap[current[i + 1]], c = remap[current[i + 2]];
+			if (positionOf[a] == positionOf[b] || positionOf[a] == positionOf[c] || positionOf[b] == positionOf[c])
+				continue;
+			current[kept++] = a;
+			current[kept++] = b;
+			current[kept++] = c;
+		}
+		current.resize(kept);
+	}
+};
+#endif
@@ -0,0 +1,249 @@
+#ifndef MESHLET_BUILDER_H
+#define MESHLET_BUILDER_H
+
+#include <glm/glm.hpp>
+
+#include <opengl/mesh.h>
+#include <opengl/ThreadPool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// limits of one meshlet; the sizes mesh shading hardware works best with
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+// below this cosine between the cone axis and some triangle normal, a meshlet gets no cone
+const float MESHLET_MIN_CONE_COSINE = 0.1f;
+// a triangle that doesn't touch the meshlet only joins it when it faces this close to the meshlet's average normal
+const float MESHLET_JOIN_COSINE = 0.7f;
+
+// Splits a mesh into meshlets. A meshlet grows from a seed triangle over the triangles sharing its vertices,
+// always taking the one that adds the fewest new vertices, then the one nearest to its centroid, until it hits a
+// limit. Parts that don't share vertices with anything are filled up from the nearby triangles facing the same way.
+// The next meshlet is seeded next to the last one. The full index list is then rewritten meshlet by meshlet, so every
+// meshlet is one contiguous range that culling can hand to glMultiDrawElements.
+class MeshletBuilder
+{
+public:
+	static void Build(MeshData& mesh)
+	{
+		mesh.meshlets.clear();
+		unsigned int triangleCount = (unsigned int)(mesh.indices.size() / 3);
+		unsigned int vertexCount = (unsigned int)mesh.vertices.size();
+		if (triangleCount == 0)
+			return;
+
+		// the triangles around every vertex
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (unsigned int i = 0; i < triangleCount * 3; i++)
+			offsets[mesh.indices[i] + 1]++;
+		for (unsigned int v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		std::vector<unsigned int> adjacency(triangleCount * 3);
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (unsigned int i = 0; i < triangleCount * 3; i++)
+			adjacency[fill[mesh.indices[i]]++] = i / 3;
+
+		std::vector<glm::vec3> centroids(triangleCount), normals(triangleCount);
+		for (unsigned int t = 0; t < triangleCount; t++)
+		{
+			centroids[t] = (position(mesh, t, 0) + position(mesh, t, 1) + position(mesh, t, 2)) / 3.0f;
+			normals[t] = faceNormal(mesh, t);
+		}
+
+		std::vector<unsigned int> indices;
+		indices.reserve(mesh.indices.size());
+		std::vector<bool> used(triangleCount, false);
+		std::vector<bool> inMeshlet(vertexCount, false);
+		std::vector<unsigned int> vertices, triangles, candidates;
+		unsigned int cursor = 0;
+		for (;;)
+		{
+			// seed next to the previous meshlet if it left anything, otherwise at the next unused triangle
+			unsigned int seed = triangleCount;
+			for (unsigned int i = 0; i < candidates.size() && seed == triangleCount; i++)
+			{
+				if (!used[candidates[i]])
+					seed = candidates[i];
+			}
+			while (seed == triangleCount && cursor < triangleCount)
+			{
+				if (!used[cursor])
+					seed = cursor;
+				cursor++;
+			}
+			if (seed == triangleCount)
+				break;
+
+			vertices.clear();
+			triangles.clear();
+			candidates.clear();
+			glm::vec3 centroidSum(0.0f), normalSum(0.0f);
+			unsigned int next = seed;
+			while (next != triangleCount)
+			{
+				used[next] = true;
+				triangles.push_back(next);
+				centroidSum += centroids[next];
+				normalSum += normals[next];
+				for (unsigned int k = 0; k < 3; k++)
+				{
+					unsigned int v = mesh.indices[next * 3 + k];
+					if (inMeshlet[v])
+						continue;
+					inMeshlet[v] = true;
+					vertices.push_back(v);
+					for (unsigned int j = offsets[v]; j < offsets[v + 1]; j++)
+					{
+						if (!used[adjacency[j]])
+							candidates.push_back(adjacency[j]);
+					}
+				}
+				if (triangles.size() == MESHLET_MAX_TRIANGLES)
+					break;
+
+				// the best candidate that still fits; used ones are dropped on the way
+				glm::vec3 centroid = centroidSum / (float)triangles.size();
+				next = triangleCount;
+				unsigned int bestNew = 4;
+				float bestDistance = 0.0f;
+				unsigned int kept = 0;
+				for (unsigned int i = 0; i < candidates.size(); i++)
+				{
+					unsigned int t = candidates[i];
+					if (used[t])
+						continue;
+					candidates[kept++] = t;
+					unsigned int added = !inMeshlet[mesh.indices[t * 3]] + !inMeshlet[mesh.indices[t * 3 + 1]] + !inMeshlet[mesh.indices[t * 3 + 2]];
+					if (vertices.size() + added > MESHLET_MAX_VERTICES)
+						continue;
+					glm::vec3 offset = centroids[t] - centroid;
+					float distance = glm::dot(offset, offset);
+					if (added < bestNew || (added == bestNew && distance < bestDistance))
+					{
+						next = t;
+						bestNew = added;
+						bestDistance = distance;
+					}
+				}
+				candidates.resize(kept);
+
+				// nothing left around the meshlet (a small or unwelded part): take the nearest of the next unused
+				// triangles in index order, which the optimizer has left spatially coherent, if it faces the same way
+				glm::vec3 normal = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : glm::vec3(0.0f);
+				for (unsigned int t = cursor, scanned = 0; kept == 0 && t < triangleCount && scanned < MESHLET_MAX_TRIANGLES; t++)
+				{
+					if (used[t])
+						continue;
+					scanned++;
+					unsigned int added = !inMeshlet[mesh.indices[t * 3]] + !inMeshlet[mesh.indices[t * 3 + 1]] + !inMeshlet[mesh.indices[t * 3 + 2]];
+					if (vertices.size() + added > MESHLET_MAX_VERTICES || glm::dot(normals[t], normal) < MESHLET_JOIN_COSINE)
+						continue;
+					glm::vec3 offset = centroids[t] - centroid;
+					float distance = glm::dot(offset, offset);
+					if (next == triangleCount || distance < bestDistance)
+					{
+						next = t;
+						bestDistance = distance;
+					}
+				}
+			}
+
+			Meshlet meshlet;
+			meshlet.firstIndex = (unsigned int)indices.size();
+			meshlet.indexCount = (unsigned int)triangles.size() * 3;
+			meshlet.vertexCount = (unsigned int)vertices.size();
+			for (unsigned int i = 0; i < triangles.size(); i++)
+				indices.insert(indices.end(), mesh.indices.begin() + triangles[i] * 3, mesh.indices.begin() + triangles[i] * 3 + 3);
+			computeBounds(mesh, vertices, triangles, meshlet);
+			mesh.meshlets.push_back(meshlet);
+			for (unsigned int i = 0; i < vertices.size(); i++)
+				inMeshlet[vertices[i]] = false;
+		}
+		mesh.indices.swap(indices);
+	}
+
+	// builds the meshlets of every mesh, one mesh per task (maxThreads 0 = the whole pool)
+	static void BuildAll(std::vector<MeshData>& meshes, unsigned int maxThreads = 0)
+	{
+		ThreadPool::Shared().ParallelFor(meshes.size(), [&meshes](size_t i)
+		{
+			Build(meshes[i]);
+		}, maxThreads);
+	}
+
+private:
+	static const glm::vec3& position(const MeshData& mesh, unsigned int triangle, unsigned int corner)
+	{
+		return mesh.vertices[mesh.indices[triangle * 3 + corner]].Position;
+	}
+
+	// unit normal of a triangle, zero for a degenerate one
+	static glm::vec3 faceNormal(const MeshData& mesh, unsigned int triangle)
+	{
+		glm::vec3 a = position(mesh, triangle, 0);
+		glm::vec3 normal = glm::cross(position(mesh, triangle, 1) - a, position(mesh, triangle, 2) - a);
+		float length = glm::length(normal);
+		return length > 0.0f ? normal / length : glm::vec3(0.0f);
+	}
+
+	// the sphere around the meshlet's vertices and the cone around its triangle normals. The apex is moved back
+	// along the axis until it lies behind every triangle's plane, so the backface test holds for every point of
+	// the meshlet and not only its center.
+	static void computeBounds(const MeshData& mesh, const std::vector<unsigned int>& vertices, const std::vector<unsigned int>& triangles, Meshlet& meshlet)
+	{
+		glm::vec3 minimum = mesh.vertices[vertices[0]].Position, maximum = minimum;
+		for (unsigned int i = 1; i < vertices.size(); i++)
+		{
+			minimum = glm::min(minimum, mesh.vertices[vertices[i]].Position);
+			maximum = glm::max(maximum, mesh.vertices[vertices[i]].Position);
+		}
+		meshlet.center = (minimum + maximum) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (unsigned int i = 0; i < vertices.size(); i++)
+		{
+			glm::vec3 offset = mesh.vertices[vertices[i]].Position - meshlet.center;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		meshlet.radius = std::sqrt(radiusSquared);
+
+		std::vector<glm::vec3> normals(triangles.size());
+		glm::vec3 axis(0.0f);
+		for (unsigned int i = 0; i < triangles.size(); i++)
+		{
+			normals[i] = faceNormal(mesh, triangles[i]);
+			axis += normals[i];
+		}
+		meshlet.coneApex = meshlet.center;
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+		float axisLength = glm::length(axis);
+		if (axisLength <= 0.0f)
+			return;
+		axis /= axisLength;
+
+		float minimumCosine = 1.0f;
+		for (unsigned int i = 0; i < triangles.size(); i++)
+		{
+			if (normals[i] != glm::vec3(0.0f))
+				minimumCosine = std::min(minimumCosine, glm::dot(axis, normals[i]));
+		}
+		if (minimumCosine < MESHLET_MIN_CONE_COSINE)
+			return;
+
+		float back = 0.0f;
+		for (unsigned int i = 0; i < triangles.size(); i++)
+		{
+			if (normals[i] == glm::vec3(0.0f))
+				continue;
+			// how far along -axis the center has to go to get behind this triangle's plane
+			float distance = glm::dot(meshlet.center - position(mesh, triangles[i], 0), normals[i]) / glm::dot(axis, normals[i]);
+			back = std::max(back, distance);
+		}
+		meshlet.coneApex = meshlet.center - axis * back;
+		meshlet.coneAxis = axis;
+		meshlet.coneCutoff = std::sqrt(1.0f - minimumCosine * minimumCosine);
+	}
+};
+#endif
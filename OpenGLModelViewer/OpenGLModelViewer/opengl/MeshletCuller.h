@@ -0,0 +1,201 @@
+#ifndef MESHLET_CULLER_H
+#define MESHLET_CULLER_H
+
+#include <opengl/model.h>
+#include <opengl/FrustumCuller.h>
+#include <opengl/ThreadPool.h>
+#include <opengl/Timing.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// meshlets one culling task tests
+const unsigned int MESHLET_CULL_CHUNK = 256;
+
+// counters of the most recent Cull call
+struct MeshletStats
+{
+	unsigned int meshlets = 0; // tested
+	unsigned int culledByFrustum = 0;
+	unsigned int culledByCone = 0;
+	unsigned int ranges = 0;    // index ranges drawn: neighbouring meshlets that both survive share one
+	unsigned int drawCalls = 0; // one per mesh with anything left to draw
+	size_t triangles = 0;       // submitted by the meshes that were culled per meshlet
+	size_t fullTriangles = 0;   // what those meshes would have submitted whole
+	double milliseconds = 0.0;
+};
+
+// Culls a model's meshlets against the view frustum and by their normal cones, in parallel on the thread pool,
+// and draws what is left of each mesh as a list of index ranges with one glMultiDrawElements. The tests run in
+// model space: the frustum planes come from the full model-view-projection matrix and the eye is taken back
+// through the model matrix, which keeps the cone test exact under any affine transform. Meshes without meshlets
+// or drawn at a coarser level of detail (see LodSelector) are drawn whole. Cone culling only removes back faces,
+// so draw with GL_CULL_FACE on when it is enabled; otherwise the back faces of the remaining meshlets still show.
+class MeshletCuller
+{
+public:
+	bool FrustumCulling = true;
+	bool ConeCulling = true;
+
+	// 'visible' are the per-mesh flags of the earlier culling passes; meshes with a 0 are skipped entirely
+	void Cull(const Model& model, const glm::mat4& modelMatrix, const glm::mat4& view, const glm::mat4& projection, const unsigned char* visible = nullptr)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		Frustum frustum = Frustum::FromMatrix(projection * view * modelMatrix);
+		glm::vec3 eye = glm::vec3(glm::inverse(view * modelMatrix)[3]);
+
+		// one entry per mesh: whether it is drawn, and whether by meshlets
+		unsigned int meshCount = (unsigned int)model.meshes.size();
+		meshRanges.resize(meshCount);
+		chunks.clear();
+		unsigned int meshletCount = 0;
+		for (unsigned int m = 0; m < meshCount; m++)
+		{
+			const Mesh& mesh = model.meshes[m];
+			MeshRanges& ranges = meshRanges[m];
+			ranges.mode = (visible != nullptr && !visible[m]) ? SKIP_MESH : (mesh.meshlets.empty() || mesh.lod != 0 ? WHOLE_MESH : MESHLET_RANGES);
+			ranges.firstMeshlet = meshletCount;
+			if (ranges.mode != MESHLET_RANGES)
+				continue;
+			for (unsigned int first = 0; first < mesh.meshlets.size(); first += MESHLET_CULL_CHUNK)
+			{
+				Chunk chunk = { m, first, std::min(first + MESHLET_CULL_CHUNK, (unsigned int)mesh.meshlets.size()) };
+				chunks.push_back(chunk);
+			}
+			meshletCount += (unsigned int)mesh.meshlets.size();
+		}
+
+		results.resize(meshletCount);
+		bool frustumCulling = FrustumCulling, coneCulling = ConeCulling;
+		ThreadPool::Shared().ParallelFor(chunks.size(), [this, &model, &frustum, &eye, frustumCulling, coneCulling](size_t c)
+		{
+			const Chunk& chunk = chunks[c];
+			const std::vector<Meshlet>& meshlets = model.meshes[chunk.mesh].meshlets;
+			unsigned char* result = &results[meshRanges[chunk.mesh].firstMeshlet];
+			for (unsigned int i = chunk.begin; i < chunk.end; i++)
+				result[i] = test(meshlets[i], frustum, eye, frustumCulling, coneCulling);
+		});
+
+		// neighbouring survivors merge into one range, since their indices are contiguous
+		stats = MeshletStats();
+		counts.clear();
+		offsets.clear();
+		for (unsigned int m = 0; m < meshCount; m++)
+		{
+			const Mesh& mesh = model.meshes[m];
+			MeshRanges& ranges = meshRanges[m];
+			ranges.firstRange = (unsigned int)counts.size();
+			stats.drawCalls += ranges.mode == WHOLE_MESH;
+			if (ranges.mode != MESHLET_RANGES)
+				continue;
+			size_t indexSize = mesh.IndexSize();
+			bool open = false;
+			for (unsigned int i = 0; i < mesh.meshlets.size(); i++)
+			{
+				const Meshlet& meshlet = mesh.meshlets[i];
+				unsigned char result = results[ranges.firstMeshlet + i];
+				stats.culledByFrustum += result == CULLED_BY_FRUSTUM;
+				stats.culledByCone += result == CULLED_BY_CONE;
+				if (result != MESHLET_VISIBLE)
+				{
+					open = false;
+					continue;
+				}
+				if (open)
+					counts.back() += (GLsizei)meshlet.indexCount;
+				else
+				{
+					counts.push_back((GLsizei)meshlet.indexCount);
+					offsets.push_back((const void*)(meshlet.firstIndex * indexSize));
+					open = true;
+				}
+				stats.triangles += meshlet.indexCount / 3;
+			}
+			stats.fullTriangles += mesh.indexCount / 3;
+			stats.drawCalls += counts.size() > ranges.firstRange;
+		}
+		stats.meshlets = meshletCount;
+		stats.ranges = (unsigned int)counts.size();
+		stats.milliseconds = ElapsedMilliseconds(start);
+	}
+
+	// draws the model as the last Cull left it; call with the shader in use
+	void Draw(Model& model, const Shader& shader)
+	{
+		for (unsigned int m = 0; m < model.meshes.size() && m < meshRanges.size(); m++)
+		{
+			const MeshRanges& ranges = meshRanges[m];
+			if (ranges.mode == WHOLE_MESH)
+				model.meshes[m].Draw(shader);
+			else if (ranges.mode == MESHLET_RANGES)
+			{
+				unsigned int end = m + 1 < meshRanges.size() ? meshRanges[m + 1].firstRange : (unsigned int)counts.size();
+				if (end > ranges.firstRange)
+					model.meshes[m].DrawRanges(shader, &counts[ranges.firstRange], &offsets[ranges.firstRange], (GLsizei)(end - ranges.firstRange));
+			}
+		}
+	}
+
+	MeshletStats Stats() const { return stats; }
+
+private:
+	enum Mesh_Mode
+	{
+		SKIP_MESH,
+		WHOLE_MESH,
+		MESHLET_RANGES
+	};
+
+	enum Meshlet_Result
+	{
+		MESHLET_VISIBLE,
+		CULLED_BY_FRUSTUM,
+		CULLED_BY_CONE
+	};
+
+	struct MeshRanges
+	{
+		Mesh_Mode mode;
+		unsigned int firstMeshlet; // into 'results'
+		unsigned int firstRange;   // into 'counts' and 'offsets'
+	};
+
+	// a run of one mesh's meshlets, tested by one task
+	struct Chunk
+	{
+		unsigned int mesh;
+		unsigned int begin;
+		unsigned int end;
+	};
+
+	std::vector<MeshRanges> meshRanges;
+	std::vector<Chunk> chunks;
+	std::vector<unsigned char> results; // Meshlet_Result per meshlet of the meshes drawn by meshlets
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+	MeshletStats stats;
+
+	static unsigned char test(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& eye, bool frustumCulling, bool coneCulling)
+	{
+		if (frustumCulling)
+		{
+			for (unsigned int p = 0; p < 6; p++)
+			{
+				if (glm::dot(glm::vec3(frustum.planes[p]), meshlet.center) + frustum.planes[p].w < -meshlet.radius)
+					return CULLED_BY_FRUSTUM;
+			}
+		}
+		if (coneCulling && meshlet.coneCutoff < 1.0f)
+		{
+			glm::vec3 direction = meshlet.coneApex - eye;
+			float length = glm::length(direction);
+			if (length > 0.0f && glm::dot(direction, meshlet.coneAxis) >= meshlet.coneCutoff * length)
+				return CULLED_BY_CONE;
+		}
+		return MESHLET_VISIBLE;
+	}
+};
+#endif
@@ -4,95 +4,828 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-#include <stb/stb_image.h>
-
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/ProgressHandler.hpp>
 
 #include <opengl/mesh.h>
 #include <opengl/shader.h>
+#include <opengl/MeshCache.h>
+#include <opengl/Timing.h>
+#include <opengl/MeshletBuilder.h>
+#include <opengl/MeshOptimizer.h>
+#include <opengl/MeshSimplifier.h>
+#include <opengl/ObjLoader.h>
+#include <opengl/TextureCache.h>
+#include <opengl/ThreadPool.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <map>
+#include <unordered_map>
 #include <vector>
 
-struct ImageData
+// post-process steps of the "Full quality" import profile; the profile's flags are part of the mesh cache key
+const unsigned int MODEL_IMPORT_FLAGS =
+	aiProcess_JoinIdenticalVertices |
+	aiProcess_Triangulate |
+	aiProcess_GenNormals |
+	aiProcess_CalcTangentSpace |
+	aiProcess_LimitBoneWeights |
+	aiProcess_ImproveCacheLocality |
+	aiProcess_RemoveRedundantMaterials |
+	aiProcess_TransformUVCoords |
+	aiProcess_GenUVCoords |
+	aiProcess_SortByPType |
+	aiProcess_FindDegenerates |
+	aiProcess_FindInvalidData |
+	aiProcess_FindInstances |
+	aiProcess_ValidateDataStructure |
+	aiProcess_OptimizeMeshes |
+	aiProcess_OptimizeGraph |
+	aiProcess_Debone |
+	0;
+
+// post-process steps of the "Fast preview" import profile: just enough to get drawable triangles with normals
+const unsigned int PREVIEW_IMPORT_FLAGS =
+	aiProcess_Triangulate |
+	aiProcess_GenNormals |
+	aiProcess_SortByPType |
+	0;
+
+// a named set of post-process steps, selectable in the UI or with --profile <key> on the command line
+struct ImportProfile
+{
+	const char* name;
+	const char* key;
+	unsigned int flags;
+};
+
+const ImportProfile IMPORT_PROFILES[] =
+{
+	{ "Full quality", "full", MODEL_IMPORT_FLAGS },
+	{ "Fast preview", "fast", PREVIEW_IMPORT_FLAGS },
+};
+const unsigned int IMPORT_PROFILE_COUNT = sizeof(IMPORT_PROFILES) / sizeof(IMPORT_PROFILES[0]);
+
+// returns the index of the profile with the given key, or -1
+inline int FindImportProfile(const std::string& key)
+{
+	for (unsigned int i = 0; i < IMPORT_PROFILE_COUNT; i++)
+	{
+		if (key == IMPORT_PROFILES[i].key)
+			return (int)i;
+	}
+	return -1;
+}
+
+// every post-process step the profiles use, in the order ASSIMP itself runs them. Model::Import applies
+// them one at a time through ApplyPostProcessing so each step can be timed.
+struct ImportStep
+{
+	unsigned int flag;
+	const char* name;
+};
+
+const ImportStep IMPORT_STEPS[] =
+{
+	{ aiProcess_ValidateDataStructure, "ValidateDataStructure" },
+	{ aiProcess_RemoveRedundantMaterials, "RemoveRedundantMaterials" },
+	{ aiProcess_FindInstances, "FindInstances" },
+	{ aiProcess_OptimizeGraph, "OptimizeGraph" },
+	{ aiProcess_OptimizeMeshes, "OptimizeMeshes" },
+	{ aiProcess_FindDegenerates, "FindDegenerates" },
+	{ aiProcess_GenUVCoords, "GenUVCoords" },
+	{ aiProcess_TransformUVCoords, "TransformUVCoords" },
+	{ aiProcess_Triangulate, "Triangulate" },
+	{ aiProcess_SortByPType, "SortByPType" },
+	{ aiProcess_FindInvalidData, "FindInvalidData" },
+	{ aiProcess_GenNormals, "GenNormals" },
+	{ aiProcess_CalcTangentSpace, "CalcTangentSpace" },
+	{ aiProcess_JoinIdenticalVertices, "JoinIdenticalVertices" },
+	{ aiProcess_Debone, "Debone" },
+	{ aiProcess_LimitBoneWeights, "LimitBoneWeights" },
+	{ aiProcess_ImproveCacheLocality, "ImproveCacheLocality" },
+};
+const unsigned int IMPORT_STEP_COUNT = sizeof(IMPORT_STEPS) / sizeof(IMPORT_STEPS[0]);
+
+// cache key flags for meshes built by the native ObjLoader (no ASSIMP post-processing ran)
+const unsigned int OBJ_LOADER_IMPORT_FLAGS = 0;
+
+// granularity of the parallel mesh conversion (vertices / faces per task)
+const unsigned int VERTEX_CHUNK = 16384;
+const unsigned int FACE_CHUNK = 16384;
+
+// progress and cancellation shared between a loading worker thread and the render thread
+struct LoadProgress
 {
-	int width;
-	int height;
-	int nrComponents;
-	unsigned char *uc;
+	std::atomic<bool> cancelled{ false };
+	std::atomic<float> fraction{ 0.0f }; // of the import alone, in [0, 1]
 };
 
-static std::map<std::string, ImageData> TEXTURE_STORAGE{};
+// forwards Assimp's import progress and aborts the import once the load is cancelled
+class ImportProgressHandler : public Assimp::ProgressHandler
+{
+public:
+	ImportProgressHandler(LoadProgress *progress) : progress(progress) {}
+
+	// reading the file is the first half of the import, as ASSIMP reports it
+	bool Update(float percentage) override
+	{
+		if (percentage >= 0.0f)
+			progress->fraction = percentage;
+		return !progress->cancelled;
+	}
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+	// the post-process steps run one at a time and report themselves (see Model::applyPostProcessing)
+	void UpdatePostProcess(int, int) override {}
+
+private:
+	LoadProgress *progress;
+};
+
+// options for Model::Import
+struct ImportSettings
+{
+	unsigned int profile = 0; // index into IMPORT_PROFILES
+	bool useMeshCache = true;
+	// Wavefront OBJ files go through the native ObjLoader first; ASSIMP remains the fallback
+	bool useObjLoader = true;
+	// keep the CPU copy of the geometry after the GL upload only when something on the CPU needs it
+	Geometry_Residency residency = RELEASE_GEOMETRY;
+	// GPU vertex layout of every mesh
+	Vertex_Format vertexFormat = FULL_VERTEX;
+	// reorder indices and vertices with MeshOptimizer before the result is cached
+	bool optimizeMeshes = true;
+	// build coarser levels of detail with MeshSimplifier; they are cached along with the full meshes
+	bool generateLods = true;
+	unsigned int lodLevels = 4; // the full mesh included, at most MAX_LOD_LEVELS
+	SimplifySettings simplify;
+	// split the full meshes into meshlets with MeshletBuilder, for MeshletCuller; cached as well
+	bool buildMeshlets = false;
+};
+
+// what the meshes of a preview from Model::Import are
+enum Preview_Stage
+{
+	BOX_PREVIEW,   // the bounding box of every mesh, as soon as the meshes have been read
+	COARSE_PREVIEW // the coarsest level of detail of every mesh
+};
+
+// receives stand-ins for the meshes while Model::Import is still working on them, one per mesh in the order of
+// the final meshes. Called on the importing thread.
+typedef std::function<void(std::vector<MeshData>&& meshes, Preview_Stage stage)> PreviewCallback;
+
+// wall time of one stage of Model::Import
+struct ImportTiming
+{
+	std::string step;
+	double milliseconds;
+};
+
+// everything Model::Import produces on the CPU; turned into GL objects by Model::AddMesh
+struct ModelData
+{
+	std::string directory;
+	std::vector<MeshData> meshes;
+	bool fromCache = false;
+	std::vector<ImportTiming> timings;
+	std::vector<MeshOptimizationStats> optimization; // one per mesh when MeshOptimizer ran, also on a cache hit
+};
 
 class Model
 {
 public:
     /*  Model Data */
-	std::vector<Texture> textures_loaded; // stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+	std::unordered_map<std::string, Texture> textures_loaded; // textures this model has acquired, by type and path, so each is only referenced once
+	TextureReferences textureReferences; // this model's share of the TextureCache, released with the model
+	// mesh textures still showing a placeholder
+	struct PendingTexture
+	{
+		unsigned int mesh;
+		unsigned int texture;
+	};
+	std::vector<PendingTexture> pendingTextures;
 	std::vector<Mesh> meshes;
 	std::string directory;
     bool gammaCorrection = false;
+	ImportSettings importSettings;
+	// statistics of the most recent Load call
+	bool loadedFromCache = false;
+	double loadMilliseconds = 0.0;       // until every mesh was at full detail
+	double firstPixelMilliseconds = 0.0; // until something could be drawn, a preview if the load had one
+	std::vector<ImportTiming> importTimings;
+	std::vector<MeshOptimizationStats> optimizationStats;
+	// change whenever meshes are added or their textures replaced. Revisions are unique across models, so a
+	// renderer holding derived GL state (see BatchRenderer) can tell when to rebuild it.
+	unsigned int geometryRevision = 0;
+	unsigned int materialRevision = 0;
 
     /*  Functions   */
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void Load(std::string const& path)
 	{
 		textures_loaded.clear();
+		textureReferences.Clear();
+		pendingTextures.clear();
 		meshes.clear();
+		geometryRevision = materialRevision = nextRevision();
+		loadedFromCache = false;
 
-		// read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, 
-			aiProcess_JoinIdenticalVertices |
-			aiProcess_Triangulate |
-			aiProcess_GenNormals |
-			aiProcess_CalcTangentSpace |
-			aiProcess_LimitBoneWeights |
-			aiProcess_ImproveCacheLocality |
-			aiProcess_RemoveRedundantMaterials |
-			aiProcess_TransformUVCoords | 
-			aiProcess_GenUVCoords |
-			aiProcess_SortByPType |
-			aiProcess_FindDegenerates |
-			aiProcess_FindInvalidData |
-			aiProcess_FindInstances |
-			aiProcess_ValidateDataStructure |
-			aiProcess_OptimizeMeshes |
-			aiProcess_OptimizeGraph |
-			aiProcess_Debone |
-			0);
-		// check for errors
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		ModelData data;
+		if (!Import(path, data, nullptr, importSettings))
 			return;
-		}
+
+		TextureCache::Shared().WaitForDecodes();
+		directory = data.directory;
+		meshes.reserve(data.meshes.size());
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+			AddMesh(std::move(data.meshes[i]));
+
+		loadedFromCache = data.fromCache;
+		importTimings = data.timings;
+		optimizationStats = data.optimization;
+		loadMilliseconds = ElapsedMilliseconds(start);
+		firstPixelMilliseconds = loadMilliseconds;
+		cout << "MODEL::LOADED " << path << " (" << meshes.size() << " meshes) in " << loadMilliseconds << " ms" << endl;
+	}
+
+	// reads a model from the mesh cache, the native OBJ loader or via ASSIMP into CPU-side mesh data and decodes its textures.
+	// Touches no GL state, so it can run on a worker thread. Returns false on error or when cancelled through 'progress'.
+	// 'preview' is handed stand-ins for the meshes as soon as there are any: their bounding boxes once they are read,
+	// then their coarsest levels of detail, so a loader can show something while the rest of the import runs.
+	static bool Import(std::string const& path, ModelData& data, LoadProgress* progress = nullptr, const ImportSettings& settings = ImportSettings(),
+		const PreviewCallback& preview = PreviewCallback())
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
 		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of("/\\"));
+		data.directory = path.substr(0, path.find_last_of("/\\"));
+		data.meshes.clear();
+		data.fromCache = false;
+		data.timings.clear();
+		data.optimization.clear();
+
+		// a cache hit goes straight from the mapped file to the mesh data without building an aiScene.
+		// Native OBJ results are cached without post-process flags; an OBJ the native loader had to hand to
+		// ASSIMP is found under the profile's flags instead.
+		const ImportProfile& profile = IMPORT_PROFILES[std::min(settings.profile, IMPORT_PROFILE_COUNT - 1)];
+		bool nativeObj = settings.useObjLoader && ObjLoader::Handles(path);
+		uint64_t sourceHash = 0;
+		bool hashed = settings.useMeshCache && hashSource(path, sourceHash);
+		if (hashed && settings.optimizeMeshes)
+		{
+			// optimized meshes are cached apart from the importer's own output
+			const unsigned char optimized = 'O';
+			sourceHash = HashBytes(&optimized, 1, sourceHash);
+		}
+		if (hashed && settings.generateLods)
+		{
+			// and so are the different sets of levels: every SimplifySettings field, the weight by its bits
+			uint32_t weightBits;
+			std::memcpy(&weightBits, &settings.simplify.attributeWeight, sizeof(weightBits));
+			const unsigned char lods[8] = { 'L', (unsigned char)settings.lodLevels, settings.simplify.attributeAware, settings.simplify.preserveBorders,
+				(unsigned char)weightBits, (unsigned char)(weightBits >> 8), (unsigned char)(weightBits >> 16), (unsigned char)(weightBits >> 24) };
+			sourceHash = HashBytes(lods, sizeof(lods), sourceHash);
+		}
+		if (hashed && settings.buildMeshlets)
+		{
+			// meshlets reorder the indices
+			const unsigned char meshlets = 'M';
+			sourceHash = HashBytes(&meshlets, 1, sourceHash);
+		}
+		std::chrono::high_resolution_clock::time_point stepStart = std::chrono::high_resolution_clock::now();
+		if (hashed && ((nativeObj && loadFromCache(sourceHash, OBJ_LOADER_IMPORT_FLAGS, data)) || loadFromCache(sourceHash, profile.flags, data)))
+		{
+			data.fromCache = true;
+			addTiming(data, "Mesh cache", stepStart);
+			publishPreview(data, hasLods(data) ? COARSE_PREVIEW : BOX_PREVIEW, preview);
+			cout << "MESH_CACHE::HIT " << path << " (" << data.meshes.size() << " meshes) in " << ElapsedMilliseconds(start) << " ms" << endl;
+		}
+		else if (nativeObj && ObjLoader::Load(path, data.meshes, progress != nullptr ? &progress->cancelled : nullptr, progress != nullptr ? &progress->fraction : nullptr))
+		{
+			addTiming(data, "Native OBJ loader", stepStart);
+			publishPreview(data, BOX_PREVIEW, preview);
+			if (settings.optimizeMeshes)
+				optimizeMeshes(data);
+			if (settings.generateLods)
+			{
+				generateLods(data, settings);
+				publishPreview(data, COARSE_PREVIEW, preview);
+			}
+			if (settings.buildMeshlets)
+				buildMeshlets(data);
+			if (hashed && !MeshCache::Write(MeshCache::PathFor(sourceHash, OBJ_LOADER_IMPORT_FLAGS), sourceHash, OBJ_LOADER_IMPORT_FLAGS, data.meshes, data.optimization))
+				cout << "ERROR::MESH_CACHE:: could not write the cache for " << path << endl;
+			cout << "OBJ_LOADER::LOADED " << path << " (" << data.meshes.size() << " meshes) in " << ElapsedMilliseconds(start) << " ms" << endl;
+		}
+		else
+		{
+			if (isCancelled(progress))
+				return false;
+			if (nativeObj)
+				cout << "OBJ_LOADER::FALLBACK " << path << " uses features the native loader doesn't support, importing via ASSIMP" << endl;
+			// read file via ASSIMP
+			Assimp::Importer importer;
+			if (progress != nullptr)
+				importer.SetProgressHandler(new ImportProgressHandler(progress)); // the importer takes ownership
+			const aiScene* scene = importer.ReadFile(path, 0);
+			if (isCancelled(progress))
+				return false;
+			// check for errors
+			if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+			{
+				cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+				return false;
+			}
+			addTiming(data, "ReadFile", stepStart);
+			// the materials are known now, so the textures can decode while the meshes are processed
+			decodeTextures(scene, data.directory);
+
+			// run the profile's post-process steps one at a time to see what each of them costs
+			if (!applyPostProcessing(importer, profile.flags, data, progress))
+				return false;
+
+			// convert ASSIMP's meshes into our vertex format
+			stepStart = std::chrono::high_resolution_clock::now();
+			ConvertScene(importer.GetScene(), data.meshes, progress);
+			if (isCancelled(progress))
+				return false;
+			addTiming(data, "Convert meshes", stepStart);
+			publishPreview(data, BOX_PREVIEW, preview);
+			if (settings.optimizeMeshes)
+				optimizeMeshes(data);
+			if (settings.generateLods)
+			{
+				generateLods(data, settings);
+				publishPreview(data, COARSE_PREVIEW, preview);
+			}
+			if (settings.buildMeshlets)
+				buildMeshlets(data);
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+			if (hashed && !MeshCache::Write(MeshCache::PathFor(sourceHash, profile.flags), sourceHash, profile.flags, data.meshes, data.optimization))
+				cout << "ERROR::MESH_CACHE:: could not write the cache for " << path << endl;
+			cout << "MESH_CACHE::MISS " << path << " (" << data.meshes.size() << " meshes, profile \"" << profile.name << "\") in " << ElapsedMilliseconds(start) << " ms" << endl;
+			for (unsigned int i = 0; i < data.timings.size(); i++)
+				cout << "  " << data.timings[i].step << ": " << data.timings[i].milliseconds << " ms" << endl;
+		}
+
+		computeBounds(data);
+		buildBvhs(data);
+
+		requestTextures(data);
+		if (progress != nullptr)
+			progress->fraction = 1.0f;
+		return !isCancelled(progress);
+	}
+
+	// converts every mesh reachable from the scene's root node, in node order. Vertices and faces are split
+	// into fixed-size chunks that are converted in parallel on the thread pool, so even a file with a single
+	// large mesh uses every core (maxThreads 0 = the whole pool).
+	static void ConvertScene(const aiScene *scene, std::vector<MeshData> &meshes, LoadProgress *progress = nullptr, unsigned int maxThreads = 0)
+	{
+		std::vector<aiMesh*> sceneMeshes;
+		processNode(scene->mRootNode, scene, sceneMeshes);
+
+		struct ConvertChunk
+		{
+			unsigned int mesh;
+			unsigned int begin;
+			unsigned int end;
+			bool faces;
+			size_t firstIndex;
+		};
+		std::vector<ConvertChunk> chunks;
+		std::vector<size_t> faceChunkOffsets;
+
+		meshes.clear();
+		meshes.resize(sceneMeshes.size());
+		for (unsigned int m = 0; m < sceneMeshes.size(); m++)
+		{
+			const aiMesh *mesh = sceneMeshes[m];
+			processMesh(sceneMeshes[m], scene, meshes[m], faceChunkOffsets);
+			for (unsigned int begin = 0; begin < mesh->mNumVertices; begin += VERTEX_CHUNK)
+			{
+				ConvertChunk chunk = { m, begin, std::min(begin + VERTEX_CHUNK, mesh->mNumVertices), false, 0 };
+				chunks.push_back(chunk);
+			}
+			for (unsigned int c = 0; c < faceChunkOffsets.size(); c++)
+			{
+				unsigned int begin = c * FACE_CHUNK;
+				ConvertChunk chunk = { m, begin, std::min(begin + FACE_CHUNK, mesh->mNumFaces), true, faceChunkOffsets[c] };
+				chunks.push_back(chunk);
+			}
+		}
+
+		ThreadPool::Shared().ParallelFor(chunks.size(), [&](size_t i)
+		{
+			const ConvertChunk &chunk = chunks[i];
+			if (isCancelled(progress))
+				return;
+			if (chunk.faces)
+				processFaces(sceneMeshes[chunk.mesh], meshes[chunk.mesh], chunk.begin, chunk.end, chunk.firstIndex);
+			else
+				processVertices(sceneMeshes[chunk.mesh], meshes[chunk.mesh], chunk.begin, chunk.end);
+		}, maxThreads);
+	}
+
+	// deletes the GL buffers of every mesh; call on the GL thread before dropping a model that was drawn
+	void DeleteBuffers()
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].DeleteBuffers();
+	}
+
+	// creates the GL objects for one imported mesh, loading its textures if this model hasn't loaded them yet.
+	// Textures that are still decoding get a placeholder until UpdateTextures swaps them in.
+	// The geometry buffers are moved into the mesh and, depending on importSettings.residency, freed after the upload.
+	void AddMesh(MeshData&& data)
+	{
+		resolveTextures(data, (unsigned int)meshes.size());
+		meshes.push_back(Mesh(std::move(data.vertices), std::move(data.indices), std::move(data.textures), importSettings.residency, importSettings.vertexFormat,
+			data.lodIndices, std::move(data.lods)));
+		meshes.back().bounds = data.bounds;
+		meshes.back().bvh = std::move(data.bvh);
+		meshes.back().meshlets = std::move(data.meshlets);
+		geometryRevision = materialRevision = nextRevision();
+	}
+
+	// like AddMesh, but takes the place of meshes[index], e.g. the full mesh replacing a preview; the old mesh's
+	// GL objects are deleted
+	void ReplaceMesh(unsigned int index, MeshData&& data)
+	{
+		for (unsigned int i = 0; i < pendingTextures.size();)
+		{
+			if (pendingTextures[i].mesh == index)
+				pendingTextures.erase(pendingTextures.begin() + i);
+			else
+				i++;
+		}
+		resolveTextures(data, index);
+		meshes[index].DeleteBuffers();
+		meshes[index] = Mesh(std::move(data.vertices), std::move(data.indices), std::move(data.textures), importSettings.residency, importSettings.vertexFormat,
+			data.lodIndices, std::move(data.lods));
+		meshes[index].bounds = data.bounds;
+		meshes[index].bvh = std::move(data.bvh);
+		meshes[index].meshlets = std::move(data.meshlets);
+		geometryRevision = materialRevision = nextRevision();
+	}
+
+	// call once per frame on the GL thread: uploads the textures that finished decoding and replaces their
+	// placeholders. Returns true while textures are still pending.
+	bool UpdateTextures()
+	{
+		for (unsigned int i = 0; i < pendingTextures.size();)
+		{
+			Mesh& mesh = meshes[pendingTextures[i].mesh];
+			const Texture& texture = mesh.textures[pendingTextures[i].texture];
+			if (TextureCache::Shared().IsDecoding(directory + '/' + texture.path, TextureUsageFor(texture.type)))
+			{
+				i++;
+				continue;
+			}
+			mesh.SetTexture(pendingTextures[i].texture, loadTexture(texture.path, texture.type));
+			pendingTextures.erase(pendingTextures.begin() + i);
+			materialRevision = nextRevision();
+		}
+		return !pendingTextures.empty();
+	}
+
+	// size of the model's geometry on the GPU and of the CPU copies that are still resident
+	size_t GeometryBytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].GeometryBytes();
+		return bytes;
+	}
+
+	// what the GPU buffers would take with FULL_VERTEX; the difference to GeometryBytes is saved by packing
+	size_t FullGeometryBytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].FullGeometryBytes();
+		return bytes;
+	}
+
+	size_t ResidentGeometryBytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].ResidentGeometryBytes();
+		return bytes;
 	}
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    // draws the model, and thus all its meshes, except those whose 'visible' flag is 0 (see FrustumCuller)
+    void Draw(const Shader& shader, const unsigned char* visible = nullptr)
     {
         for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        {
+            if (visible == nullptr || visible[i])
+                meshes[i].Draw(shader);
+        }
     }
 
 private:
     /*  Functions */
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+	// the source part of the mesh cache key: the model file and, for OBJ, the material libraries it references, so
+	// editing a .mtl rebuilds the cache too
+	static bool hashSource(const std::string& path, uint64_t& hash)
+	{
+		if (!MeshCache::HashSource(path, hash))
+			return false;
+		std::vector<std::string> libraries = materialLibraries(path);
+		for (unsigned int i = 0; i < libraries.size(); i++)
+		{
+			// a missing library still counts, so the cache is rebuilt once it appears
+			uint64_t libraryHash = 0;
+			MeshCache::HashSource(libraries[i], libraryHash);
+			hash = HashBytes((const unsigned char*)&libraryHash, sizeof(libraryHash), hash);
+		}
+		return true;
+	}
+
+	// the files named by the mtllib statements of an OBJ file, as paths next to it
+	static std::vector<std::string> materialLibraries(const std::string& path)
+	{
+		std::vector<std::string> libraries;
+		size_t dot = path.find_last_of('.');
+		std::string extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+		for (unsigned int i = 0; i < extension.size(); i++)
+			extension[i] = (char)tolower(extension[i]);
+		MappedFile file;
+		if (extension != "obj" || !file.Open(path))
+			return libraries;
+		std::string directory = path.substr(0, path.find_last_of("/\\"));
+		const char* p = (const char*)file.Data();
+		const char* end = p + file.Size();
+		while (p < end)
+		{
+			const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+			if (lineEnd == nullptr)
+				lineEnd = end;
+			if (lineEnd - p > 7 && std::memcmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))
+			{
+				const char* name = p + 7;
+				const char* nameEnd = lineEnd;
+				while (name < nameEnd && (*name == ' ' || *name == '\t'))
+					name++;
+				while (nameEnd > name && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t' || nameEnd[-1] == '\r'))
+					nameEnd--;
+				libraries.push_back(directory + '/' + std::string(name, nameEnd));
+			}
+			p = lineEnd + 1;
+		}
+		return libraries;
+	}
+
+	static bool isCancelled(const LoadProgress* progress)
+	{
+		return progress != nullptr && progress->cancelled;
+	}
+
+	static unsigned int nextRevision()
+	{
+		static unsigned int revision = 0;
+		return ++revision;
+	}
+
+	// loads the textures of a mesh that is to become meshes[mesh], or gives them placeholders while they decode
+	void resolveTextures(MeshData& data, unsigned int mesh)
+	{
+		for (unsigned int i = 0; i < data.textures.size(); i++)
+		{
+			if (TextureCache::Shared().IsDecoding(directory + '/' + data.textures[i].path, TextureUsageFor(data.textures[i].type)))
+			{
+				PendingTexture pending = { mesh, i };
+				pendingTextures.push_back(pending);
+				data.textures[i].id = TextureCache::Shared().Placeholder(data.textures[i].type);
+			}
+			else
+				data.textures[i] = loadTexture(data.textures[i].path, data.textures[i].type);
+		}
+	}
+
+	static void addTiming(ModelData& data, const char* step, std::chrono::high_resolution_clock::time_point start)
+	{
+		ImportTiming timing = { step, ElapsedMilliseconds(start) };
+		data.timings.push_back(timing);
+	}
+
+	// reorders the meshes in parallel and keeps the before/after statistics of every mesh
+	static void optimizeMeshes(ModelData& data)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		MeshOptimizer::OptimizeAll(data.meshes, data.optimization);
+		addTiming(data, "Mesh optimizer", start);
+	}
+
+	// simplifies the meshes in parallel, after the optimizer so the levels index the final vertex order
+	static void generateLods(ModelData& data, const ImportSettings& settings)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		MeshSimplifier::BuildAllLods(data.meshes, settings.lodLevels, settings.simplify);
+		addTiming(data, "LOD generation", start);
+	}
+
+	// clusters the full meshes in parallel. The levels of detail keep their own indices, so the order doesn't matter to them.
+	static void buildMeshlets(ModelData& data)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		MeshletBuilder::BuildAll(data.meshes);
+		addTiming(data, "Meshlets", start);
+	}
+
+	// decodes the referenced images on the thread pool; the GL thread uploads each one once it is ready
+	static void requestTextures(const ModelData& data)
+	{
+		std::vector<TextureRequest> requests;
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+		{
+			for (unsigned int j = 0; j < data.meshes[i].textures.size(); j++)
+			{
+				const Texture& texture = data.meshes[i].textures[j];
+				TextureRequest request = { data.directory + '/' + texture.path, TextureUsageFor(texture.type) };
+				requests.push_back(request);
+			}
+		}
+		TextureCache::Shared().DecodeAsync(requests);
+	}
+
+	static bool hasLods(const ModelData& data)
+	{
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+		{
+			if (data.meshes[i].lods.size() > 1)
+				return true;
+		}
+		return false;
+	}
+
+	// hands stand-ins for the meshes to 'preview', with their own bounds so they can be culled like the real ones
+	static void publishPreview(const ModelData& data, Preview_Stage stage, const PreviewCallback& preview)
+	{
+		if (!preview)
+			return;
+		const std::vector<MeshData>& source = data.meshes;
+		std::vector<MeshData> meshes(source.size());
+		ThreadPool::Shared().ParallelFor(source.size(), [&source, &meshes, stage](size_t i)
+		{
+			if (stage == COARSE_PREVIEW)
+				meshes[i] = MeshSimplifier::ExtractLevel(source[i], (unsigned int)std::max<size_t>(source[i].lods.size(), 1) - 1);
+			else
+				meshes[i] = boxProxy(source[i]);
+			meshes[i].bounds = MeshBounds::FromVertices(meshes[i].vertices);
+		});
+		// the stand-ins wear the meshes' textures; start decoding them now so the GL thread doesn't load them itself
+		requestTextures(data);
+		preview(std::move(meshes), stage);
+	}
+
+	// the axis-aligned bounding box of a mesh as 12 triangles with face normals, wearing the mesh's textures
+	static MeshData boxProxy(const MeshData& mesh)
+	{
+		MeshData box;
+		box.textures = mesh.textures;
+		if (mesh.vertices.empty())
+			return box;
+		glm::vec3 minimum = mesh.vertices[0].Position, maximum = mesh.vertices[0].Position;
+		for (size_t i = 1; i < mesh.vertices.size(); i++)
+		{
+			minimum = glm::min(minimum, mesh.vertices[i].Position);
+			maximum = glm::max(maximum, mesh.vertices[i].Position);
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int side = 0; side < 2; side++)
+			{
+				// the face's corners go counter-clockwise seen from outside
+				glm::vec3 normal(0.0f);
+				normal[axis] = side ? 1.0f : -1.0f;
+				int u = (axis + (side ? 1 : 2)) % 3, v = (axis + (side ? 2 : 1)) % 3;
+				unsigned int first = (unsigned int)box.vertices.size();
+				for (int corner = 0; corner < 4; corner++)
+				{
+					Vertex vertex = {};
+					vertex.Position[axis] = side ? maximum[axis] : minimum[axis];
+					vertex.Position[u] = (corner == 1 || corner == 2) ? maximum[u] : minimum[u];
+					vertex.Position[v] = (corner >= 2) ? maximum[v] : minimum[v];
+					vertex.Normal = normal;
+					vertex.TexCoords = glm::vec2(corner == 1 || corner == 2 ? 1.0f : 0.0f, corner >= 2 ? 1.0f : 0.0f);
+					vertex.Tangent[u] = 1.0f;
+					vertex.Bitangent[v] = 1.0f;
+					box.vertices.push_back(vertex);
+				}
+				const unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+				for (int k = 0; k < 6; k++)
+					box.indices.push_back(first + quad[k]);
+			}
+		}
+		return box;
+	}
+
+	// bounding volumes of every mesh, whichever path imported it; they aren't cached since they are cheap to rebuild
+	static void computeBounds(ModelData& data)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::vector<MeshData>& meshes = data.meshes;
+		ThreadPool::Shared().ParallelFor(meshes.size(), [&meshes](size_t i)
+		{
+			meshes[i].bounds = MeshBounds::FromVertices(meshes[i].vertices);
+		});
+		addTiming(data, "Bounds", start);
+	}
+
+	// triangle BVHs for picking, one mesh per task
+	static void buildBvhs(ModelData& data)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::vector<MeshData>& meshes = data.meshes;
+		ThreadPool::Shared().ParallelFor(meshes.size(), [&meshes](size_t i)
+		{
+			if (!meshes[i].vertices.empty())
+				meshes[i].bvh.Build(&meshes[i].vertices[0].Position, sizeof(Vertex), meshes[i].indices);
+		});
+		addTiming(data, "BVH", start);
+	}
+
+	// applies the post-process steps in 'flags' to the importer's scene one by one, recording the time of each
+	static bool applyPostProcessing(Assimp::Importer& importer, unsigned int flags, ModelData& data, LoadProgress* progress)
+	{
+		unsigned int stepCount = 0, stepsDone = 0;
+		for (unsigned int i = 0; i < IMPORT_STEP_COUNT; i++)
+			stepCount += (flags & IMPORT_STEPS[i].flag) != 0;
+
+		for (unsigned int i = 0; i < IMPORT_STEP_COUNT; i++)
+		{
+			if (!(flags & IMPORT_STEPS[i].flag))
+				continue;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			if (importer.ApplyPostProcessing(IMPORT_STEPS[i].flag) == nullptr)
+			{
+				cout << "ERROR::ASSIMP:: " << IMPORT_STEPS[i].name << ": " << importer.GetErrorString() << endl;
+				return false;
+			}
+			addTiming(data, IMPORT_STEPS[i].name, start);
+			if (isCancelled(progress))
+				return false;
+			if (progress != nullptr)
+				progress->fraction = 0.5f + 0.4f * (float)++stepsDone / (float)stepCount;
+		}
+		return true;
+	}
+
+	// rebuilds the mesh data from a mapped cache file
+	static bool loadFromCache(uint64_t sourceHash, uint32_t importFlags, ModelData& data)
+	{
+		MeshCacheView cache;
+		if (!cache.Open(MeshCache::PathFor(sourceHash, importFlags), sourceHash, importFlags))
+			return false;
+
+		data.meshes.resize(cache.MeshCount());
+		for (unsigned int i = 0; i < cache.MeshCount(); i++)
+		{
+			const MeshCacheEntry& entry = cache.Entry(i);
+			MeshData& mesh = data.meshes[i];
+			mesh.vertices.assign(cache.Vertices(entry), cache.Vertices(entry) + entry.vertexCount);
+			mesh.indices.assign(cache.Indices(entry), cache.Indices(entry) + entry.indexCount);
+			mesh.lodIndices.assign(cache.Indices(entry) + entry.indexCount, cache.Indices(entry) + entry.indexCount + entry.lodIndexCount);
+			for (unsigned int j = 0; j < entry.lodCount; j++)
+			{
+				const MeshCacheLod& cached = cache.Lod(entry.firstLod + j);
+				MeshLod lod = { cached.firstIndex, cached.indexCount, cached.error };
+				mesh.lods.push_back(lod);
+			}
+			mesh.meshlets.assign(cache.Meshlets(entry), cache.Meshlets(entry) + entry.meshletCount);
+			for (unsigned int j = 0; j < entry.textureCount; j++)
+			{
+				const MeshCacheTextureRef& ref = cache.TextureRef(entry.firstTexture + j);
+				Texture texture;
+				texture.id = 0;
+				texture.type = cache.String(ref.typeOffset, ref.typeLength);
+				texture.path = cache.String(ref.pathOffset, ref.pathLength);
+				mesh.textures.push_back(texture);
+			}
+		}
+		if (cache.Optimization() != nullptr)
+			data.optimization.assign(cache.Optimization(), cache.Optimization() + cache.MeshCount());
+		return true;
+	}
+
+    // processes a node in a recursive fashion. Collects each individual mesh located at the node and repeats this process on its children nodes (if any).
+    static void processNode(aiNode *node, const aiScene *scene, std::vector<aiMesh*> &meshes)
     {
         // process each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -100,26 +833,63 @@ private:
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            meshes.push_back(mesh);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, meshes);
         }
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // sizes 'data' for one aiMesh and collects its texture references. The vertex and face data is then filled in
+    // place by processVertices/processFaces, which only read the scene and may run concurrently on disjoint ranges.
+    // faceChunkOffsets receives the first index of every FACE_CHUNK faces.
+    static void processMesh(aiMesh *mesh, const aiScene *scene, MeshData &data, std::vector<size_t> &faceChunkOffsets)
     {
-        // data to fill
-		std::vector<Vertex> vertices;
-		std::vector<unsigned int> indices;
-		std::vector<Texture> textures;
+        // data to fill; sized up front so the conversion writes in place instead of growing the vectors
+		std::vector<Texture> &textures = data.textures;
+		size_t indexCount = 0;
+		faceChunkOffsets.clear();
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		{
+			if (i % FACE_CHUNK == 0)
+				faceChunkOffsets.push_back(indexCount);
+			indexCount += mesh->mFaces[i].mNumIndices;
+		}
+		data.vertices.resize(mesh->mNumVertices);
+		data.indices.resize(indexCount);
+
+        // process materials
+        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
+        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
+        // Same applies to other texture as the following list summarizes:
+        // diffuse: texture_diffuseN
+        // specular: texture_specularN
+        // normal: texture_normalN
 
+        // 1. diffuse maps
+		std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        // 2. specular maps
+		std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        // 3. normal maps
+        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        // 4. height maps
+        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
+        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+    }
+
+    // converts the vertices [begin, end) of an aiMesh into our interleaved vertex format
+    static void processVertices(const aiMesh *mesh, MeshData &data, unsigned int begin, unsigned int end)
+    {
         // Walk through each of the mesh's vertices
-        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        for (unsigned int i = begin; i < end; i++)
         {
-            Vertex vertex;
+            Vertex &vertex = data.vertices[i];
             glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -170,143 +940,78 @@ private:
 				vertex.Tangent = glm::vec3(0.0f, 0.0f, 0.0f);
 				vertex.Bitangent = glm::vec3(0.0f, 0.0f, 0.0f);
 			}
-            
-            vertices.push_back(vertex);
         }
+    }
+
+    // copies the indices of the faces [begin, end) into data.indices, starting at firstIndex
+    static void processFaces(const aiMesh *mesh, MeshData &data, unsigned int begin, unsigned int end, size_t firstIndex)
+    {
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
-        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+        size_t index = firstIndex;
+        for (unsigned int i = begin; i < end; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace &face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
             for (unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+                data.indices[index++] = face.mIndices[j];
         }
-        // process materials
-        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
-        // Same applies to other texture as the following list summarizes:
-        // diffuse: texture_diffuseN
-        // specular: texture_specularN
-        // normal: texture_normalN
-
-        // 1. diffuse maps
-		std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        // 2. specular maps
-		std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-        // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-        // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+    }
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+    // starts decoding the textures of every material in the scene
+    static void decodeTextures(const aiScene *scene, const std::string &directory)
+    {
+        // same mapping as processMesh; aiTextureType_HEIGHT holds the normal maps
+        const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+        const Texture_Usage usages[] = { COLOR_TEXTURE, LINEAR_TEXTURE, NORMAL_TEXTURE, LINEAR_TEXTURE };
+        std::vector<TextureRequest> requests;
+        for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+        {
+            for (unsigned int t = 0; t < 4; t++)
+            {
+                std::vector<Texture> textures = loadMaterialTextures(scene->mMaterials[i], types[t], "");
+                for (unsigned int j = 0; j < textures.size(); j++)
+                {
+                    TextureRequest request = { directory + '/' + textures[j].path, usages[t] };
+                    requests.push_back(request);
+                }
+            }
+        }
+        TextureCache::Shared().DecodeAsync(requests);
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
+    // collects all material textures of a given type. Loading happens later on the GL thread (see AddMesh),
+    // so the returned Texture structs only carry the path and type.
+    static vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
     {
 		std::vector<Texture> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            { // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture); // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
         }
         return textures;
     }
-};
-
-unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma)
-{
-	std::string filename = std::string(path);
-    filename = directory + '/' + filename;
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
 
-	std::map<std::string, ImageData>::const_iterator locator = TEXTURE_STORAGE.find(filename);
-	if (locator != TEXTURE_STORAGE.end())
-	{
-		ImageData iData = TEXTURE_STORAGE.at(filename);
-		GLenum format;
-		if (iData.nrComponents == 1)
-			format = GL_RED;
-		else if (iData.nrComponents == 3)
-			format = GL_RGB;
-		else if (iData.nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, iData.width, iData.height, 0, format, GL_UNSIGNED_BYTE, iData.uc);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	}
-	else
-	{
-		int width, height, nrComponents;
-		unsigned char *uc = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-		if (uc)
-		{
-			std::cout << "Texture loaded at: " << filename << std::endl;
-			ImageData iData = { width, height, nrComponents, uc };
-			std::map<std::string, ImageData>::iterator it = TEXTURE_STORAGE.begin();
-			TEXTURE_STORAGE.insert(it, std::pair<std::string, ImageData>(filename, iData));
-
-			GLenum format;
-			if (nrComponents == 1)
-				format = GL_RED;
-			else if (nrComponents == 3)
-				format = GL_RGB;
-			else if (nrComponents == 4)
-				format = GL_RGBA;
-
-			glBindTexture(GL_TEXTURE_2D, textureID);
-			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, uc);
-			glGenerateMipmap(GL_TEXTURE_2D);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			//stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Texture failed to load at: " << filename << std::endl;
-			stbi_image_free(uc);
-		}
-	}
+    // returns the texture at the given path, loading it only if it hasn't been loaded for this model yet
+    Texture loadTexture(const std::string &path, const std::string &typeName)
+    {
+        // files with the same contents are shared by the texture cache; this only avoids taking a second reference
+        std::string key = typeName + '|' + path;
+        std::unordered_map<std::string, Texture>::const_iterator found = textures_loaded.find(key);
+        if (found != textures_loaded.end())
+            return found->second;
+        Texture texture;
+        texture.id = textureReferences.Acquire(this->directory + '/' + path, TextureUsageFor(typeName));
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded[key] = texture;
+        return texture;
+    }
+};
 
-    return textureID;
-}
 #endif
\ No newline at end of file
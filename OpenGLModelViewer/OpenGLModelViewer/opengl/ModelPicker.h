@@ -0,0 +1,97 @@
+#ifndef MODEL_PICKER_H
+#define MODEL_PICKER_H
+
+#include <opengl/model.h>
+#include <opengl/Timing.h>
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <vector>
+
+// the result of the most recent Pick
+struct PickResult
+{
+	bool hit = false;
+	unsigned int mesh = 0;
+	unsigned int triangle = 0;
+	glm::vec3 point = glm::vec3(0.0f); // world space
+	double milliseconds = 0.0;
+};
+
+// Finds the triangle under a ray with a two-level BVH: one over the model's meshes, rebuilt from their bounds
+// whenever the geometry changes, and the per-mesh triangle BVHs built on import. The ray is taken into model
+// space once, so the model matrix never touches the hierarchies.
+class ModelPicker
+{
+public:
+	// the ray through a point of the viewport given in normalized device coordinates, in world space
+	static Ray ViewportRay(const glm::vec2& ndc, const glm::mat4& projection, const glm::mat4& view)
+	{
+		glm::mat4 inverse = glm::inverse(projection * view);
+		glm::vec4 nearPoint = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+		glm::vec4 farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+		Ray ray;
+		ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+		ray.direction = glm::vec3(farPoint) / farPoint.w - ray.origin;
+		return ray;
+	}
+
+	PickResult Pick(const Model& model, const glm::mat4& modelMatrix, const Ray& worldRay)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if (model.geometryRevision != geometryRevision)
+			build(model);
+
+		glm::mat4 inverse = glm::inverse(modelMatrix);
+		Ray ray;
+		ray.origin = glm::vec3(inverse * glm::vec4(worldRay.origin, 1.0f));
+		ray.direction = glm::vec3(inverse * glm::vec4(worldRay.direction, 0.0f));
+
+		RayHit hit;
+		meshBvh.Traverse(ray, hit, [this, &model, &ray](unsigned int first, unsigned int count, RayHit& closest)
+		{
+			for (unsigned int i = first; i < first + count; i++)
+			{
+				unsigned int mesh = meshBvh.primitives[i];
+				if (model.meshes[mesh].bvh.Intersect(ray, closest))
+					closest.mesh = mesh;
+			}
+		});
+
+		result = PickResult();
+		if (hit.Hit())
+		{
+			result.hit = true;
+			result.mesh = hit.mesh;
+			result.triangle = hit.triangle;
+			result.point = glm::vec3(modelMatrix * glm::vec4(ray.origin + ray.direction * hit.distance, 1.0f));
+		}
+		result.milliseconds = ElapsedMilliseconds(start);
+		return result;
+	}
+
+	PickResult LastPick() const { return result; }
+	double BuildMilliseconds() const { return buildMilliseconds; }
+
+private:
+	Bvh meshBvh; // over the meshes' model-space boxes
+	unsigned int geometryRevision = 0;
+	double buildMilliseconds = 0.0;
+	PickResult result;
+
+	void build(const Model& model)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::vector<glm::vec3> minima(model.meshes.size()), maxima(model.meshes.size());
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
+		{
+			minima[i] = model.meshes[i].bounds.minimum;
+			maxima[i] = model.meshes[i].bounds.maximum;
+		}
+		meshBvh.Build(minima, maxima);
+		geometryRevision = model.geometryRevision;
+		buildMilliseconds = ElapsedMilliseconds(start);
+	}
+};
+#endif
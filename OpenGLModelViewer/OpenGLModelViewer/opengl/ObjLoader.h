@@ -0,0 +1,807 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <glm/glm.hpp>
+
+#include <opengl/mesh.h>
+#include <opengl/MeshCache.h>
+#include <opengl/Simd.h>
+#include <opengl/ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Native Wavefront OBJ/MTL loader. Parses a memory-mapped file in parallel chunks and builds the deduplicated,
+// triangulated Vertex/index arrays directly (normals and tangents are generated when missing), without an aiScene.
+// Load returns false for anything it doesn't support (free-form geometry, lines, points, texture options, ...)
+// so the caller can fall back to ASSIMP.
+class ObjLoader
+{
+public:
+	// true for files the native loader should try first
+	static bool Handles(const std::string& path)
+	{
+		size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos)
+			return false;
+		std::string extension = path.substr(dot + 1);
+		for (unsigned int i = 0; i < extension.size(); i++)
+			extension[i] = (char)tolower(extension[i]);
+		return extension == "obj";
+	}
+
+	// 'fraction' receives the progress: the parsed chunks fill the first half, the built meshes the second
+	static bool Load(const std::string& path, std::vector<MeshData>& meshes, const std::atomic<bool>* cancelled = nullptr, std::atomic<float>* fraction = nullptr, unsigned int maxThreads = 0)
+	{
+		meshes.clear();
+		MappedFile file;
+		if (!file.Open(path))
+			return false;
+		const char* begin = (const char*)file.Data();
+		const char* end = begin + file.Size();
+		std::string directory = path.substr(0, path.find_last_of("/\\"));
+
+		// 1. split the file into line-aligned chunks and tokenize them in parallel
+		ThreadPool& pool = ThreadPool::Shared();
+		unsigned int threads = maxThreads == 0 ? pool.Size() + 1 : maxThreads;
+		size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads * 4, file.Size() / MIN_CHUNK_BYTES));
+		std::vector<const char*> bounds(chunkCount + 1);
+		bounds[0] = begin;
+		bounds[chunkCount] = end;
+		for (size_t i = 1; i < chunkCount; i++)
+		{
+			const char* split = std::max(bounds[i - 1], begin + file.Size() * i / chunkCount);
+			bounds[i] = (split == begin) ? begin : nextLine(split - 1, end);
+		}
+		std::vector<Chunk> chunks(chunkCount);
+		std::atomic<unsigned int> chunksParsed{ 0 };
+		pool.ParallelFor(chunkCount, [&](size_t i)
+		{
+			parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+			reportProgress(fraction, 0.5f * (float)++chunksParsed / (float)chunkCount);
+		}, threads);
+		if (isCancelled(cancelled))
+			return false;
+
+		// 2. resolve chunk-relative indices and material/smoothing state in file order
+		Geometry geometry;
+		std::vector<std::string> materialNames;
+		std::vector<std::vector<FaceRef>> meshFaces;
+		if (!mergeChunks(chunks, geometry, materialNames, meshFaces))
+			return false;
+
+		std::map<std::string, ObjMaterial> materials;
+		for (unsigned int i = 0; i < chunks.size(); i++)
+		{
+			for (unsigned int j = 0; j < chunks[i].mtllibs.size(); j++)
+			{
+				if (!loadMaterialLibrary(directory + '/' + chunks[i].mtllibs[j], materials))
+					return false;
+			}
+		}
+		if (isCancelled(cancelled))
+			return false;
+
+		// 3. build one deduplicated mesh per material, in parallel
+		meshes.resize(meshFaces.size());
+		std::atomic<unsigned int> meshesBuilt{ 0 };
+		pool.ParallelFor(meshFaces.size(), [&](size_t m)
+		{
+			if (isCancelled(cancelled))
+				return;
+			buildMesh(chunks, geometry, meshFaces[m], meshes[m]);
+			std::map<std::string, ObjMaterial>::const_iterator material = materials.find(materialNames[m]);
+			if (material != materials.end())
+				meshes[m].textures = material->second.textures;
+			reportProgress(fraction, 0.5f + 0.5f * (float)++meshesBuilt / (float)meshFaces.size());
+		}, threads);
+		return !isCancelled(cancelled);
+	}
+
+	/*  Tokenizer  */
+	// returns the start of the line after the one containing 'p'
+	static const char* nextLine(const char* p, const char* end)
+	{
+#ifdef SIMD_SSE2
+		const __m128i newline = _mm_set1_epi8('\n');
+		while (p + 16 <= end)
+		{
+			int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+			if (mask != 0)
+				return p + countTrailingZeros(mask) + 1;
+			p += 16;
+		}
+#endif
+		while (p < end && *p != '\n')
+			p++;
+		return p < end ? p + 1 : end;
+	}
+
+	// parses a decimal float ("-1.25e-3"). Digits are consumed eight at a time with SWAR arithmetic and the
+	// result is assembled with one exact floating point operation; unusual input falls back to strtod.
+	static bool parseFloat(const char*& p, const char* end, float& value)
+	{
+		const char* s = p;
+		bool negative = false;
+		if (s < end && (*s == '-' || *s == '+'))
+			negative = (*s++ == '-');
+
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		const char* integerStart = s;
+		s = parseDigits(s, end, mantissa, digits);
+		bool any = s != integerStart;
+		if (s < end && *s == '.')
+		{
+			const char* fractionStart = ++s;
+			s = parseDigits(s, end, mantissa, digits);
+			exponent -= (int)(s - fractionStart);
+			any = any || s != fractionStart;
+		}
+		if (!any)
+			return parseFloatSlow(p, end, value);
+		if (s < end && (*s == 'e' || *s == 'E'))
+		{
+			const char* e = s + 1;
+			int exponentValue = 0;
+			if (!parseInt(e, end, exponentValue))
+				return parseFloatSlow(p, end, value);
+			exponent += exponentValue;
+			s = e;
+		}
+		if (digits > 19 || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+			return parseFloatSlow(p, end, value);
+
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		double result = (double)mantissa;
+		result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+		value = (float)(negative ? -result : result);
+		p = s;
+		return true;
+	}
+
+	static bool parseInt(const char*& p, const char* end, int& value)
+	{
+		const char* s = p;
+		bool negative = false;
+		if (s < end && (*s == '-' || *s == '+'))
+			negative = (*s++ == '-');
+		uint64_t magnitude = 0;
+		int digits = 0;
+		const char* start = s;
+		s = parseDigits(s, end, magnitude, digits);
+		if (s == start || digits > 10 || magnitude > (uint64_t)INT_MAX)
+			return false;
+		value = negative ? -(int)magnitude : (int)magnitude;
+		p = s;
+		return true;
+	}
+
+private:
+	// files smaller than this aren't worth splitting any further
+	static const size_t MIN_CHUNK_BYTES = 256 * 1024;
+	// marks a missing texture coordinate / normal reference in a Corner
+	static const int MISSING = INT_MIN;
+
+	struct ObjMaterial
+	{
+		std::vector<Texture> textures;
+	};
+
+	// one face corner. Indices are zero-based and absolute when >= 0; negative values (-1 - localIndex)
+	// index the chunk's own vertices until mergeChunks resolves them.
+	struct Corner
+	{
+		int position;
+		int texCoord;
+		int normal;
+	};
+
+	struct Face
+	{
+		unsigned int firstCorner;
+		unsigned int cornerCount;
+	};
+
+	// 'usemtl' / 's' statements, applied from the given face onwards
+	struct StateChange
+	{
+		unsigned int face;
+		int material; // index into Chunk::materialNames, or -1 when only smoothing changes
+		int smooth;   // smoothing group (0 = off), or -1 when only the material changes
+	};
+
+	struct Chunk
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> texCoords;
+		std::vector<glm::vec3> normals;
+		std::vector<Corner> corners;
+		std::vector<Face> faces;
+		std::vector<StateChange> changes;
+		std::vector<std::string> materialNames;
+		std::vector<std::string> mtllibs;
+		// filled in by mergeChunks
+		std::vector<int> faceGroup;
+		bool unsupported = false;
+	};
+
+	struct Geometry
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> texCoords;
+		std::vector<glm::vec3> normals;
+	};
+
+	struct FaceRef
+	{
+		unsigned int chunk;
+		unsigned int face;
+	};
+
+	struct VertexKey
+	{
+		int position;
+		int texCoord;
+		int normal; // MISSING for smooth generated normals, -2 - faceIndex for flat generated ones
+		int group;  // smoothing group of a smooth generated normal, 0 otherwise
+
+		bool operator==(const VertexKey& other) const
+		{
+			return position == other.position && texCoord == other.texCoord && normal == other.normal && group == other.group;
+		}
+	};
+
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const
+		{
+			uint64_t h = (uint64_t)(uint32_t)key.position * 0x9E3779B97F4A7C15ULL;
+			h ^= (uint64_t)(uint32_t)key.texCoord * 0xC2B2AE3D27D4EB4FULL + (h << 6) + (h >> 2);
+			h ^= (uint64_t)(uint32_t)key.normal * 0x165667B19E3779F9ULL + (h << 6) + (h >> 2);
+			h ^= (uint64_t)(uint32_t)key.group * 0x27D4EB2F165667C5ULL + (h << 6) + (h >> 2);
+			return (size_t)h;
+		}
+	};
+
+	static bool isCancelled(const std::atomic<bool>* cancelled)
+	{
+		return cancelled != nullptr && *cancelled;
+	}
+
+	// called from the pool threads; only ever raises the value, so a late report can't move the bar back
+	static void reportProgress(std::atomic<float>* fraction, float value)
+	{
+		if (fraction == nullptr)
+			return;
+		float current = *fraction;
+		while (current < value && !fraction->compare_exchange_weak(current, value)) {}
+	}
+
+	static int countTrailingZeros(int mask)
+	{
+		int count = 0;
+		while ((mask & 1) == 0)
+		{
+			mask >>= 1;
+			count++;
+		}
+		return count;
+	}
+
+	static bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	// eight ASCII digits to their value in a handful of integer operations (little-endian load)
+	static bool parseEightDigits(const char* p, uint64_t& value)
+	{
+		uint64_t chunk;
+		std::memcpy(&chunk, p, sizeof(chunk));
+		if ((((chunk & 0xF0F0F0F0F0F0F0F0ULL) | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) != 0x3333333333333333ULL))
+			return false;
+		chunk -= 0x3030303030303030ULL;
+		chunk = (chunk * 10) + (chunk >> 8);
+		value = (((chunk & 0x000000FF000000FFULL) * 0x000F424000000064ULL) + (((chunk >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+		return true;
+	}
+
+	// accumulates a run of digits into 'value'; 'digits' counts them (beyond 19 the value is unusable)
+	static const char* parseDigits(const char* s, const char* end, uint64_t& value, int& digits)
+	{
+		uint64_t eight;
+		while (digits + 8 <= 19 && s + 8 <= end && parseEightDigits(s, eight))
+		{
+			value = value * 100000000ULL + eight;
+			digits += 8;
+			s += 8;
+		}
+		while (s < end && isDigit(*s))
+		{
+			if (digits < 19)
+				value = value * 10 + (uint64_t)(*s - '0');
+			digits++;
+			s++;
+		}
+		return s;
+	}
+
+	static bool parseFloatSlow(const char*& p, const char* end, float& value)
+	{
+		char buffer[64];
+		size_t length = 0;
+		while (p + length < end && length + 1 < sizeof(buffer) && !isSpace(p[length]))
+		{
+			buffer[length] = p[length];
+			length++;
+		}
+		buffer[length] = '\0';
+		char* parsedEnd = nullptr;
+		value = (float)strtod(buffer, &parsedEnd);
+		if (parsedEnd == buffer)
+			return false;
+		p += parsedEnd - buffer;
+		return true;
+	}
+
+	static bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	static const char* skipSpaces(const char* p, const char* lineEnd)
+	{
+		while (p < lineEnd && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	static bool startsWith(const char* p, const char* lineEnd, const char* keyword)
+	{
+		size_t length = strlen(keyword);
+		return (size_t)(lineEnd - p) >= length && std::memcmp(p, keyword, length) == 0 &&
+			((size_t)(lineEnd - p) == length || isSpace(p[length]));
+	}
+
+	// the rest of the line after the keyword, trimmed
+	// "s 3" -> 3, "s off" -> 0; anything else that isn't a number ("s on") is group 1
+	static int smoothingGroup(const std::string& group)
+	{
+		if (group == "off")
+			return 0;
+		char* end = nullptr;
+		unsigned long value = std::strtoul(group.c_str(), &end, 10);
+		if (end == group.c_str() || *end != '\0')
+			return 1;
+		return (int)std::min<unsigned long>(value, INT_MAX);
+	}
+
+	static std::string restOfLine(const char* p, const char* lineEnd, size_t keywordLength)
+	{
+		p = skipSpaces(p + keywordLength, lineEnd);
+		const char* e = lineEnd;
+		while (e > p && isSpace(e[-1]))
+			e--;
+		return std::string(p, e);
+	}
+
+	static bool parseVector(const char* p, const char* lineEnd, float* out, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			p = skipSpaces(p, lineEnd);
+			if (!parseFloat(p, lineEnd, out[i]))
+				return false;
+		}
+		return true;
+	}
+
+	// encodes an OBJ index (1-based, or negative = relative to the vertices read so far) as described for Corner.
+	// Relative indices that reach back into a previous chunk are rare enough to be left to ASSIMP.
+	static bool encodeIndex(int index, size_t localCount, int& encoded)
+	{
+		if (index > 0)
+			encoded = index - 1;
+		else if (index < 0 && (size_t)(-index) <= localCount)
+			encoded = -1 - (int)(localCount + index);
+		else
+			return false;
+		return true;
+	}
+
+	static void parseChunk(const char* p, const char* end, Chunk& chunk)
+	{
+		while (p < end && !chunk.unsupported)
+		{
+			const char* next = nextLine(p, end);
+			const char* lineEnd = next;
+			p = skipSpaces(p, lineEnd);
+			if (p < lineEnd)
+				parseLine(p, lineEnd, chunk);
+			p = next;
+		}
+	}
+
+	static void parseLine(const char* p, const char* lineEnd, Chunk& chunk)
+	{
+		switch (*p)
+		{
+		case '#':
+		case '\r':
+		case '\n':
+			return;
+		case 'v':
+			if (startsWith(p, lineEnd, "v"))
+			{
+				glm::vec3 position;
+				chunk.unsupported |= !parseVector(p + 1, lineEnd, &position.x, 3);
+				chunk.positions.push_back(position);
+			}
+			else if (startsWith(p, lineEnd, "vt"))
+			{
+				// the v coordinate is optional
+				glm::vec2 texCoord(0.0f);
+				const char* coordinate = skipSpaces(p + 2, lineEnd);
+				chunk.unsupported |= !parseFloat(coordinate, lineEnd, texCoord.x);
+				coordinate = skipSpaces(coordinate, lineEnd);
+				if (coordinate < lineEnd && !isSpace(*coordinate))
+					chunk.unsupported |= !parseFloat(coordinate, lineEnd, texCoord.y);
+				chunk.texCoords.push_back(texCoord);
+			}
+			else if (startsWith(p, lineEnd, "vn"))
+			{
+				glm::vec3 normal;
+				chunk.unsupported |= !parseVector(p + 2, lineEnd, &normal.x, 3);
+				chunk.normals.push_back(normal);
+			}
+			else
+				chunk.unsupported = true; // vp: free-form parameter space vertices
+			return;
+		case 'f':
+			if (startsWith(p, lineEnd, "f"))
+				chunk.unsupported |= !parseFace(p + 1, lineEnd, chunk);
+			else
+				chunk.unsupported = true;
+			return;
+		case 's':
+			if (startsWith(p, lineEnd, "s"))
+			{
+				StateChange change = { (unsigned int)chunk.faces.size(), -1, smoothingGroup(restOfLine(p, lineEnd, 1)) };
+				chunk.changes.push_back(change);
+			}
+			return;
+		case 'u':
+			if (startsWith(p, lineEnd, "usemtl"))
+			{
+				StateChange change = { (unsigned int)chunk.faces.size(), (int)chunk.materialNames.size(), -1 };
+				chunk.materialNames.push_back(restOfLine(p, lineEnd, 6));
+				chunk.changes.push_back(change);
+			}
+			return;
+		case 'm':
+			if (startsWith(p, lineEnd, "mtllib"))
+				chunk.mtllibs.push_back(restOfLine(p, lineEnd, 6));
+			return;
+		case 'o':
+		case 'g':
+			return; // meshes are grouped by material, like ASSIMP's OptimizeMeshes would
+		default:
+			// lines, points, curves and surfaces are left to ASSIMP; anything else is ignored like ASSIMP does
+			if (startsWith(p, lineEnd, "l") || startsWith(p, lineEnd, "p") || startsWith(p, lineEnd, "curv") ||
+				startsWith(p, lineEnd, "curv2") || startsWith(p, lineEnd, "surf") || startsWith(p, lineEnd, "cstype"))
+				chunk.unsupported = true;
+			return;
+		}
+	}
+
+	// "f v", "f v/vt", "f v//vn" or "f v/vt/vn" with three or more corners
+	static bool parseFace(const char* p, const char* lineEnd, Chunk& chunk)
+	{
+		Face face = { (unsigned int)chunk.corners.size(), 0 };
+		for (;;)
+		{
+			p = skipSpaces(p, lineEnd);
+			if (p >= lineEnd || isSpace(*p))
+				break;
+			int index;
+			Corner corner = { 0, MISSING, MISSING };
+			if (!parseInt(p, lineEnd, index) || !encodeIndex(index, chunk.positions.size(), corner.position))
+				return false;
+			if (p < lineEnd && *p == '/')
+			{
+				p++;
+				if (p < lineEnd && *p != '/')
+				{
+					if (!parseInt(p, lineEnd, index) || !encodeIndex(index, chunk.texCoords.size(), corner.texCoord))
+						return false;
+				}
+				if (p < lineEnd && *p == '/')
+				{
+					p++;
+					if (!parseInt(p, lineEnd, index) || !encodeIndex(index, chunk.normals.size(), corner.normal))
+						return false;
+				}
+			}
+			chunk.corners.push_back(corner);
+			face.cornerCount++;
+		}
+		if (face.cornerCount < 3)
+			return false;
+		chunk.faces.push_back(face);
+		return true;
+	}
+
+	// turns an encoded Corner index into an absolute one; false if it is out of range
+	static bool resolveIndex(int& index, size_t chunkBase, size_t total)
+	{
+		if (index == MISSING)
+			return true;
+		if (index < 0)
+			index = (int)(chunkBase + (size_t)(-1 - index));
+		return (size_t)index < total;
+	}
+
+	static bool mergeChunks(std::vector<Chunk>& chunks, Geometry& geometry, std::vector<std::string>& materialNames, std::vector<std::vector<FaceRef>>& meshFaces)
+	{
+		size_t positionCount = 0, texCoordCount = 0, normalCount = 0;
+		for (unsigned int i = 0; i < chunks.size(); i++)
+		{
+			if (chunks[i].unsupported)
+				return false;
+			positionCount += chunks[i].positions.size();
+			texCoordCount += chunks[i].texCoords.size();
+			normalCount += chunks[i].normals.size();
+		}
+		if (positionCount > (size_t)INT_MAX || texCoordCount > (size_t)INT_MAX || normalCount > (size_t)INT_MAX)
+			return false;
+		geometry.positions.reserve(positionCount);
+		geometry.texCoords.reserve(texCoordCount);
+		geometry.normals.reserve(normalCount);
+
+		std::map<std::string, unsigned int> meshByMaterial;
+		int currentMesh = -1;
+		int group = 1;
+		for (unsigned int c = 0; c < chunks.size(); c++)
+		{
+			Chunk& chunk = chunks[c];
+			size_t positionBase = geometry.positions.size();
+			size_t texCoordBase = geometry.texCoords.size();
+			size_t normalBase = geometry.normals.size();
+			geometry.positions.insert(geometry.positions.end(), chunk.positions.begin(), chunk.positions.end());
+			geometry.texCoords.insert(geometry.texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+			geometry.normals.insert(geometry.normals.end(), chunk.normals.begin(), chunk.normals.end());
+
+			for (unsigned int i = 0; i < chunk.corners.size(); i++)
+			{
+				Corner& corner = chunk.corners[i];
+				if (corner.position == MISSING ||
+					!resolveIndex(corner.position, positionBase, positionCount) ||
+					!resolveIndex(corner.texCoord, texCoordBase, texCoordCount) ||
+					!resolveIndex(corner.normal, normalBase, normalCount))
+					return false;
+			}
+
+			chunk.faceGroup.resize(chunk.faces.size());
+			unsigned int change = 0;
+			for (unsigned int f = 0; f < chunk.faces.size(); f++)
+			{
+				for (; change < chunk.changes.size() && chunk.changes[change].face == f; change++)
+				{
+					const StateChange& state = chunk.changes[change];
+					if (state.smooth >= 0)
+						group = state.smooth;
+					if (state.material >= 0)
+						currentMesh = meshIndex(chunk.materialNames[state.material], meshByMaterial, materialNames, meshFaces);
+				}
+				if (currentMesh < 0)
+					currentMesh = meshIndex("", meshByMaterial, materialNames, meshFaces);
+				chunk.faceGroup[f] = group;
+				FaceRef ref = { c, f };
+				meshFaces[currentMesh].push_back(ref);
+			}
+		}
+		return true;
+	}
+
+	static int meshIndex(const std::string& material, std::map<std::string, unsigned int>& meshByMaterial, std::vector<std::string>& materialNames, std::vector<std::vector<FaceRef>>& meshFaces)
+	{
+		std::map<std::string, unsigned int>::iterator it = meshByMaterial.find(material);
+		if (it != meshByMaterial.end())
+			return (int)it->second;
+		unsigned int index = (unsigned int)materialNames.size();
+		meshByMaterial[material] = index;
+		materialNames.push_back(material);
+		meshFaces.push_back(std::vector<FaceRef>());
+		return (int)index;
+	}
+
+	static void buildMesh(const std::vector<Chunk>& chunks, const Geometry& geometry, const std::vector<FaceRef>& faces, MeshData& mesh)
+	{
+		std::unordered_map<VertexKey, unsigned int, VertexKeyHash> vertexIndex;
+		vertexIndex.reserve(faces.size() * 2);
+		// accumulated normals per (position, smoothing group) for faces without explicit normals, so the
+		// groups meeting at a position keep their own normals
+		std::unordered_map<uint64_t, glm::vec3> smoothNormals;
+		bool hasTexCoords = false;
+		std::vector<unsigned int> faceVertices;
+
+		for (unsigned int f = 0; f < faces.size(); f++)
+		{
+			const Chunk& chunk = chunks[faces[f].chunk];
+			const Face& face = chunk.faces[faces[f].face];
+			const Corner* corners = &chunk.corners[face.firstCorner];
+
+			// face normal (area weighted) for corners without one
+			glm::vec3 faceNormal(0.0f);
+			for (unsigned int i = 1; i + 1 < face.cornerCount; i++)
+			{
+				const glm::vec3& p0 = geometry.positions[corners[0].position];
+				faceNormal += glm::cross(geometry.positions[corners[i].position] - p0, geometry.positions[corners[i + 1].position] - p0);
+			}
+			int group = chunk.faceGroup[faces[f].face];
+			bool smooth = group != 0;
+
+			faceVertices.clear();
+			for (unsigned int i = 0; i < face.cornerCount; i++)
+			{
+				const Corner& corner = corners[i];
+				VertexKey key = { corner.position, corner.texCoord, corner.normal, 0 };
+				if (corner.normal == MISSING && !smooth)
+					key.normal = -2 - (int)f;
+				if (corner.normal == MISSING && smooth)
+					key.group = group;
+				std::pair<std::unordered_map<VertexKey, unsigned int, VertexKeyHash>::iterator, bool> inserted =
+					vertexIndex.insert(std::make_pair(key, (unsigned int)mesh.vertices.size()));
+				if (inserted.second)
+				{
+					Vertex vertex;
+					vertex.Position = geometry.positions[corner.position];
+					vertex.Normal = corner.normal >= 0 ? geometry.normals[corner.normal] : glm::vec3(0.0f);
+					vertex.TexCoords = corner.texCoord >= 0 ? geometry.texCoords[corner.texCoord] : glm::vec2(0.0f);
+					vertex.Tangent = glm::vec3(0.0f);
+					vertex.Bitangent = glm::vec3(0.0f);
+					if (corner.normal == MISSING && !smooth)
+						vertex.Normal = faceNormal;
+					mesh.vertices.push_back(vertex);
+				}
+				if (corner.normal == MISSING && smooth)
+					smoothNormals[smoothKey(corner.position, group)] += faceNormal;
+				hasTexCoords = hasTexCoords || corner.texCoord >= 0;
+				faceVertices.push_back(inserted.first->second);
+			}
+
+			// triangulate as a fan
+			for (unsigned int i = 1; i + 1 < faceVertices.size(); i++)
+			{
+				mesh.indices.push_back(faceVertices[0]);
+				mesh.indices.push_back(faceVertices[i]);
+				mesh.indices.push_back(faceVertices[i + 1]);
+			}
+		}
+
+		// finish generated normals
+		for (std::unordered_map<VertexKey, unsigned int, VertexKeyHash>::const_iterator it = vertexIndex.begin(); it != vertexIndex.end(); ++it)
+		{
+			Vertex& vertex = mesh.vertices[it->second];
+			if (it->first.normal == MISSING)
+				vertex.Normal = smoothNormals[smoothKey(it->first.position, it->first.group)];
+			if (it->first.normal < 0)
+				vertex.Normal = safeNormalize(vertex.Normal);
+		}
+
+		if (hasTexCoords)
+			calcTangentSpace(mesh);
+	}
+
+	static uint64_t smoothKey(int position, int group)
+	{
+		return ((uint64_t)(uint32_t)position << 32) | (uint32_t)group;
+	}
+
+	static glm::vec3 safeNormalize(const glm::vec3& v)
+	{
+		float length = glm::length(v);
+		return length > 1e-20f ? v / length : glm::vec3(0.0f);
+	}
+
+	// per-triangle tangent frames accumulated on the shared vertices, then orthogonalized against the normal
+	static void calcTangentSpace(MeshData& mesh)
+	{
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			Vertex& v0 = mesh.vertices[mesh.indices[i]];
+			Vertex& v1 = mesh.vertices[mesh.indices[i + 1]];
+			Vertex& v2 = mesh.vertices[mesh.indices[i + 2]];
+			glm::vec3 edge1 = v1.Position - v0.Position;
+			glm::vec3 edge2 = v2.Position - v0.Position;
+			glm::vec2 deltaUV1 = v1.TexCoords - v0.TexCoords;
+			glm::vec2 deltaUV2 = v2.TexCoords - v0.TexCoords;
+			float determinant = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+			if (std::fabs(determinant) < 1e-20f)
+				continue;
+			float r = 1.0f / determinant;
+			glm::vec3 tangent = (edge1 * deltaUV2.y - edge2 * deltaUV1.y) * r;
+			glm::vec3 bitangent = (edge2 * deltaUV1.x - edge1 * deltaUV2.x) * r;
+			v0.Tangent += tangent; v1.Tangent += tangent; v2.Tangent += tangent;
+			v0.Bitangent += bitangent; v1.Bitangent += bitangent; v2.Bitangent += bitangent;
+		}
+		for (size_t i = 0; i < mesh.vertices.size(); i++)
+		{
+			Vertex& vertex = mesh.vertices[i];
+			const glm::vec3& n = vertex.Normal;
+			vertex.Tangent = safeNormalize(vertex.Tangent - n * glm::dot(n, vertex.Tangent));
+			vertex.Bitangent = safeNormalize(vertex.Bitangent - n * glm::dot(n, vertex.Bitangent) - vertex.Tangent * glm::dot(vertex.Tangent, vertex.Bitangent));
+		}
+	}
+
+	// reads the texture maps of every material in an MTL file. Texture options ("-bm 0.5 ...") are not supported.
+	static bool loadMaterialLibrary(const std::string& path, std::map<std::string, ObjMaterial>& materials)
+	{
+		MappedFile file;
+		if (!file.Open(path))
+			return true; // like ASSIMP, a missing material library only means untextured meshes
+		const char* p = (const char*)file.Data();
+		const char* end = p + file.Size();
+
+		ObjMaterial* material = nullptr;
+		// the same texture slots, names and order Model::processMesh uses for ASSIMP materials
+		static const char* const keywords[] = { "map_Kd", "map_Ks", "map_Bump", "bump", "map_Ka" };
+		static const char* const types[] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_normal", "texture_height" };
+		static const unsigned int slotOf[] = { 0, 1, 2, 2, 3 };
+		std::vector<Texture> slots[4];
+		std::string materialName;
+
+		for (;;)
+		{
+			const char* next = (p < end) ? nextLine(p, end) : end;
+			const char* lineEnd = next;
+			const char* line = skipSpaces(p, lineEnd);
+			bool newMaterial = line < lineEnd && startsWith(line, lineEnd, "newmtl");
+			if (p >= end || newMaterial)
+			{
+				if (material != nullptr)
+				{
+					material->textures.clear();
+					for (unsigned int s = 0; s < 4; s++)
+						material->textures.insert(material->textures.end(), slots[s].begin(), slots[s].end());
+				}
+				if (p >= end)
+					break;
+				material = &materials[restOfLine(line, lineEnd, 6)];
+				for (unsigned int s = 0; s < 4; s++)
+					slots[s].clear();
+			}
+			else if (material != nullptr && line < lineEnd)
+			{
+				for (unsigned int k = 0; k < 5; k++)
+				{
+					if (!startsWith(line, lineEnd, keywords[k]))
+						continue;
+					Texture texture;
+					texture.id = 0;
+					texture.type = types[k];
+					texture.path = restOfLine(line, lineEnd, strlen(keywords[k]));
+					if (texture.path.empty() || texture.path[0] == '-')
+						return false;
+					slots[slotOf[k]].push_back(texture);
+					break;
+				}
+			}
+			p = next;
+		}
+		return true;
+	}
+};
+#endif
@@ -0,0 +1,372 @@
+#ifndef OCCLUSION_BUFFER_H
+#define OCCLUSION_BUFFER_H
+
+#include <opengl/Simd.h>
+#include <opengl/ThreadPool.h>
+#include <opengl/Timing.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+// clip-space w below which a vertex counts as behind the camera
+const float OCCLUSION_NEAR_W = 1e-5f;
+// how much nearer than its nearest corner a box is tested, so a mesh is not hidden behind its own surface
+const float OCCLUSION_DEPTH_BIAS = 1e-4f;
+// occluder triangles reaching further off screen than this many pixels are dropped, which keeps the edge
+// functions precise
+const float OCCLUSION_GUARD_BAND = 2048.0f;
+
+// triangles to rasterize into the occlusion buffer: 'triangleCount' * 3 corners, as TriangleBvh::Corners keeps them
+struct Occluder
+{
+	const glm::vec3* corners;
+	size_t triangleCount;
+	glm::mat4 modelViewProjection;
+};
+
+// counters and timing of the most recent OcclusionBuffer::Render call
+struct OcclusionRasterStats
+{
+	unsigned int occluders = 0;
+	unsigned int occluderTriangles = 0;
+	unsigned int rasterizedTriangles = 0; // after rejecting triangles that are off screen or cross the near plane
+	double milliseconds = 0.0;
+};
+
+// A small CPU depth buffer that occluder triangles are rasterized into and boxes are tested against. It holds
+// 1/w, which is linear in screen space and larger for nearer surfaces, so a pixel no occluder covers is 0.
+// Triangles are set up in parallel chunks, then each screen tile is rasterized by one thread, four pixels at a
+// time with SSE, and reduced to 8x8 blocks holding the smallest (farthest) depth in the block. Works on plain
+// triangles and matrices only, so it can be checked without a GPU or a model (see tests/OcclusionBufferTest.cpp).
+class OcclusionBuffer
+{
+public:
+	static const unsigned int WIDTH = 256;
+	static const unsigned int HEIGHT = 128;
+	static const unsigned int TILE_WIDTH = 64;
+	static const unsigned int TILE_HEIGHT = 32;
+	static const unsigned int BLOCK_SIZE = 8;
+
+	OcclusionBuffer()
+		: depth(WIDTH * HEIGHT, 0.0f), blockDepth(BLOCKS_X * BLOCKS_Y, 0.0f)
+	{
+	}
+
+	// clears the buffer and rasterizes the occluders into it
+	void Render(const std::vector<Occluder>& occluderList)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		// split into chunks of triangles, each set up by one task into its own range of 'triangles'
+		const size_t CHUNK_TRIANGLES = 4096;
+		chunks.clear();
+		size_t total = 0;
+		for (unsigned int o = 0; o < occluderList.size(); o++)
+		{
+			for (size_t first = 0; first < occluderList[o].triangleCount; first += CHUNK_TRIANGLES)
+			{
+				Chunk chunk;
+				chunk.occluder = o;
+				chunk.first = first;
+				chunk.count = std::min(CHUNK_TRIANGLES, occluderList[o].triangleCount - first);
+				chunk.offset = total;
+				chunk.valid = 0;
+				chunks.push_back(chunk);
+				total += chunk.count;
+			}
+		}
+		triangles.resize(total);
+		ThreadPool::Shared().ParallelFor(chunks.size(), [this, &occluderList](size_t c)
+		{
+			setupChunk(occluderList[chunks[c].occluder], chunks[c]);
+		});
+
+		ThreadPool::Shared().ParallelFor(TILES_X * TILES_Y, [this](size_t tile)
+		{
+			rasterizeTile((unsigned int)tile);
+		});
+
+		stats.occluders = (unsigned int)occluderList.size();
+		stats.occluderTriangles = (unsigned int)total;
+		stats.rasterizedTriangles = 0;
+		for (unsigned int c = 0; c < chunks.size(); c++)
+			stats.rasterizedTriangles += (unsigned int)chunks[c].valid;
+		stats.milliseconds = ElapsedMilliseconds(start);
+	}
+
+	// whether the box is behind the occluders at every pixel it covers. Boxes crossing the near plane or off
+	// screen are never occluded; leaving those out is the frustum culler's job.
+	bool IsOccluded(const glm::vec3& minimum, const glm::vec3& maximum, const glm::mat4& modelViewProjection) const
+	{
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = 0.0f;
+		for (unsigned int c = 0; c < 8; c++)
+		{
+			glm::vec3 corner((c & 1) ? maximum.x : minimum.x, (c & 2) ? maximum.y : minimum.y, (c & 4) ? maximum.z : minimum.z);
+			glm::vec4 clip = modelViewProjection * glm::vec4(corner, 1.0f);
+			if (clip.w < OCCLUSION_NEAR_W || clip.z < -clip.w)
+				return false;
+			float inverseW = 1.0f / clip.w;
+			glm::vec2 screen = toScreen(clip, inverseW);
+			minX = std::min(minX, screen.x);
+			maxX = std::max(maxX, screen.x);
+			minY = std::min(minY, screen.y);
+			maxY = std::max(maxY, screen.y);
+			nearest = std::max(nearest, inverseW);
+		}
+		if (maxX < 0.0f || maxY < 0.0f || minX >= (float)WIDTH || minY >= (float)HEIGHT)
+			return false;
+		int x0 = std::max(0, (int)std::floor(minX)), x1 = std::min((int)WIDTH - 1, (int)std::floor(maxX));
+		int y0 = std::max(0, (int)std::floor(minY)), y1 = std::min((int)HEIGHT - 1, (int)std::floor(maxY));
+		float threshold = nearest * (1.0f + OCCLUSION_DEPTH_BIAS);
+
+		for (int by = y0 / (int)BLOCK_SIZE; by <= y1 / (int)BLOCK_SIZE; by++)
+		{
+			for (int bx = x0 / (int)BLOCK_SIZE; bx <= x1 / (int)BLOCK_SIZE; bx++)
+			{
+				if (blockDepth[by * BLOCKS_X + bx] > threshold)
+					continue;
+				int pixelX1 = std::min(x1, (bx + 1) * (int)BLOCK_SIZE - 1), pixelY1 = std::min(y1, (by + 1) * (int)BLOCK_SIZE - 1);
+				for (int y = std::max(y0, by * (int)BLOCK_SIZE); y <= pixelY1; y++)
+				{
+					for (int x = std::max(x0, bx * (int)BLOCK_SIZE); x <= pixelX1; x++)
+					{
+						if (depth[y * WIDTH + x] <= threshold)
+							return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	// 1/w per pixel, row 0 at the top of the screen; 0 where no occluder was drawn
+	const std::vector<float>& Depth() const { return depth; }
+	// the farthest depth in each 8x8 block
+	const std::vector<float>& BlockDepth() const { return blockDepth; }
+	OcclusionRasterStats Stats() const { return stats; }
+
+	// the buffer as a WIDTH x HEIGHT RGBA image for display, nearer surfaces brighter
+	void DebugImage(std::vector<unsigned char>& rgba) const
+	{
+		float nearest = 0.0f;
+		for (unsigned int i = 0; i < depth.size(); i++)
+			nearest = std::max(nearest, depth[i]);
+		rgba.resize(depth.size() * 4);
+		for (unsigned int i = 0; i < depth.size(); i++)
+		{
+			unsigned char value = nearest > 0.0f ? (unsigned char)(255.0f * depth[i] / nearest) : 0;
+			rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = value;
+			rgba[i * 4 + 3] = 255;
+		}
+	}
+
+private:
+	static const unsigned int TILES_X = WIDTH / TILE_WIDTH;
+	static const unsigned int TILES_Y = HEIGHT / TILE_HEIGHT;
+	static const unsigned int BLOCKS_X = WIDTH / BLOCK_SIZE;
+	static const unsigned int BLOCKS_Y = HEIGHT / BLOCK_SIZE;
+	// a triangle ready to rasterize: edge functions a * x + b * y + c that are >= 0 inside, the depth plane,
+	// the pixel bounds and a bit per screen tile it overlaps
+	struct SetupTriangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		int minX, minY, maxX, maxY;
+		unsigned int tiles;
+	};
+
+	struct Chunk
+	{
+		unsigned int occluder;
+		size_t first, count;
+		size_t offset; // of the chunk's range in 'triangles'
+		size_t valid;  // triangles that survived setup, at the start of the range
+	};
+
+	std::vector<float> depth;
+	std::vector<float> blockDepth;
+	std::vector<SetupTriangle> triangles;
+	std::vector<Chunk> chunks;
+	OcclusionRasterStats stats;
+
+	static glm::vec2 toScreen(const glm::vec4& clip, float inverseW)
+	{
+		return glm::vec2((clip.x * inverseW * 0.5f + 0.5f) * WIDTH, (0.5f - clip.y * inverseW * 0.5f) * HEIGHT);
+	}
+
+	void setupChunk(const Occluder& occluder, Chunk& chunk)
+	{
+		SetupTriangle* out = &triangles[chunk.offset];
+		size_t valid = 0;
+		for (size_t t = chunk.first; t < chunk.first + chunk.count; t++)
+		{
+			glm::vec2 screen[3];
+			float inverseW[3];
+			bool rejected = false;
+			for (unsigned int k = 0; k < 3 && !rejected; k++)
+			{
+				glm::vec4 clip = occluder.modelViewProjection * glm::vec4(occluder.corners[t * 3 + k], 1.0f);
+				// triangles crossing the near plane are dropped rather than clipped; they only cost occlusion
+				if (clip.w < OCCLUSION_NEAR_W || clip.z < -clip.w)
+				{
+					rejected = true;
+					break;
+				}
+				inverseW[k] = 1.0f / clip.w;
+				screen[k] = toScreen(clip, inverseW[k]);
+				rejected = std::fabs(screen[k].x) > OCCLUSION_GUARD_BAND || std::fabs(screen[k].y) > OCCLUSION_GUARD_BAND;
+			}
+			if (rejected)
+				continue;
+
+			glm::vec2 low = glm::min(screen[0], glm::min(screen[1], screen[2]));
+			glm::vec2 high = glm::max(screen[0], glm::max(screen[1], screen[2]));
+			SetupTriangle& triangle = out[valid];
+			triangle.minX = std::max(0, (int)std::floor(low.x));
+			triangle.minY = std::max(0, (int)std::floor(low.y));
+			triangle.maxX = std::min((int)WIDTH - 1, (int)std::floor(high.x));
+			triangle.maxY = std::min((int)HEIGHT - 1, (int)std::floor(high.y));
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+				continue;
+
+			// edge k is opposite corner k, so edge k over the area is that corner's barycentric weight
+			float area = 0.0f;
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				const glm::vec2& from = screen[(k + 1) % 3];
+				const glm::vec2& to = screen[(k + 2) % 3];
+				triangle.edgeA[k] = from.y - to.y;
+				triangle.edgeB[k] = to.x - from.x;
+				triangle.edgeC[k] = from.x * to.y - from.y * to.x;
+			}
+			area = triangle.edgeA[0] * screen[0].x + triangle.edgeB[0] * screen[0].y + triangle.edgeC[0];
+			if (std::fabs(area) < 1e-8f)
+				continue;
+			triangle.depthA = triangle.depthB = triangle.depthC = 0.0f;
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				triangle.depthA += triangle.edgeA[k] * inverseW[k] / area;
+				triangle.depthB += triangle.edgeB[k] * inverseW[k] / area;
+				triangle.depthC += triangle.edgeC[k] * inverseW[k] / area;
+			}
+			// both windings are occluders
+			if (area < 0.0f)
+			{
+				for (unsigned int k = 0; k < 3; k++)
+				{
+					triangle.edgeA[k] = -triangle.edgeA[k];
+					triangle.edgeB[k] = -triangle.edgeB[k];
+					triangle.edgeC[k] = -triangle.edgeC[k];
+				}
+			}
+
+			triangle.tiles = 0;
+			for (int ty = triangle.minY / (int)TILE_HEIGHT; ty <= triangle.maxY / (int)TILE_HEIGHT; ty++)
+			{
+				for (int tx = triangle.minX / (int)TILE_WIDTH; tx <= triangle.maxX / (int)TILE_WIDTH; tx++)
+					triangle.tiles |= 1u << (ty * TILES_X + tx);
+			}
+			valid++;
+		}
+		chunk.valid = valid;
+	}
+
+	// clears the tile, draws the triangles overlapping it and updates its blocks; touches no other tile's pixels
+	void rasterizeTile(unsigned int tile)
+	{
+		int tileX0 = (int)((tile % TILES_X) * TILE_WIDTH), tileY0 = (int)((tile / TILES_X) * TILE_HEIGHT);
+		int tileX1 = tileX0 + (int)TILE_WIDTH - 1, tileY1 = tileY0 + (int)TILE_HEIGHT - 1;
+		for (int y = tileY0; y <= tileY1; y++)
+			std::fill(depth.begin() + y * WIDTH + tileX0, depth.begin() + y * WIDTH + tileX1 + 1, 0.0f);
+
+		unsigned int bit = 1u << tile;
+		for (unsigned int c = 0; c < chunks.size(); c++)
+		{
+			const SetupTriangle* chunkTriangles = &triangles[chunks[c].offset];
+			for (size_t t = 0; t < chunks[c].valid; t++)
+			{
+				if (chunkTriangles[t].tiles & bit)
+					rasterizeTriangle(chunkTriangles[t], std::max(chunkTriangles[t].minX, tileX0), std::max(chunkTriangles[t].minY, tileY0),
+						std::min(chunkTriangles[t].maxX, tileX1), std::min(chunkTriangles[t].maxY, tileY1));
+			}
+		}
+
+		for (int by = tileY0 / (int)BLOCK_SIZE; by <= tileY1 / (int)BLOCK_SIZE; by++)
+		{
+			for (int bx = tileX0 / (int)BLOCK_SIZE; bx <= tileX1 / (int)BLOCK_SIZE; bx++)
+			{
+				float farthest = FLT_MAX;
+				for (int y = by * (int)BLOCK_SIZE; y < (by + 1) * (int)BLOCK_SIZE; y++)
+				{
+					for (int x = bx * (int)BLOCK_SIZE; x < (bx + 1) * (int)BLOCK_SIZE; x++)
+						farthest = std::min(farthest, depth[y * WIDTH + x]);
+				}
+				blockDepth[by * BLOCKS_X + bx] = farthest;
+			}
+		}
+	}
+
+	// keeps the nearer depth at every pixel center of [x0, x1] x [y0, y1] inside the triangle
+	void rasterizeTriangle(const SetupTriangle& triangle, int x0, int y0, int x1, int y1)
+	{
+#ifdef SIMD_SSE
+		// whole groups of four from a multiple of four; tiles are a multiple of four wide, so they stay in the tile
+		x0 &= ~3;
+		const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		__m128 edgeA[3], edgeStep[3];
+		for (unsigned int k = 0; k < 3; k++)
+		{
+			edgeA[k] = _mm_set1_ps(triangle.edgeA[k]);
+			edgeStep[k] = _mm_set1_ps(triangle.edgeA[k] * 4.0f);
+		}
+		__m128 depthStep = _mm_set1_ps(triangle.depthA * 4.0f);
+		__m128 zero = _mm_setzero_ps();
+		for (int y = y0; y <= y1; y++)
+		{
+			float centerY = y + 0.5f;
+			__m128 x = _mm_add_ps(_mm_set1_ps((float)x0), offsets);
+			__m128 edge[3];
+			for (unsigned int k = 0; k < 3; k++)
+				edge[k] = _mm_add_ps(_mm_mul_ps(edgeA[k], x), _mm_set1_ps(triangle.edgeB[k] * centerY + triangle.edgeC[k]));
+			__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthA), x), _mm_set1_ps(triangle.depthB * centerY + triangle.depthC));
+			float* row = &depth[y * WIDTH];
+			for (int px = x0; px <= x1; px += 4)
+			{
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)), _mm_cmpge_ps(edge[2], zero));
+				if (_mm_movemask_ps(inside))
+				{
+					__m128 current = _mm_loadu_ps(row + px);
+					__m128 nearer = _mm_max_ps(current, z);
+					_mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+				}
+				for (unsigned int k = 0; k < 3; k++)
+					edge[k] = _mm_add_ps(edge[k], edgeStep[k]);
+				z = _mm_add_ps(z, depthStep);
+			}
+		}
+#else
+		// reference version, used on targets without SSE
+		for (int y = y0; y <= y1; y++)
+		{
+			float centerY = y + 0.5f;
+			for (int x = x0; x <= x1; x++)
+			{
+				float centerX = x + 0.5f;
+				bool inside = true;
+				for (unsigned int k = 0; k < 3 && inside; k++)
+					inside = triangle.edgeA[k] * centerX + triangle.edgeB[k] * centerY + triangle.edgeC[k] >= 0.0f;
+				if (!inside)
+					continue;
+				float z = triangle.depthA * centerX + triangle.depthB * centerY + triangle.depthC;
+				float& pixel = depth[y * WIDTH + x];
+				pixel = std::max(pixel, z);
+			}
+		}
+#endif
+	}
+};
+#endif
@@ -0,0 +1,128 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <opengl/model.h>
+#include <opengl/OcclusionBuffer.h>
+#include <opengl/ThreadPool.h>
+#include <opengl/Timing.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+// counters and timings of the most recent Cull call
+struct OcclusionStats
+{
+	unsigned int tested = 0;
+	unsigned int occluded = 0;
+	unsigned int occluders = 0;
+	unsigned int occluderTriangles = 0;
+	unsigned int rasterizedTriangles = 0; // after rejecting triangles that are off screen or cross the near plane
+	double rasterMilliseconds = 0.0;
+	double testMilliseconds = 0.0;
+};
+
+// Software occlusion culling. The largest meshes on screen are rasterized as occluders into an OcclusionBuffer,
+// then the box of every other mesh is tested against it. Makes no GL calls.
+class OcclusionCuller
+{
+public:
+	// meshes become occluders by their angular size (bounding radius over view depth), largest first, until
+	// their triangles would exceed the budget
+	unsigned int OccluderTriangleBudget = 100000;
+	float MinimumOccluderSize = 0.1f;
+
+	// the meshes of 'visible' (all if null) that are not hidden by the model's largest meshes, one flag per mesh
+	const std::vector<unsigned char>& Cull(const Model& model, const glm::mat4& modelMatrix, const glm::mat4& viewProjection, const unsigned char* visible = nullptr)
+	{
+		unsigned int count = (unsigned int)model.meshes.size();
+		glm::mat4 modelViewProjection = viewProjection * modelMatrix;
+		selectOccluders(model, modelMatrix, modelViewProjection, visible);
+		buffer.Render(occluders);
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		result.resize(count);
+		for (unsigned int i = 0; i < count; i++)
+			result[i] = visible == nullptr || visible[i] ? 1 : 0;
+		const unsigned int TEST_CHUNK = 64;
+		ThreadPool::Shared().ParallelFor((count + TEST_CHUNK - 1) / TEST_CHUNK, [this, &model, &modelViewProjection, count, TEST_CHUNK](size_t chunk)
+		{
+			unsigned int end = std::min(count, (unsigned int)(chunk + 1) * TEST_CHUNK);
+			for (unsigned int i = (unsigned int)chunk * TEST_CHUNK; i < end; i++)
+			{
+				if (result[i] && buffer.IsOccluded(model.meshes[i].bounds.minimum, model.meshes[i].bounds.maximum, modelViewProjection))
+					result[i] = 0;
+			}
+		});
+		stats.tested = stats.occluded = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			bool tested = visible == nullptr || visible[i];
+			stats.tested += tested;
+			stats.occluded += tested && !result[i];
+		}
+		stats.testMilliseconds = ElapsedMilliseconds(start);
+		return result;
+	}
+
+	const std::vector<unsigned char>& Visibility() const { return result; }
+	// the depth buffer the occluders were drawn into, e.g. for DebugImage
+	const OcclusionBuffer& Buffer() const { return buffer; }
+
+	OcclusionStats Stats() const
+	{
+		OcclusionStats combined = stats;
+		OcclusionRasterStats raster = buffer.Stats();
+		combined.occluders = raster.occluders;
+		combined.occluderTriangles = raster.occluderTriangles;
+		combined.rasterizedTriangles = raster.rasterizedTriangles;
+		combined.rasterMilliseconds = raster.milliseconds;
+		return combined;
+	}
+
+private:
+	OcclusionBuffer buffer;
+	std::vector<Occluder> occluders;
+	std::vector<std::pair<float, unsigned int> > candidates; // angular size, mesh
+	std::vector<unsigned char> result;
+	OcclusionStats stats;
+
+	void selectOccluders(const Model& model, const glm::mat4& modelMatrix, const glm::mat4& modelViewProjection, const unsigned char* visible)
+	{
+		glm::mat3 linear(modelMatrix);
+		float scale = std::max(glm::length(linear[0]), std::max(glm::length(linear[1]), glm::length(linear[2])));
+		candidates.clear();
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
+		{
+			const Mesh& mesh = model.meshes[i];
+			if ((visible != nullptr && !visible[i]) || mesh.bvh.Empty())
+				continue;
+			float w = (modelViewProjection * glm::vec4(mesh.bounds.center, 1.0f)).w;
+			float radius = mesh.bounds.radius * scale;
+			float size = w > radius ? radius / w : 1.0f;
+			if (size >= MinimumOccluderSize)
+				candidates.push_back(std::make_pair(size, i));
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, unsigned int>& a, const std::pair<float, unsigned int>& b)
+		{
+			return a.first > b.first;
+		});
+
+		occluders.clear();
+		size_t budget = OccluderTriangleBudget;
+		for (unsigned int c = 0; c < candidates.size(); c++)
+		{
+			const std::vector<glm::vec3>& corners = model.meshes[candidates[c].second].bvh.Corners();
+			size_t triangleCount = corners.size() / 3;
+			if (triangleCount > budget)
+				continue;
+			budget -= triangleCount;
+			Occluder occluder = { &corners[0], triangleCount, modelViewProjection };
+			occluders.push_back(occluder);
+		}
+	}
+};
+#endif
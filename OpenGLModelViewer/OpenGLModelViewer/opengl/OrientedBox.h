@@ -0,0 +1,233 @@
+#ifndef ORIENTED_BOX_H
+#define ORIENTED_BOX_H
+
+#include <glm/glm.hpp>
+
+#include <Eigen/Eigenvalues>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// A box with arbitrary orthonormal axes. Built from a mesh's vertices by PCA: the eigenvectors of the position
+// covariance give the initial axes, then each pair of axes is turned to the minimum-area rectangle around the
+// convex hull of the points projected onto their plane (rotating calipers), which removes most of the bias
+// PCA has towards densely tessellated regions. Never larger than the axis-aligned box, which it falls back to.
+struct OrientedBox
+{
+	glm::vec3 center = glm::vec3(0.0f);
+	glm::vec3 axes[3] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+	glm::vec3 halfExtents = glm::vec3(0.0f);
+
+	float Volume() const { return 8.0f * halfExtents.x * halfExtents.y * halfExtents.z; }
+
+	// the box under an affine transform. Exact for rotations and scales along the box axes; otherwise the result
+	// keeps the transformed axes' directions and lengths, which is what culling and collision tests need.
+	OrientedBox Transformed(const glm::mat4& transform) const
+	{
+		OrientedBox box;
+		box.center = glm::vec3(transform * glm::vec4(center, 1.0f));
+		glm::mat3 linear(transform);
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			glm::vec3 axis = linear * axes[i];
+			float length = glm::length(axis);
+			box.axes[i] = length > 0.0f ? axis / length : axes[i];
+			box.halfExtents[i] = halfExtents[i] * length;
+		}
+		return box;
+	}
+
+	// separating axis test against another box in the same space: the 3 + 3 face normals and their 9 cross products
+	bool Intersects(const OrientedBox& other) const
+	{
+		glm::vec3 offset = other.center - center;
+		glm::vec3 candidates[15];
+		unsigned int count = 0;
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			candidates[count++] = axes[i];
+			candidates[count++] = other.axes[i];
+			for (unsigned int j = 0; j < 3; j++)
+				candidates[count++] = glm::cross(axes[i], other.axes[j]);
+		}
+		for (unsigned int c = 0; c < count; c++)
+		{
+			const glm::vec3& axis = candidates[c];
+			if (glm::dot(axis, axis) < 1e-10f)
+				continue; // parallel edges; covered by the face normals
+			if (std::fabs(glm::dot(offset, axis)) > ProjectedRadius(axis) + other.ProjectedRadius(axis))
+				return false;
+		}
+		return true;
+	}
+
+	// half the length of the box's projection onto 'direction', scaled by its length
+	float ProjectedRadius(const glm::vec3& direction) const
+	{
+		return std::fabs(glm::dot(direction, axes[0])) * halfExtents.x + std::fabs(glm::dot(direction, axes[1])) * halfExtents.y + std::fabs(glm::dot(direction, axes[2])) * halfExtents.z;
+	}
+
+	// fits a box to 'count' positions that are 'stride' bytes apart, e.g. the Position member of a vertex array
+	static OrientedBox FromPoints(const glm::vec3* positions, size_t count, size_t stride)
+	{
+		OrientedBox box;
+		if (count == 0)
+			return box;
+		const char* base = reinterpret_cast<const char*>(positions);
+
+		// covariance of the positions around their mean, in double since the sums are large
+		Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+		for (size_t i = 0; i < count; i++)
+			mean += toEigen(point(base, stride, i));
+		mean /= (double)count;
+		Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+		for (size_t i = 0; i < count; i++)
+		{
+			Eigen::Vector3d offset = toEigen(point(base, stride, i)) - mean;
+			covariance += offset * offset.transpose();
+		}
+		covariance /= (double)count;
+
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+		OrientedBox best = box.fit(base, stride, count); // the axis-aligned box
+		if (solver.info() == Eigen::Success)
+		{
+			Eigen::Matrix3d vectors = solver.eigenvectors();
+			for (unsigned int i = 0; i < 3; i++)
+				box.axes[i] = glm::normalize(glm::vec3((float)vectors(0, i), (float)vectors(1, i), (float)vectors(2, i)));
+			box.axes[2] = glm::normalize(glm::cross(box.axes[0], box.axes[1])); // exactly orthonormal
+			box.axes[1] = glm::cross(box.axes[2], box.axes[0]);
+			box = box.fit(base, stride, count);
+			box.refine(base, stride, count);
+			if (box.Volume() < best.Volume())
+				best = box;
+		}
+		return best;
+	}
+
+private:
+	static const glm::vec3& point(const char* base, size_t stride, size_t i)
+	{
+		return *reinterpret_cast<const glm::vec3*>(base + i * stride);
+	}
+
+	static Eigen::Vector3d toEigen(const glm::vec3& v)
+	{
+		return Eigen::Vector3d(v.x, v.y, v.z);
+	}
+
+	// this box's axes with the center and extents that enclose the points
+	OrientedBox fit(const char* base, size_t stride, size_t count) const
+	{
+		glm::vec3 minimum(0.0f), maximum(0.0f);
+		for (size_t i = 0; i < count; i++)
+		{
+			const glm::vec3& p = point(base, stride, i);
+			glm::vec3 projected(glm::dot(p, axes[0]), glm::dot(p, axes[1]), glm::dot(p, axes[2]));
+			minimum = i == 0 ? projected : glm::min(minimum, projected);
+			maximum = i == 0 ? projected : glm::max(maximum, projected);
+		}
+		OrientedBox box = *this;
+		glm::vec3 middle = (minimum + maximum) * 0.5f;
+		box.center = axes[0] * middle.x + axes[1] * middle.y + axes[2] * middle.z;
+		box.halfExtents = (maximum - minimum) * 0.5f;
+		return box;
+	}
+
+	// keeps each axis in turn and rotates the other two to the smallest rectangle around the 2D hull of the
+	// points projected onto their plane
+	void refine(const char* base, size_t stride, size_t count)
+	{
+		std::vector<glm::vec2> projected(count);
+		std::vector<glm::vec2> hull;
+		for (unsigned int fixed = 0; fixed < 3; fixed++)
+		{
+			glm::vec3 u = axes[(fixed + 1) % 3], v = axes[(fixed + 2) % 3];
+			for (size_t i = 0; i < count; i++)
+			{
+				const glm::vec3& p = point(base, stride, i);
+				projected[i] = glm::vec2(glm::dot(p, u), glm::dot(p, v));
+			}
+			convexHull(projected, hull);
+			glm::vec2 direction;
+			if (!minimumRectangle(hull, direction))
+				continue;
+			OrientedBox candidate = *this;
+			candidate.axes[(fixed + 1) % 3] = glm::normalize(u * direction.x + v * direction.y);
+			candidate.axes[(fixed + 2) % 3] = glm::cross(axes[fixed], candidate.axes[(fixed + 1) % 3]);
+			candidate = candidate.fit(base, stride, count);
+			if (candidate.Volume() < Volume())
+				*this = candidate;
+		}
+	}
+
+	// Andrew's monotone chain; sorts 'points' in place and writes the hull counter-clockwise
+	static void convexHull(std::vector<glm::vec2>& points, std::vector<glm::vec2>& hull)
+	{
+		if (points.size() < 3)
+		{
+			hull = points;
+			return;
+		}
+		std::sort(points.begin(), points.end(), [](const glm::vec2& a, const glm::vec2& b)
+		{
+			return a.x < b.x || (a.x == b.x && a.y < b.y);
+		});
+		hull.assign(2 * points.size(), glm::vec2(0.0f));
+		size_t k = 0;
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0f)
+				k--;
+			hull[k++] = points[i];
+		}
+		for (size_t i = points.size() - 1, lower = k + 1; i-- > 0;)
+		{
+			while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0f)
+				k--;
+			hull[k++] = points[i];
+		}
+		hull.resize(k > 1 ? k - 1 : k);
+	}
+
+	static float cross(const glm::vec2& o, const glm::vec2& a, const glm::vec2& b)
+	{
+		return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+	}
+
+	// the minimum-area enclosing rectangle has a side on a hull edge; returns that edge's direction
+	static bool minimumRectangle(const std::vector<glm::vec2>& hull, glm::vec2& direction)
+	{
+		if (hull.size() < 3)
+			return false;
+		float bestArea = -1.0f;
+		for (size_t e = 0; e < hull.size(); e++)
+		{
+			glm::vec2 edge = hull[(e + 1) % hull.size()] - hull[e];
+			float length = glm::length(edge);
+			if (length <= 0.0f)
+				continue;
+			edge /= length;
+			glm::vec2 normal(-edge.y, edge.x);
+			float minimumU = 0.0f, maximumU = 0.0f, maximumV = 0.0f; // the hull lies on the normal's side of the edge
+			for (size_t i = 0; i < hull.size(); i++)
+			{
+				glm::vec2 offset = hull[i] - hull[e];
+				float along = glm::dot(offset, edge);
+				minimumU = std::min(minimumU, along);
+				maximumU = std::max(maximumU, along);
+				maximumV = std::max(maximumV, glm::dot(offset, normal));
+			}
+			float area = (maximumU - minimumU) * maximumV;
+			if (bestArea < 0.0f || area < bestArea)
+			{
+				bestArea = area;
+				direction = edge;
+			}
+		}
+		return bestArea >= 0.0f;
+	}
+};
+#endif
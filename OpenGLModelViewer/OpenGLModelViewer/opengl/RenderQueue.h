@@ -0,0 +1,199 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <opengl/model.h>
+#include <opengl/Timing.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+enum Render_Pass
+{
+	OPAQUE_PASS,      // front to back, so early depth testing rejects hidden fragments
+	TRANSPARENT_PASS  // back to front, for blending
+};
+
+// A draw as the queue sorts it. The key fields, from the most significant bit:
+//   pass 2 | shader 8 | material 16 | VAO 14 | depth 24
+// so draws are grouped by pass, then by the state that is most expensive to change, and ordered by depth last.
+struct RenderCommand
+{
+	uint64_t key;
+	unsigned int payload; // index of the mesh in the model
+};
+
+// timings and counters of the most recent frame
+struct RenderQueueStats
+{
+	unsigned int commands = 0;
+	unsigned int materialChanges = 0;
+	unsigned int vertexArrayChanges = 0;
+	double buildMilliseconds = 0.0;   // key generation
+	double sortMilliseconds = 0.0;
+	double submitMilliseconds = 0.0;  // replaying the sorted draws to GL
+};
+
+// Collects the draws of a frame as 64-bit sort keys, radix sorts them and replays them in key order. Material ids
+// are assigned once per model revision by comparing textures; every frame only the depths change. The command
+// arrays keep their capacity, so a frame allocates nothing once the queue has seen the model.
+class RenderQueue
+{
+public:
+	static const unsigned int SHADER_BITS = 8;
+	static const unsigned int MATERIAL_BITS = 16;
+	static const unsigned int VERTEX_ARRAY_BITS = 14;
+	static const unsigned int DEPTH_BITS = 24;
+
+	static uint64_t MakeKey(Render_Pass pass, unsigned int shader, unsigned int material, unsigned int vertexArray, float depth)
+	{
+		uint64_t depthBits = quantizeDepth(depth);
+		if (pass == TRANSPARENT_PASS)
+			depthBits = field(DEPTH_BITS) - depthBits;
+		uint64_t key = (uint64_t)pass;
+		key = (key << SHADER_BITS) | (shader & field(SHADER_BITS));
+		key = (key << MATERIAL_BITS) | (material & field(MATERIAL_BITS));
+		key = (key << VERTEX_ARRAY_BITS) | (vertexArray & field(VERTEX_ARRAY_BITS));
+		return (key << DEPTH_BITS) | depthBits;
+	}
+
+	// starts a new frame
+	void Clear()
+	{
+		commands.clear();
+	}
+
+	void Submit(uint64_t key, unsigned int payload)
+	{
+		RenderCommand command = { key, payload };
+		commands.push_back(command);
+	}
+
+	// submits the visible meshes of a model as opaque draws (all if 'visible' is null); modelView places the
+	// mesh centers in view space
+	void Submit(const Model& model, const Shader& shader, const glm::mat4& modelView, const unsigned char* visible = nullptr)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if (model.materialRevision != materialRevision)
+			assignMaterials(model);
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
+		{
+			if (visible != nullptr && !visible[i])
+				continue;
+			const Mesh& mesh = model.meshes[i];
+			float depth = -(modelView * glm::vec4(mesh.bounds.center, 1.0f)).z;
+			Submit(MakeKey(OPAQUE_PASS, shader.ID, materials[i], mesh.VAO, depth), i);
+		}
+		stats.buildMilliseconds = ElapsedMilliseconds(start);
+	}
+
+	void Sort()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		radixSort();
+		stats.sortMilliseconds = ElapsedMilliseconds(start);
+	}
+
+	// draws the sorted commands of a model submitted with Submit(model, ...)
+	void Draw(Model& model, const Shader& shader)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		const uint64_t depthMask = field(DEPTH_BITS);
+		const uint64_t materialMask = ~field(VERTEX_ARRAY_BITS + DEPTH_BITS);
+		stats.commands = (unsigned int)commands.size();
+		stats.materialChanges = stats.vertexArrayChanges = 0;
+		for (unsigned int i = 0; i < commands.size(); i++)
+		{
+			const RenderCommand& command = commands[i];
+			if (i == 0 || (command.key & materialMask) != (commands[i - 1].key & materialMask))
+				stats.materialChanges++;
+			if (i == 0 || (command.key & ~depthMask) != (commands[i - 1].key & ~depthMask))
+				stats.vertexArrayChanges++;
+			model.meshes[command.payload].Draw(shader);
+		}
+		stats.submitMilliseconds = ElapsedMilliseconds(start);
+	}
+
+	const std::vector<RenderCommand>& Commands() const { return commands; }
+	RenderQueueStats Stats() const { return stats; }
+
+private:
+	std::vector<RenderCommand> commands;
+	std::vector<RenderCommand> scratch;
+	// material id per mesh, and the revision it was assigned for
+	std::vector<unsigned int> materials;
+	unsigned int materialRevision = 0;
+	RenderQueueStats stats;
+
+	static uint64_t field(unsigned int bits)
+	{
+		return ((uint64_t)1 << bits) - 1;
+	}
+
+	// the bits of a non-negative float compare like the float itself; the top 24 keep 15 bits of mantissa
+	static uint64_t quantizeDepth(float depth)
+	{
+		if (!(depth > 0.0f))
+			return 0;
+		uint32_t bits;
+		std::memcpy(&bits, &depth, sizeof(bits));
+		return bits >> (32 - DEPTH_BITS);
+	}
+
+	// meshes with the same textures share an id, numbered in order of first use
+	void assignMaterials(const Model& model)
+	{
+		materials.assign(model.meshes.size(), 0);
+		unsigned int count = 0;
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
+		{
+			unsigned int j = 0;
+			while (j < i && !SameTextures(model.meshes[j].textures, model.meshes[i].textures))
+				j++;
+			materials[i] = j < i ? materials[j] : count++;
+		}
+		materialRevision = model.materialRevision;
+	}
+
+	// LSD radix sort on bytes. One pass builds all eight histograms, and bytes that are equal in every key
+	// (the pass and shader, usually) are skipped. Stable, so equal keys keep their submission order.
+	void radixSort()
+	{
+		size_t count = commands.size();
+		if (count < 2)
+			return;
+		unsigned int histograms[8][256];
+		std::memset(histograms, 0, sizeof(histograms));
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t key = commands[i].key;
+			for (unsigned int b = 0; b < 8; b++)
+				histograms[b][(key >> (b * 8)) & 0xFF]++;
+		}
+
+		scratch.resize(count);
+		RenderCommand* source = &commands[0];
+		RenderCommand* destination = &scratch[0];
+		for (unsigned int b = 0; b < 8; b++)
+		{
+			unsigned int* histogram = histograms[b];
+			if (histogram[(source[0].key >> (b * 8)) & 0xFF] == count)
+				continue;
+			unsigned int offset = 0;
+			for (unsigned int d = 0; d < 256; d++)
+			{
+				unsigned int digits = histogram[d];
+				histogram[d] = offset;
+				offset += digits;
+			}
+			for (size_t i = 0; i < count; i++)
+				destination[histogram[(source[i].key >> (b * 8)) & 0xFF]++] = source[i];
+			std::swap(source, destination);
+		}
+		if (source != &commands[0])
+			commands.swap(scratch);
+	}
+};
+#endif
@@ -0,0 +1,14 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// SSE is part of every x64 target, and of x86 builds with /arch:SSE or later (SSE2 with /arch:SSE2)
+#if defined(_M_X64) || defined(__SSE__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SIMD_SSE
+#include <xmmintrin.h>
+#endif
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#endif
@@ -0,0 +1,333 @@
+#ifndef TEXTURE_BAKER_H
+#define TEXTURE_BAKER_H
+
+#include <stb/stb_dxt.h>
+#include <stb/stb_image_resize.h>
+
+#include <opengl/MeshCache.h>
+#include <opengl/ThreadPool.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Bump whenever the container layout or the encoder output changes so stale bakes are rebuilt
+const uint32_t TEXTURE_CONTAINER_VERSION = 2;
+// block rows per encoder task
+const int BAKE_ROWS_PER_TASK = 8;
+
+struct BakedLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t offset;
+	uint32_t size;
+};
+
+// how a texture's texels are interpreted, which decides its mip filtering and compressed format
+enum Texture_Usage
+{
+	COLOR_TEXTURE,  // sRGB color: mips are filtered in linear light
+	LINEAR_TEXTURE, // data such as specular or roughness, filtered as stored
+	NORMAL_TEXTURE  // tangent-space normal map
+};
+
+inline Texture_Usage TextureUsageFor(const std::string& type)
+{
+	if (type == "texture_diffuse")
+		return COLOR_TEXTURE;
+	if (type == "texture_normal")
+		return NORMAL_TEXTURE;
+	return LINEAR_TEXTURE;
+}
+
+// a texture with its full mip chain, either as plain pixels (format 0, 'components' bytes per texel)
+// or encoded to a GL compressed format
+struct BakedTexture
+{
+	unsigned int format = 0; // GL_COMPRESSED_*, or 0 for uncompressed
+	int components = 0;
+	std::vector<BakedLevel> levels;
+	std::vector<unsigned char> data;
+};
+
+struct TextureContainerHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t format;
+	uint32_t levelCount;
+	uint64_t dataSize;
+	// followed by levelCount BakedLevel records and the block data
+};
+
+// Builds mip chains for decoded images with stb_image_resize, encodes them to BCn with stb_dxt and stores
+// the result in ./cache, keyed by the source file's hash.
+//   BC1  opaque RGB(A)              BC3  RGBA with alpha
+//   BC4  single channel             BC5  normal maps (X/Y only; a shader sampling them has to rebuild Z)
+// Encoding runs on the thread pool, one task per few block rows of a mip level.
+class TextureBaker
+{
+public:
+	// picks the compressed format for an image
+	static unsigned int ChooseFormat(const unsigned char* pixels, int width, int height, int nrComponents, bool normalMap)
+	{
+		if (normalMap && nrComponents >= 3)
+			return GL_COMPRESSED_RG_RGTC2;
+		if (nrComponents == 1)
+			return GL_COMPRESSED_RED_RGTC1;
+		if (nrComponents == 2 || nrComponents == 4)
+		{
+			size_t pixelCount = (size_t)width * height;
+			for (size_t i = 0; i < pixelCount; i++)
+			{
+				if (pixels[i * nrComponents + nrComponents - 1] != 255)
+					return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			}
+		}
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+
+	// builds the mip chain of an image down to 1x1. Each level is filtered from the previous one; color
+	// textures are filtered in linear light, and the edges wrap like the GL_REPEAT sampling.
+	static std::shared_ptr<BakedTexture> BuildMipChain(const unsigned char* pixels, int width, int height, int nrComponents, Texture_Usage usage)
+	{
+		std::shared_ptr<BakedTexture> chain = std::make_shared<BakedTexture>();
+		chain->components = nrComponents;
+		int alphaChannel = (nrComponents == 2 || nrComponents == 4) ? nrComponents - 1 : STBIR_ALPHA_CHANNEL_NONE;
+		stbir_colorspace space = usage == COLOR_TEXTURE ? STBIR_COLORSPACE_SRGB : STBIR_COLORSPACE_LINEAR;
+
+		for (;;)
+		{
+			BakedLevel info;
+			info.width = width;
+			info.height = height;
+			info.offset = (uint32_t)chain->data.size();
+			info.size = (uint32_t)((size_t)width * height * nrComponents);
+			chain->data.resize(info.offset + info.size);
+			if (chain->levels.empty())
+				std::memcpy(&chain->data[info.offset], pixels, info.size);
+			else
+			{
+				const BakedLevel& previous = chain->levels.back();
+				stbir_resize_uint8_generic(&chain->data[previous.offset], previous.width, previous.height, 0,
+					&chain->data[info.offset], width, height, 0, nrComponents, alphaChannel, 0,
+					STBIR_EDGE_WRAP, STBIR_FILTER_DEFAULT, space, nullptr);
+			}
+			chain->levels.push_back(info);
+
+			if (width == 1 && height == 1)
+				break;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		return chain;
+	}
+
+	// the compressed format Compress picks for an uncompressed mip chain
+	static unsigned int FormatFor(const BakedTexture& chain, Texture_Usage usage)
+	{
+		const BakedLevel& base = chain.levels[0];
+		return ChooseFormat(&chain.data[base.offset], base.width, base.height, chain.components, usage == NORMAL_TEXTURE);
+	}
+
+	// encodes every level of an uncompressed mip chain (maxThreads 0 = the whole pool)
+	static std::shared_ptr<BakedTexture> Compress(const BakedTexture& chain, Texture_Usage usage, unsigned int maxThreads = 0)
+	{
+		int nrComponents = chain.components;
+		std::shared_ptr<BakedTexture> baked = std::make_shared<BakedTexture>();
+		baked->format = FormatFor(chain, usage);
+
+		std::vector<unsigned char> rgba;
+		for (unsigned int l = 0; l < chain.levels.size(); l++)
+		{
+			const BakedLevel& source = chain.levels[l];
+			const unsigned char* pixels = &chain.data[source.offset];
+
+			// expand to RGBA for the encoder; stb_image's channel counts are grey, grey + alpha, RGB, RGBA
+			size_t pixelCount = (size_t)source.width * source.height;
+			rgba.resize(pixelCount * 4);
+			for (size_t i = 0; i < pixelCount; i++)
+			{
+				const unsigned char* src = pixels + i * nrComponents;
+				unsigned char* dst = &rgba[i * 4];
+				dst[0] = src[0];
+				dst[1] = nrComponents >= 3 ? src[1] : src[0];
+				dst[2] = nrComponents >= 3 ? src[2] : src[0];
+				dst[3] = nrComponents == 4 ? src[3] : (nrComponents == 2 ? src[1] : 255);
+			}
+
+			BakedLevel info;
+			info.width = source.width;
+			info.height = source.height;
+			info.offset = (uint32_t)baked->data.size();
+			info.size = (uint32_t)(blocksAcross(source.width) * blocksAcross(source.height) * BlockBytes(baked->format));
+			baked->levels.push_back(info);
+			baked->data.resize(info.offset + info.size);
+			encodeLevel(&rgba[0], source.width, source.height, baked->format, &baked->data[info.offset], maxThreads);
+		}
+		return baked;
+	}
+
+	// container file name for a source image; the usage changes filtering and format, so it is part of the key
+	static std::string PathFor(uint64_t sourceHash, Texture_Usage usage)
+	{
+		const char* suffixes[] = { "", "l", "n" };
+		char name[40];
+		snprintf(name, sizeof(name), "%016llx%s.ctex", (unsigned long long)sourceHash, suffixes[usage]);
+		return std::string(MESH_CACHE_DIRECTORY) + "/" + name;
+	}
+
+	// reads a container written by Write; returns null if it is missing, stale or damaged
+	static std::shared_ptr<BakedTexture> Load(const std::string& path, uint64_t sourceHash)
+	{
+		MappedFile file;
+		if (!file.Open(path) || file.Size() < sizeof(TextureContainerHeader))
+			return std::shared_ptr<BakedTexture>();
+
+		TextureContainerHeader header;
+		std::memcpy(&header, file.Data(), sizeof(header));
+		size_t levelsOffset = sizeof(TextureContainerHeader);
+		size_t dataOffset = levelsOffset + (size_t)header.levelCount * sizeof(BakedLevel);
+		if (std::memcmp(header.magic, "OMVT", 4) != 0 || header.version != TEXTURE_CONTAINER_VERSION || header.sourceHash != sourceHash ||
+			header.levelCount == 0 || header.levelCount > 32 || dataOffset + header.dataSize != file.Size())
+			return std::shared_ptr<BakedTexture>();
+
+		std::shared_ptr<BakedTexture> baked = std::make_shared<BakedTexture>();
+		baked->format = header.format;
+		baked->levels.resize(header.levelCount);
+		std::memcpy(&baked->levels[0], file.Data() + levelsOffset, header.levelCount * sizeof(BakedLevel));
+		for (unsigned int i = 0; i < baked->levels.size(); i++)
+		{
+			if ((uint64_t)baked->levels[i].offset + baked->levels[i].size > header.dataSize)
+				return std::shared_ptr<BakedTexture>();
+		}
+		baked->data.assign(file.Data() + dataOffset, file.Data() + dataOffset + header.dataSize);
+		return baked;
+	}
+
+	// writes the container via a temporary file, like the mesh cache
+	static bool Write(const std::string& path, uint64_t sourceHash, const BakedTexture& baked)
+	{
+		MeshCache::MakeDirectory(MESH_CACHE_DIRECTORY);
+
+		TextureContainerHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, "OMVT", 4);
+		header.version = TEXTURE_CONTAINER_VERSION;
+		header.sourceHash = sourceHash;
+		header.format = baked.format;
+		header.levelCount = (uint32_t)baked.levels.size();
+		header.dataSize = baked.data.size();
+
+		std::string tempPath = path + ".tmp";
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)baked.levels.data(), baked.levels.size() * sizeof(BakedLevel));
+		out.write((const char*)baked.data.data(), baked.data.size());
+		out.close();
+		if (!out)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+
+		std::remove(path.c_str());
+		return std::rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+
+	// bytes per 4x4 block
+	static size_t BlockBytes(unsigned int format)
+	{
+		return (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1) ? 8 : 16;
+	}
+
+	// whether the driver can sample the format. BC1/BC3 need EXT_texture_compression_s3tc and BC4/BC5
+	// ARB_texture_compression_rgtc; both are checked once, on the first call after glewInit.
+	static bool Supported(unsigned int format)
+	{
+		static const bool s3tc = GLEW_EXT_texture_compression_s3tc != 0;
+		static const bool rgtc = GLEW_ARB_texture_compression_rgtc != 0;
+		if (format == GL_COMPRESSED_RED_RGTC1 || format == GL_COMPRESSED_RG_RGTC2)
+			return rgtc;
+		return s3tc;
+	}
+
+	static const char* FormatName(unsigned int format)
+	{
+		switch (format)
+		{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+		case GL_COMPRESSED_RED_RGTC1: return "BC4";
+		case GL_COMPRESSED_RG_RGTC2: return "BC5";
+		default: return "?";
+		}
+	}
+
+private:
+	static size_t blocksAcross(int size)
+	{
+		return (size_t)(size + 3) / 4;
+	}
+
+	static void encodeLevel(const unsigned char* rgba, int width, int height, unsigned int format, unsigned char* output, unsigned int maxThreads)
+	{
+		size_t blockColumns = blocksAcross(width);
+		size_t blockRows = blocksAcross(height);
+		size_t bytes = BlockBytes(format);
+		size_t tasks = (blockRows + BAKE_ROWS_PER_TASK - 1) / BAKE_ROWS_PER_TASK;
+
+		ThreadPool::Shared().ParallelFor(tasks, [&](size_t task)
+		{
+			size_t firstRow = task * BAKE_ROWS_PER_TASK;
+			size_t lastRow = std::min(firstRow + BAKE_ROWS_PER_TASK, blockRows);
+			unsigned char block[64];
+			unsigned char channels[32];
+			for (size_t by = firstRow; by < lastRow; by++)
+			{
+				for (size_t bx = 0; bx < blockColumns; bx++)
+				{
+					// gather the 4x4 block, clamping at the edges ("you must pad")
+					for (int y = 0; y < 4; y++)
+					{
+						int sy = std::min((int)by * 4 + y, height - 1);
+						for (int x = 0; x < 4; x++)
+						{
+							int sx = std::min((int)bx * 4 + x, width - 1);
+							std::memcpy(&block[(y * 4 + x) * 4], &rgba[((size_t)sy * width + sx) * 4], 4);
+						}
+					}
+
+					unsigned char* dest = output + (by * blockColumns + bx) * bytes;
+					if (format == GL_COMPRESSED_RED_RGTC1)
+					{
+						for (int i = 0; i < 16; i++)
+							channels[i] = block[i * 4];
+						stb_compress_bc4_block(dest, channels);
+					}
+					else if (format == GL_COMPRESSED_RG_RGTC2)
+					{
+						for (int i = 0; i < 16; i++)
+						{
+							channels[i * 2] = block[i * 4];
+							channels[i * 2 + 1] = block[i * 4 + 1];
+						}
+						stb_compress_bc5_block(dest, channels);
+					}
+					else
+						stb_compress_dxt_block(dest, block, format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, STB_DXT_HIGHQUAL);
+				}
+			}
+		}, maxThreads);
+	}
+};
+#endif
@@ -0,0 +1,586 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <stb/stb_image.h>
+
+#include <opengl/GLState.h>
+#include <opengl/TextureBaker.h>
+#include <opengl/ThreadPool.h>
+#include <opengl/Timing.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// decoded pixels of one image file, or its BCn bake
+struct ImageData
+{
+	int width;
+	int height;
+	int nrComponents;
+	unsigned char *uc;
+	std::shared_ptr<const BakedTexture> baked; // set instead of uc for compressed textures
+
+	size_t Bytes() const { return baked ? baked->data.size() : (size_t)width * height * nrComponents; }
+};
+
+// an image file to decode and how its texels are used
+struct TextureRequest
+{
+	std::string filename;
+	Texture_Usage usage;
+};
+
+// counters shown in the UI
+struct TextureCacheStats
+{
+	size_t cpuBytes = 0;
+	size_t gpuBytes = 0;
+	unsigned int cpuImages = 0;
+	unsigned int gpuTextures = 0;
+	unsigned int referencedTextures = 0;
+	unsigned int files = 0;
+	unsigned int uniqueFiles = 0; // distinct file contents among 'files'
+	unsigned int decoding = 0;
+	unsigned int mipChains = 0;
+	double mipMilliseconds = 0.0;
+	unsigned int baked = 0;
+	double bakeMilliseconds = 0.0;
+	unsigned int cappedTextures = 0;
+	unsigned int hits = 0;
+	unsigned int misses = 0;
+	unsigned int cpuEvictions = 0;
+	unsigned int gpuEvictions = 0;
+};
+
+// Shares GL textures between models by file contents: an image is keyed by a hash of its bytes and its usage,
+// so the same picture under another name or folder is decoded and uploaded once. Models Acquire a texture and
+// Release it when they are done; textures nobody references stay resident for reuse until the GPU budget needs their space.
+// Decoded pixels are kept within the CPU budget so an evicted texture can be re-uploaded without decoding again.
+// Both budgets evict least recently used entries first. Preload and DecodeAsync may run on any thread;
+// everything else must run on the GL thread.
+class TextureCache
+{
+public:
+	size_t CpuBudgetBytes = 256u << 20;
+	size_t GpuBudgetBytes = 512u << 20;
+	// bake textures to BCn (see TextureBaker) and upload them compressed; applies to images decoded from now on
+	std::atomic<bool> CompressTextures{ true };
+	// textures larger than this skip their top mip levels when uploaded (0 = no limit)
+	int MaxTextureDimension = 0;
+
+	TextureCache() {}
+	~TextureCache()
+	{
+		// GL objects are left to the context; Clear() deletes them while it is still current
+		WaitForDecodes();
+		for (std::unordered_map<uint64_t, CpuEntry>::iterator it = images.begin(); it != images.end(); ++it)
+			stbi_image_free(it->second.image.uc);
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// the cache shared by every model
+	static TextureCache& Shared()
+	{
+		static TextureCache cache;
+		return cache;
+	}
+
+	// decodes an image without touching GL, so Acquire only has to upload it later
+	void Preload(const std::string& filename, Texture_Usage usage = COLOR_TEXTURE)
+	{
+		uint64_t sourceHash, key;
+		if (!contentKey(filename, usage, sourceHash, key))
+			return; // Acquire reports the failure when it retries on the GL thread
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (images.find(key) != images.end())
+				return;
+		}
+
+		ImageData image;
+		if (!decode(filename, sourceHash, usage, image))
+			return;
+
+		if (storeImage(key, image))
+			std::cout << "Texture decoded at: " << filename << std::endl;
+		else
+			stbi_image_free(image.uc); // another thread decoded it first
+	}
+
+	// decodes the images on the thread pool without waiting for them. Files are hashed on the calling thread;
+	// contents that are decoded, resident or already being decoded are skipped.
+	void DecodeAsync(const std::vector<TextureRequest>& requests)
+	{
+		for (unsigned int i = 0; i < requests.size(); i++)
+		{
+			const std::string& filename = requests[i].filename;
+			Texture_Usage usage = requests[i].usage;
+			uint64_t sourceHash, key;
+			if (!contentKey(filename, usage, sourceHash, key))
+				continue;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (images.find(key) != images.end() || residentKeys.count(key) != 0 || !decoding.insert(key).second)
+					continue;
+			}
+			ThreadPool::Shared().Submit([this, filename, usage, key]()
+			{
+				Preload(filename, usage);
+				std::lock_guard<std::mutex> lock(mutex);
+				decoding.erase(key);
+				if (decoding.empty())
+					decoded.notify_all();
+			});
+		}
+	}
+
+	// true while a DecodeAsync task for the file's contents hasn't finished; Acquire would have to decode it again
+	bool IsDecoding(const std::string& filename, Texture_Usage usage = COLOR_TEXTURE)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<std::string, uint64_t>::const_iterator found = sourceHashes.find(filename);
+		return found != sourceHashes.end() && decoding.count(keyFor(found->second, usage)) != 0;
+	}
+
+	// blocks until every DecodeAsync task has finished
+	void WaitForDecodes()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		decoded.wait(lock, [this]() { return decoding.empty(); });
+	}
+
+	// a 1x1 texture to bind while the real one is still decoding: flat for normal maps, mid grey otherwise
+	unsigned int Placeholder(const std::string& type)
+	{
+		bool normal = type == "texture_normal";
+		unsigned int& id = normal ? normalPlaceholder : colorPlaceholder;
+		if (id == 0)
+		{
+			unsigned char flatNormal[] = { 128, 128, 255, 255 };
+			unsigned char grey[] = { 128, 128, 128, 255 };
+			ImageData image = { 1, 1, 4, normal ? flatNormal : grey, nullptr };
+			size_t bytes;
+			id = upload(image, bytes);
+		}
+		return id;
+	}
+
+	// returns the GL texture for an image file, uploading it if it isn't resident, and adds a reference.
+	// Returns 0 if the image can't be loaded.
+	unsigned int Acquire(const std::string& filename, Texture_Usage usage = COLOR_TEXTURE)
+	{
+		uint64_t sourceHash, key;
+		if (!contentKey(filename, usage, sourceHash, key))
+		{
+			std::cout << "Texture failed to load at: " << filename << std::endl;
+			return 0;
+		}
+		std::unordered_map<uint64_t, GpuEntry>::iterator found = textures.find(key);
+		if (found != textures.end())
+		{
+			stats.hits++;
+			found->second.references++;
+			found->second.lastUse = ++clock;
+			return found->second.id;
+		}
+		stats.misses++;
+
+		ImageData image;
+		if (!lookupImage(key, image))
+		{
+			if (!decode(filename, sourceHash, usage, image))
+			{
+				std::cout << "Texture failed to load at: " << filename << std::endl;
+				return 0;
+			}
+			std::cout << "Texture loaded at: " << filename << std::endl;
+			if (!storeImage(key, image))
+				stbi_image_free(image.uc);
+			lookupImage(key, image);
+		}
+
+		GpuEntry entry;
+		entry.id = upload(image, entry.bytes);
+		entry.references = 1;
+		entry.lastUse = ++clock;
+		textures[key] = entry;
+		gpuBytes += entry.bytes;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			residentKeys.insert(key);
+		}
+
+		trimGpu();
+		trimCpu();
+		return entry.id;
+	}
+
+	// drops a reference taken by Acquire. The texture stays resident until the GPU budget evicts it.
+	void Release(const std::string& filename, Texture_Usage usage = COLOR_TEXTURE)
+	{
+		std::unordered_map<uint64_t, GpuEntry>::iterator found;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::unordered_map<std::string, uint64_t>::const_iterator hashed = sourceHashes.find(filename);
+			if (hashed == sourceHashes.end())
+				return;
+			found = textures.find(keyFor(hashed->second, usage));
+		}
+		if (found == textures.end() || found->second.references == 0)
+			return;
+		found->second.references--;
+		found->second.lastUse = ++clock;
+		trimGpu();
+	}
+
+	// evicts down to the current budgets, e.g. after they were lowered
+	void Trim()
+	{
+		trimGpu();
+		trimCpu();
+	}
+
+	// deletes every GL texture and decoded image; references held by models become invalid
+	void Clear()
+	{
+		for (std::unordered_map<uint64_t, GpuEntry>::iterator it = textures.begin(); it != textures.end(); ++it)
+			GLState::Current().DeleteTexture(it->second.id);
+		textures.clear();
+		gpuBytes = 0;
+		GLState::Current().DeleteTexture(colorPlaceholder);
+		GLState::Current().DeleteTexture(normalPlaceholder);
+		colorPlaceholder = normalPlaceholder = 0;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		residentKeys.clear();
+		for (std::unordered_map<uint64_t, CpuEntry>::iterator it = images.begin(); it != images.end(); ++it)
+			stbi_image_free(it->second.image.uc);
+		images.clear();
+		cpuBytes = 0;
+		sourceHashes.clear();
+	}
+
+	TextureCacheStats Stats()
+	{
+		// the decode counters are written by the pool threads under the mutex
+		std::lock_guard<std::mutex> lock(mutex);
+		TextureCacheStats result = stats;
+		result.gpuBytes = gpuBytes;
+		result.gpuTextures = (unsigned int)textures.size();
+		result.referencedTextures = 0;
+		for (std::unordered_map<uint64_t, GpuEntry>::const_iterator it = textures.begin(); it != textures.end(); ++it)
+			result.referencedTextures += it->second.references > 0;
+		result.cpuBytes = cpuBytes;
+		result.cpuImages = (unsigned int)images.size();
+		result.decoding = (unsigned int)decoding.size();
+		std::unordered_set<uint64_t> unique;
+		for (std::unordered_map<std::string, uint64_t>::const_iterator it = sourceHashes.begin(); it != sourceHashes.end(); ++it)
+			unique.insert(it->second);
+		result.files = (unsigned int)sourceHashes.size();
+		result.uniqueFiles = (unsigned int)unique.size();
+
+		return result;
+	}
+
+private:
+	struct CpuEntry
+	{
+		ImageData image;
+		size_t bytes;
+		uint64_t lastUse;
+	};
+
+	struct GpuEntry
+	{
+		unsigned int id;
+		size_t bytes;
+		unsigned int references;
+		uint64_t lastUse;
+	};
+
+	// content hashes of the files seen so far, decoded images, images being decoded and images with a GL texture,
+	// all keyed by contentKey; guarded by mutex since loader threads use them
+	std::mutex mutex;
+	std::unordered_map<std::string, uint64_t> sourceHashes;
+	std::unordered_map<uint64_t, CpuEntry> images;
+	size_t cpuBytes = 0;
+	std::unordered_set<uint64_t> decoding;
+	std::unordered_set<uint64_t> residentKeys;
+	std::condition_variable decoded;
+
+	// GL textures; only touched on the GL thread
+	std::unordered_map<uint64_t, GpuEntry> textures;
+	size_t gpuBytes = 0;
+	unsigned int colorPlaceholder = 0;
+	unsigned int normalPlaceholder = 0;
+
+	std::atomic<uint64_t> clock{ 0 };
+	TextureCacheStats stats;
+
+	// hashes the file's bytes the first time a path is seen and combines the hash with the usage, which
+	// changes how the image is filtered and baked
+	bool contentKey(const std::string& filename, Texture_Usage usage, uint64_t& sourceHash, uint64_t& key)
+	{
+		bool known;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::unordered_map<std::string, uint64_t>::const_iterator found = sourceHashes.find(filename);
+			known = found != sourceHashes.end();
+			if (known)
+				sourceHash = found->second;
+		}
+		if (!known)
+		{
+			if (!MeshCache::HashSource(filename, sourceHash))
+				return false;
+			std::lock_guard<std::mutex> lock(mutex);
+			sourceHashes[filename] = sourceHash;
+		}
+		key = keyFor(sourceHash, usage);
+		return true;
+	}
+
+	static uint64_t keyFor(uint64_t sourceHash, Texture_Usage usage)
+	{
+		unsigned char usageByte = (unsigned char)usage;
+		return HashBytes(&usageByte, 1, sourceHash);
+	}
+
+	// returns false if the image was already stored, in which case the caller still owns its pixels
+	bool storeImage(uint64_t key, const ImageData& image)
+	{
+		CpuEntry entry;
+		entry.image = image;
+		entry.bytes = image.Bytes();
+		entry.lastUse = ++clock;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!images.insert(std::make_pair(key, entry)).second)
+			return false;
+		cpuBytes += entry.bytes;
+		return true;
+	}
+
+	bool lookupImage(uint64_t key, ImageData& image)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<uint64_t, CpuEntry>::iterator found = images.find(key);
+		if (found == images.end())
+			return false;
+		found->second.lastUse = ++clock;
+		image = found->second.image;
+		return true;
+	}
+
+	// deletes unreferenced GL textures, least recently used first, until the GPU budget is met
+	void trimGpu()
+	{
+		while (gpuBytes > GpuBudgetBytes)
+		{
+			std::unordered_map<uint64_t, GpuEntry>::iterator victim = textures.end();
+			for (std::unordered_map<uint64_t, GpuEntry>::iterator it = textures.begin(); it != textures.end(); ++it)
+			{
+				if (it->second.references == 0 && (victim == textures.end() || it->second.lastUse < victim->second.lastUse))
+					victim = it;
+			}
+			if (victim == textures.end())
+				return; // everything left is in use
+			GLState::Current().DeleteTexture(victim->second.id);
+			gpuBytes -= victim->second.bytes;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				residentKeys.erase(victim->first);
+			}
+			textures.erase(victim);
+			stats.gpuEvictions++;
+		}
+	}
+
+	// frees decoded images, least recently used first, until the CPU budget is met. Images that were uploaded
+	// are only needed again if their texture gets evicted, and then they can be decoded from the file.
+	void trimCpu()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (cpuBytes > CpuBudgetBytes && !images.empty())
+		{
+			std::unordered_map<uint64_t, CpuEntry>::iterator victim = images.begin();
+			for (std::unordered_map<uint64_t, CpuEntry>::iterator it = images.begin(); it != images.end(); ++it)
+			{
+				if (it->second.lastUse < victim->second.lastUse)
+					victim = it;
+			}
+			stbi_image_free(victim->second.image.uc);
+			cpuBytes -= victim->second.bytes;
+			images.erase(victim);
+			stats.cpuEvictions++;
+		}
+	}
+
+	// loads the image's bake from the cache directory, or decodes the file with stb_image and builds its mip
+	// chain (baking it when CompressTextures is on and the driver supports the format; otherwise the chain is
+	// uploaded uncompressed). Safe to call from any thread.
+	bool decode(const std::string& filename, uint64_t sourceHash, Texture_Usage usage, ImageData& image)
+	{
+		image.uc = nullptr;
+		image.baked.reset();
+		bool compress = CompressTextures;
+		if (compress)
+		{
+			std::shared_ptr<BakedTexture> baked = TextureBaker::Load(TextureBaker::PathFor(sourceHash, usage), sourceHash);
+			if (baked && TextureBaker::Supported(baked->format))
+			{
+				image.width = (int)baked->levels[0].width;
+				image.height = (int)baked->levels[0].height;
+				image.nrComponents = 0;
+				image.baked = baked;
+				return true;
+			}
+		}
+
+		unsigned char* pixels = stbi_load(filename.c_str(), &image.width, &image.height, &image.nrComponents, 0);
+		if (!pixels)
+			return false;
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::shared_ptr<BakedTexture> chain = TextureBaker::BuildMipChain(pixels, image.width, image.height, image.nrComponents, usage);
+		stbi_image_free(pixels);
+		double mipMilliseconds = ElapsedMilliseconds(start);
+		image.baked = chain;
+
+		double bakeMilliseconds = 0.0;
+		compress = compress && TextureBaker::Supported(TextureBaker::FormatFor(*chain, usage));
+		if (compress)
+		{
+			start = std::chrono::high_resolution_clock::now();
+			std::shared_ptr<BakedTexture> baked = TextureBaker::Compress(*chain, usage);
+			bakeMilliseconds = ElapsedMilliseconds(start);
+			if (!TextureBaker::Write(TextureBaker::PathFor(sourceHash, usage), sourceHash, *baked))
+				std::cout << "ERROR::TEXTURE_BAKER:: could not write the bake of " << filename << std::endl;
+			std::cout << "Texture baked to " << TextureBaker::FormatName(baked->format) << " in " << bakeMilliseconds << " ms: " << filename << std::endl;
+			image.baked = baked;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.mipChains++;
+		stats.mipMilliseconds += mipMilliseconds;
+		if (compress)
+		{
+			stats.baked++;
+			stats.bakeMilliseconds += bakeMilliseconds;
+		}
+		return true;
+	}
+
+	// creates the GL texture. Mip chains start at the first level that fits MaxTextureDimension; 'bytes'
+	// receives the size of what was uploaded.
+	unsigned int upload(const ImageData& image, size_t& bytes)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GLState::Current().BindTexture(textureID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		if (image.baked)
+		{
+			const BakedTexture& baked = *image.baked;
+			unsigned int first = 0;
+			while (MaxTextureDimension > 0 && first + 1 < baked.levels.size() &&
+				std::max(baked.levels[first].width, baked.levels[first].height) > (uint32_t)MaxTextureDimension)
+				first++;
+			if (first > 0)
+				stats.cappedTextures++;
+
+			GLenum format = pixelFormat(baked.components);
+			bytes = 0;
+			for (unsigned int i = first; i < baked.levels.size(); i++)
+			{
+				const BakedLevel& level = baked.levels[i];
+				if (baked.format != 0)
+					glCompressedTexImage2D(GL_TEXTURE_2D, i - first, baked.format, level.width, level.height, 0, level.size, &baked.data[level.offset]);
+				else
+					glTexImage2D(GL_TEXTURE_2D, i - first, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, &baked.data[level.offset]);
+				bytes += level.size;
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (int)(baked.levels.size() - first) - 1);
+		}
+		else
+		{
+			GLenum format = pixelFormat(image.nrComponents);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.uc);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			// the full mip chain adds a third to the base level
+			bytes = image.Bytes() * 4 / 3;
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		return textureID;
+	}
+
+	static GLenum pixelFormat(int nrComponents)
+	{
+		if (nrComponents == 1)
+			return GL_RED;
+		if (nrComponents == 2)
+			return GL_RG;
+		if (nrComponents == 3)
+			return GL_RGB;
+		return GL_RGBA;
+	}
+};
+
+// The textures one model has acquired from the shared cache; releases them when cleared or destroyed.
+// Move-only, so a model's references are never released twice.
+class TextureReferences
+{
+public:
+	TextureReferences() {}
+	~TextureReferences() { Clear(); }
+
+	TextureReferences(TextureReferences&& other) : acquired(std::move(other.acquired)) { other.acquired.clear(); }
+	TextureReferences& operator=(TextureReferences&& other)
+	{
+		if (this != &other)
+		{
+			Clear();
+			acquired = std::move(other.acquired);
+			other.acquired.clear();
+		}
+		return *this;
+	}
+
+	unsigned int Acquire(const std::string& filename, Texture_Usage usage = COLOR_TEXTURE)
+	{
+		unsigned int id = TextureCache::Shared().Acquire(filename, usage);
+		if (id != 0)
+			acquired.push_back(std::make_pair(filename, usage));
+		return id;
+	}
+
+	void Clear()
+	{
+		for (unsigned int i = 0; i < acquired.size(); i++)
+			TextureCache::Shared().Release(acquired[i].first, acquired[i].second);
+		acquired.clear();
+	}
+
+private:
+	std::vector<std::pair<std::string, Texture_Usage>> acquired;
+};
+#endif
@@ -0,0 +1,142 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for the CPU-heavy loading work (mesh conversion, texture decoding, ...).
+// GL calls must never be made from a pool thread; the GL context only lives on the render thread.
+class ThreadPool
+{
+public:
+	// threadCount == 0 uses one worker per hardware thread, minus the calling thread
+	explicit ThreadPool(unsigned int threadCount = 0)
+	{
+		if (threadCount == 0)
+		{
+			unsigned int hardware = std::thread::hardware_concurrency();
+			threadCount = hardware > 1 ? hardware - 1 : 1;
+		}
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.push_back(std::thread([this]() { workerLoop(); }));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// the pool shared by the whole application
+	static ThreadPool& Shared()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	unsigned int Size() const { return (unsigned int)workers.size(); }
+
+	// queues a task to run on a worker thread
+	void Submit(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+	}
+
+	// runs body(i) for every i in [0, count) and returns once all of them are done. The calling thread
+	// takes part in the work, so this is safe to call from inside another pool task.
+	// maxThreads limits the number of threads working on the loop (0 = pool size + caller).
+	void ParallelFor(size_t count, std::function<void(size_t)> body, unsigned int maxThreads = 0)
+	{
+		if (count == 0)
+			return;
+		unsigned int helpers = maxThreads == 0 ? Size() : std::min(Size(), maxThreads - 1);
+		helpers = (unsigned int)std::min<size_t>(helpers, count - 1);
+		if (helpers == 0)
+		{
+			for (size_t i = 0; i < count; i++)
+				body(i);
+			return;
+		}
+
+		std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+		state->count = count;
+		state->body = std::move(body);
+		for (unsigned int i = 0; i < helpers; i++)
+			Submit([state]() { state->Run(); });
+		state->Run();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->done.wait(lock, [&state]() { return state->completed == state->count; });
+	}
+
+private:
+	// shared by the helpers of one ParallelFor; helpers that start late just find no work left
+	struct ParallelForState
+	{
+		size_t count = 0;
+		std::function<void(size_t)> body;
+		std::atomic<size_t> next{ 0 };
+		size_t completed = 0;
+		std::mutex mutex;
+		std::condition_variable done;
+
+		void Run()
+		{
+			size_t finished = 0;
+			for (size_t i = next++; i < count; i = next++)
+			{
+				body(i);
+				finished++;
+			}
+			if (finished == 0)
+				return;
+			std::lock_guard<std::mutex> lock(mutex);
+			completed += finished;
+			if (completed == count)
+				done.notify_all();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty())
+					return;
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
+#endif
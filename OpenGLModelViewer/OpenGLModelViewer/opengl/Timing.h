@@ -0,0 +1,11 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+
+// wall time since 'start', for the timings the loaders, cullers and caches report
+inline double ElapsedMilliseconds(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+#endif
@@ -0,0 +1,116 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include "GLState.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+// binding points of the uniform blocks in material.vert/.frag and lamp.vert
+const unsigned int CAMERA_BLOCK_BINDING = 0;
+const unsigned int LIGHT_BLOCK_BINDING = 1;
+const unsigned int MATERIAL_BLOCK_BINDING = 2;
+const unsigned int DRAW_BLOCK_BINDING = 3;
+
+// std140 mirrors of the shader blocks: a vec3 starts on 16 bytes and a following scalar packs into its 4th
+// component, bools are 4-byte ints, and each block is padded to a multiple of 16 bytes since GL may report that as
+// the block size. Fill them with = {} so the padding compares equal in UniformBuffer::Update.
+
+// per frame
+struct CameraBlock
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 viewPos;
+};
+static_assert(offsetof(CameraBlock, view) == 64, "std140: Camera.view");
+static_assert(offsetof(CameraBlock, viewPos) == 128, "std140: Camera.viewPos");
+
+// changes only when the UI edits it
+struct LightBlock
+{
+	glm::vec4 position;
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec3 specular;
+	int blinn;
+};
+static_assert(offsetof(LightBlock, ambient) == 16, "std140: Light.ambient");
+static_assert(offsetof(LightBlock, diffuse) == 32, "std140: Light.diffuse");
+static_assert(offsetof(LightBlock, specular) == 48, "std140: Light.specular");
+static_assert(offsetof(LightBlock, blinn) == 60, "std140: Light.blinn");
+static_assert(sizeof(LightBlock) == 64, "std140: Light size");
+
+struct MaterialBlock
+{
+	glm::vec4 ambient;
+	glm::vec3 specular;
+	float shininess;
+};
+static_assert(offsetof(MaterialBlock, specular) == 16, "std140: Material.specular");
+static_assert(offsetof(MaterialBlock, shininess) == 28, "std140: Material.shininess");
+static_assert(sizeof(MaterialBlock) == 32, "std140: Material size");
+
+// per draw; the normal matrix is computed once on the CPU instead of per vertex
+struct DrawBlock
+{
+	glm::mat4 model;
+	glm::mat4 normalMatrix; // upper 3x3 used
+};
+static_assert(offsetof(DrawBlock, normalMatrix) == 64, "std140: Draw.normalMatrix");
+
+// A uniform buffer holding one block, bound to a fixed binding point. Update only uploads when the data differs
+// from what the buffer already holds, so blocks that rarely change cost nothing per frame.
+template <typename Block>
+class UniformBuffer
+{
+public:
+	explicit UniformBuffer(unsigned int binding) : binding(binding) {}
+	~UniformBuffer() { Clear(); }
+
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+	// returns true if the data was uploaded
+	bool Update(const Block& data)
+	{
+		if (buffer == 0)
+		{
+			glGenBuffers(1, &buffer);
+			GLState::Current().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &data, GL_DYNAMIC_DRAW);
+			GLState::Current().BindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+		}
+		else if (std::memcmp(&current, &data, sizeof(Block)) == 0)
+		{
+			skipped++;
+			return false;
+		}
+		else
+		{
+			GLState::Current().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &data);
+		}
+		current = data;
+		uploads++;
+		return true;
+	}
+
+	// deletes the buffer; call while the GL context is current
+	void Clear()
+	{
+		GLState::Current().DeleteBuffer(buffer);
+		buffer = 0;
+	}
+
+	unsigned int uploads = 0;
+	unsigned int skipped = 0;
+
+private:
+	unsigned int binding;
+	unsigned int buffer = 0;
+	Block current;
+};
+#endif
@@ -1,9 +1,13 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
@@ -1,30 +1,35 @@
 #version 330 core
 out vec4 FragColor;
 
-struct Material {
-    vec3 ambient;
-    vec3 specular;    
-    float shininess;
-}; 
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
 
-struct Light {
+layout (std140) uniform Light {
     vec3 position;
     vec3 ambient;
     vec3 diffuse;
     vec3 specular;
-};
+    bool blinn;
+} light;
+
+layout (std140) uniform Material {
+    vec3 ambient;
+    vec3 specular;
+    float shininess;
+} material;
 
 in VS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    vec3 Tangent;
+    vec3 Bitangent;
 } fs_in;
   
 uniform sampler2D diffuseTexture;
-uniform vec3 viewPos;
-uniform Material material;
-uniform Light light;
-uniform bool blinn;
 
 void main()
 {
@@ -42,7 +47,7 @@ void main()
     vec3 viewDir = normalize(viewPos - fs_in.FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
 	float spec = 0.0;
-    if(blinn)
+    if(light.blinn)
     {
         vec3 halfwayDir = normalize(lightDir + viewDir);  
         spec = pow(max(dot(norm, halfwayDir), 0.0), material.shininess);
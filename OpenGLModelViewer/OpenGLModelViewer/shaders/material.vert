@@ -1,24 +1,67 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+layout (location = 0) in vec4 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec3 aTangent;
+layout (location = 4) in vec3 aBitangent;
 
 // declare an interface block; see 'Advanced GLSL' for what these are.
 out VS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    vec3 Tangent;
+    vec3 Bitangent;
 } vs_out;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+// the normal matrix is transpose(inverse(mat3(model))), computed on the CPU
+layout (std140) uniform Draw {
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+// PackedVertex input (see Mesh.h): positions relative to the mesh bounds, octahedral normal and tangent
+// as raw shorts, the bitangent sign in aPos.w. The bounds are per-draw attributes so batched draws can
+// fetch them through their instance index.
+uniform bool packedVertices;
+layout (location = 5) in vec3 aPositionOffset;
+layout (location = 6) in vec3 aPositionScale;
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec2 e = encoded / 32767.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
-    vs_out.Normal = mat3(transpose(inverse(model))) * aNormal; 
-    vs_out.TexCoords = aTexCoords; 
-    
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    vec3 position = aPos.xyz;
+    vec3 normal = aNormal;
+    vec3 tangent = aTangent;
+    vec3 bitangent = aBitangent;
+    if (packedVertices)
+    {
+        position = aPositionOffset + aPos.xyz * aPositionScale;
+        normal = decodeOctahedral(aNormal.xy);
+        tangent = decodeOctahedral(aTangent.xy);
+        bitangent = cross(normal, tangent) * (aPos.w * 2.0 - 1.0);
+    }
+
+    vs_out.FragPos = vec3(model * vec4(position, 1.0));
+    vs_out.Normal = mat3(normalMatrix) * normal;
+    vs_out.TexCoords = aTexCoords;
+    vs_out.Tangent = mat3(model) * tangent;
+    vs_out.Bitangent = mat3(model) * bitangent;
+
+    gl_Position = projection * view * model * vec4(position, 1.0);
+}
@@ -0,0 +1,49 @@
+// Checks OcclusionBuffer on the CPU: a quad is drawn as the only occluder and boxes behind it, in front of it
+// and across its edge are tested against it. Not part of the viewer project; build and run it from this folder:
+//   g++ -std=c++14 -O2 -I. -I../ThirdParty/glm/include tests/OcclusionBufferTest.cpp -pthread && ./a.out
+//   cl /EHsc /O2 /I. /I..\ThirdParty\glm\include tests\OcclusionBufferTest.cpp && OcclusionBufferTest.exe
+#include <opengl/OcclusionBuffer.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static int failures = 0;
+
+static void expect(bool condition, const char* name)
+{
+	cout << (condition ? "PASS " : "FAIL ") << name << endl;
+	if (!condition)
+		failures++;
+}
+
+int main()
+{
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 2.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 viewProjection = projection * view;
+
+	// a quad over [-1, 1] x [-1, 1] at z = 0, facing the camera
+	vector<glm::vec3> quad;
+	quad.push_back(glm::vec3(-1.0f, -1.0f, 0.0f));
+	quad.push_back(glm::vec3(1.0f, -1.0f, 0.0f));
+	quad.push_back(glm::vec3(1.0f, 1.0f, 0.0f));
+	quad.push_back(glm::vec3(-1.0f, -1.0f, 0.0f));
+	quad.push_back(glm::vec3(1.0f, 1.0f, 0.0f));
+	quad.push_back(glm::vec3(-1.0f, 1.0f, 0.0f));
+	Occluder occluder = { &quad[0], quad.size() / 3, viewProjection };
+
+	OcclusionBuffer buffer;
+	buffer.Render(vector<Occluder>(1, occluder));
+	expect(buffer.Stats().rasterizedTriangles == 2, "both quad triangles are rasterized");
+
+	expect(buffer.IsOccluded(glm::vec3(-0.5f, -0.5f, -2.0f), glm::vec3(0.5f, 0.5f, -1.0f), viewProjection), "box behind the quad is hidden");
+	expect(!buffer.IsOccluded(glm::vec3(-0.5f, -0.5f, 1.0f), glm::vec3(0.5f, 0.5f, 2.0f), viewProjection), "box in front of the quad is visible");
+	expect(!buffer.IsOccluded(glm::vec3(0.5f, -0.5f, -2.0f), glm::vec3(1.5f, 0.5f, -1.0f), viewProjection), "box behind the quad's edge is visible");
+
+	cout << (failures ? "FAILED" : "OK") << endl;
+	return failures ? 1 : 0;
+}